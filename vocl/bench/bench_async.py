@@ -0,0 +1,61 @@
+#!/usr/bin/env python
+
+'''
+Event loop responsiveness of an asyncio server calling heavy cv2 functions.
+
+A heartbeat task measures how late the event loop wakes it up, while a number
+of requests each blur a large frame. Three ways of making the call are compared:
+directly from the coroutine (blocks the loop), through loop.run_in_executor()
+with a thread pool, and through the generated cv2.<name>_async() wrapper.
+
+Usage (Python 3.7+):
+    bench_async.py [-n REQUESTS] [-c CONCURRENCY]
+'''
+
+from __future__ import print_function
+import time, argparse, asyncio
+import numpy as np
+import cv2
+
+async def heartbeat(lags, stop, period=0.001):
+    while not stop.is_set():
+        t = time.perf_counter()
+        await asyncio.sleep(period)
+        lags.append(time.perf_counter() - t - period)
+
+async def serve(mode, frame, nrequests, concurrency):
+    loop = asyncio.get_running_loop()
+    sem = asyncio.Semaphore(concurrency)
+
+    async def request():
+        async with sem:
+            if mode == "direct":
+                return cv2.GaussianBlur(frame, (15, 15), 0)
+            if mode == "executor":
+                return await loop.run_in_executor(None, cv2.GaussianBlur, frame, (15, 15), 0)
+            return await asyncio.wrap_future(cv2.GaussianBlur_async(frame, (15, 15), 0))
+
+    lags, stop = [], asyncio.Event()
+    hb = asyncio.ensure_future(heartbeat(lags, stop))
+    t = time.perf_counter()
+    await asyncio.gather(*[request() for i in range(nrequests)])
+    elapsed = time.perf_counter() - t
+    stop.set()
+    await hb
+    return elapsed, np.array(lags or [0.0]) * 1e3
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", "--requests", type=int, default=200)
+    parser.add_argument("-c", "--concurrency", type=int, default=8)
+    args = parser.parse_args()
+
+    frame = np.random.randint(0, 255, (1080, 1920, 3), np.uint8)
+    print("%-10s %12s %14s %14s" % ("mode", "requests/s", "lag p50, ms", "lag max, ms"))
+    for mode in ["direct", "executor", "async"]:
+        elapsed, lags = asyncio.run(serve(mode, frame, args.requests, args.concurrency))
+        print("%-10s %12.1f %14.3f %14.3f" % (mode, args.requests / elapsed,
+              np.percentile(lags, 50), lags.max()))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,57 @@
+#!/usr/bin/env python
+
+'''
+Per-call overhead of a Python loop over many small operations compared with
+recording them into a cv2.batch() command buffer and running it at once.
+
+The case is resizing a few hundred crops of one frame (e.g. detections) to the
+input size of a classifier. The loop converts the arguments, releases the GIL
+and converts the result for each crop; the batch converts the arguments while
+recording, then runs all the resizes on the native thread pool with the GIL
+released once.
+
+Usage:
+    bench_batch.py [-n CROPS] [-r REPEAT]
+'''
+
+from __future__ import print_function
+import timeit, argparse
+import numpy as np
+import cv2
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", "--crops", type=int, default=500)
+    parser.add_argument("-r", "--repeat", type=int, default=20)
+    args = parser.parse_args()
+
+    rng = np.random.RandomState(0)
+    frame = rng.randint(0, 255, (1080, 1920, 3)).astype(np.uint8)
+    crops = []
+    for i in range(args.crops):
+        w, h = rng.randint(24, 256, 2)
+        x, y = rng.randint(0, 1920 - w), rng.randint(0, 1080 - h)
+        crops.append(frame[y:y+h, x:x+w])
+    dsize = (64, 64)
+
+    def loop():
+        return [cv2.resize(c, dsize) for c in crops]
+
+    def batch():
+        b = cv2.batch()
+        for c in crops:
+            b.resize(c, dsize)
+        return b.run()
+
+    for r1, r2 in zip(loop(), batch()):
+        assert np.array_equal(r1, r2)
+
+    t_loop = min(timeit.repeat(loop, number=1, repeat=args.repeat))
+    t_batch = min(timeit.repeat(batch, number=1, repeat=args.repeat))
+    print("%d crops -> %dx%d" % (args.crops, dsize[0], dsize[1]))
+    print("%-12s %10.3f ms  %8.2f us/crop" % ("loop", t_loop * 1e3, t_loop * 1e6 / args.crops))
+    print("%-12s %10.3f ms  %8.2f us/crop" % ("batch", t_batch * 1e3, t_batch * 1e6 / args.crops))
+    print("speedup      %10.2fx" % (t_loop / t_batch))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,616 @@
+/*
+  Benchmark of the conversion layer and of the generated wrappers.
+
+  The harness embeds CPython and compiles the cv2 module into itself (cv2.cpp is included
+  below, with PYOPENCV_ENABLE_STATS), so the converters are timed directly, without the
+  Python call overhead:
+
+    to_mat/<dtype>/<shape>/<layout>     pyopencv_to(Mat) of contiguous, transposed,
+                                        flipped (negative stride) and strided arrays
+    from_mat/<dtype>/<shape>/<alloc>    pyopencv_from(Mat) of a Mat allocated by numpy
+                                        (no copy) and by OpenCV (copied)
+    to_vec/<type>/<source>/<n>          pyopencvVecConverter from arrays and lists
+    from_vec/<type>/<n>                 and back
+    call/<function>/<args>              the generated wrappers, called from C as Python does
+    threads/<function>/<args>/<n>       throughput of the GIL-released calls made from n threads
+
+  Besides the time per call (median and minimum of the repeats) every case reports the Python
+  allocations (PyMem hooks), the C++ allocations (operator new), the numpy arrays created by
+  NumpyAllocator and the copies made by the converters, per call. The results are written as
+  JSON; with --baseline the results are compared with a previous run and the exit code is 1
+  if any case got slower by more than the tolerance.
+
+  Build (Python 3.4+), with the headers generated by gen2.py for the module in <gen>:
+    g++ -O2 -std=c++11 -I<gen> -I.. $(python3-config --includes) \
+        -I$(python3 -c "import numpy; print(numpy.get_include())") bench_convert.cpp -o bench_convert \
+        $(python3-config --ldflags --embed) -lopencv_imgproc -lopencv_core ...
+    (the same OpenCV libraries as the cv2 module)
+
+  Usage:
+    bench_convert [--json FILE] [--baseline FILE] [--tolerance FRACTION] [--filter TEXT]
+                  [--min-time SECONDS] [--threads N]
+*/
+
+#define PYOPENCV_ENABLE_STATS
+#include "../cv2.cpp"
+
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <new>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+///////////////////////////////////////////////////////////////////////////////////////
+// allocation counters
+
+static std::atomic<size_t> bench_cxx_allocs(0);
+static std::atomic<size_t> bench_py_allocs(0);
+
+void* operator new(size_t n)
+{
+    bench_cxx_allocs.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(n ? n : 1);
+    if( !p )
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+static PyMemAllocatorEx bench_pymem_orig[2];
+
+static void* bench_pymem_malloc(void* ctx, size_t n)
+{
+    PyMemAllocatorEx* a = (PyMemAllocatorEx*)ctx;
+    bench_py_allocs.fetch_add(1, std::memory_order_relaxed);
+    return a->malloc(a->ctx, n);
+}
+
+static void* bench_pymem_calloc(void* ctx, size_t nelem, size_t elsize)
+{
+    PyMemAllocatorEx* a = (PyMemAllocatorEx*)ctx;
+    bench_py_allocs.fetch_add(1, std::memory_order_relaxed);
+    return a->calloc(a->ctx, nelem, elsize);
+}
+
+static void* bench_pymem_realloc(void* ctx, void* p, size_t n)
+{
+    PyMemAllocatorEx* a = (PyMemAllocatorEx*)ctx;
+    if( !p )
+        bench_py_allocs.fetch_add(1, std::memory_order_relaxed);
+    return a->realloc(a->ctx, p, n);
+}
+
+static void bench_pymem_free(void* ctx, void* p)
+{
+    PyMemAllocatorEx* a = (PyMemAllocatorEx*)ctx;
+    a->free(a->ctx, p);
+}
+
+// the hooks forward to the original allocators, so the blocks allocated before are freed correctly
+static void bench_hook_pymem()
+{
+    const PyMemAllocatorDomain domains[] = { PYMEM_DOMAIN_MEM, PYMEM_DOMAIN_OBJ };
+    for( int i = 0; i < 2; i++ )
+    {
+        PyMem_GetAllocator(domains[i], &bench_pymem_orig[i]);
+        PyMemAllocatorEx hook = { &bench_pymem_orig[i], bench_pymem_malloc, bench_pymem_calloc,
+                                  bench_pymem_realloc, bench_pymem_free };
+        PyMem_SetAllocator(domains[i], &hook);
+    }
+}
+
+enum { BENCH_PY_ALLOCS, BENCH_CXX_ALLOCS, BENCH_NUMPY_ALLOCS, BENCH_COPIES, BENCH_BYTES_COPIED, BENCH_NCOUNTERS };
+
+static const char* bench_counter_names[BENCH_NCOUNTERS] =
+    { "py_allocs", "cxx_allocs", "numpy_allocs", "copies", "bytes_copied" };
+
+static void bench_counters(size_t* c)
+{
+    c[BENCH_PY_ALLOCS] = bench_py_allocs.load();
+    c[BENCH_CXX_ALLOCS] = bench_cxx_allocs.load();
+    c[BENCH_NUMPY_ALLOCS] = pyopencv_stats[PYOPENCV_STAT_NUMPY_ALLOCS].load();
+    c[BENCH_COPIES] = pyopencv_stats[PYOPENCV_STAT_COPIES].load();
+    c[BENCH_BYTES_COPIED] = pyopencv_stats[PYOPENCV_STAT_BYTES_COPIED].load();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+struct BenchResult
+{
+    std::string name;
+    double ns, nsMin;
+    size_t iterations;
+    double perCall[BENCH_NCOUNTERS];
+    int threads;
+    double speedup;
+};
+
+typedef std::function<bool()> BenchFunc;
+typedef std::chrono::steady_clock BenchClock;
+
+class Bench
+{
+public:
+    Bench() : minTime(0.1), maxThreads(std::max((int)std::thread::hardware_concurrency(), 1)),
+              tolerance(0.1), env(0) {}
+
+    bool init();
+    bool want(const std::string& name) const { return filter.empty() || name.find(filter) != std::string::npos; }
+    PyObject* eval(const std::string& expr);
+
+    void measure(const std::string& name, const BenchFunc& func);
+    void measureThreads(const std::string& name, PyObject* func, PyObject* args);
+
+    void writeJSON(FILE* f) const;
+    int compare(const std::string& path) const;
+
+    double minTime;
+    int maxThreads;
+    double tolerance;
+    std::string filter;
+    std::vector<BenchResult> results;
+
+protected:
+    void fail(const std::string& name);
+    PyObject* env;
+};
+
+bool Bench::init()
+{
+    env = PyDict_New();
+    if( !env || PyDict_SetItemString(env, "__builtins__", PyEval_GetBuiltins()) < 0 )
+        return false;
+    PyObject* r = PyRun_String("import numpy as np\nimport cv2\n", Py_file_input, env, env);
+    Py_XDECREF(r);
+    return r != 0;
+}
+
+PyObject* Bench::eval(const std::string& expr)
+{
+    PyObject* r = PyRun_String(expr.c_str(), Py_eval_input, env, env);
+    if( !r )
+        fail(expr);
+    return r;
+}
+
+void Bench::fail(const std::string& name)
+{
+    fprintf(stderr, "%s: failed\n", name.c_str());
+    if( PyErr_Occurred() )
+        PyErr_Print();
+}
+
+// the number of iterations is doubled until a run takes at least minTime/nrepeats,
+// then the time per call is the median of nrepeats runs
+void Bench::measure(const std::string& name, const BenchFunc& func)
+{
+    const int nrepeats = 5;
+    if( !func() )
+    {
+        fail(name);
+        return;
+    }
+
+    size_t i, n = 1;
+    double runTime = minTime / nrepeats;
+    for( ;; )
+    {
+        BenchClock::time_point t0 = BenchClock::now();
+        for( i = 0; i < n; i++ )
+            func();
+        double t = std::chrono::duration<double>(BenchClock::now() - t0).count();
+        if( t >= runTime || n >= ((size_t)1 << 30) )
+            break;
+        n = t > 0 ? std::max(n*2, (size_t)(n*runTime/t*1.2)) : n*2;
+    }
+
+    size_t c0[BENCH_NCOUNTERS], c1[BENCH_NCOUNTERS];
+    std::vector<double> times;
+    bench_counters(c0);
+    for( int k = 0; k < nrepeats; k++ )
+    {
+        BenchClock::time_point t0 = BenchClock::now();
+        for( i = 0; i < n; i++ )
+            func();
+        times.push_back(std::chrono::duration<double, std::nano>(BenchClock::now() - t0).count() / n);
+    }
+    bench_counters(c1);
+    std::sort(times.begin(), times.end());
+
+    BenchResult r;
+    r.name = name;
+    r.ns = times[nrepeats/2];
+    r.nsMin = times[0];
+    r.iterations = n*nrepeats;
+    for( int j = 0; j < BENCH_NCOUNTERS; j++ )
+        r.perCall[j] = (double)(c1[j] - c0[j]) / r.iterations;
+    r.threads = 1;
+    r.speedup = 1;
+    results.push_back(r);
+    fprintf(stderr, "%-48s %12.1f ns  %6.2f py  %6.2f c++  %6.2f numpy  %10.0f B copied\n", name.c_str(), r.ns,
+            r.perCall[BENCH_PY_ALLOCS], r.perCall[BENCH_CXX_ALLOCS], r.perCall[BENCH_NUMPY_ALLOCS],
+            r.perCall[BENCH_BYTES_COPIED]);
+}
+
+// calls func(*args) from 1, 2, 4, ... maxThreads threads for minTime each; the time per call
+// is the wall time divided by the total number of calls, the speedup is relative to 1 thread
+void Bench::measureThreads(const std::string& name, PyObject* func, PyObject* args)
+{
+    double base = 0;
+    for( int nthreads = 1; nthreads <= maxThreads; nthreads = nthreads < maxThreads ? std::min(nthreads*2, maxThreads) : nthreads + 1 )
+    {
+        char buf[32];
+        sprintf(buf, "/%d", nthreads);
+        std::string tname = name + buf;
+        if( !want(tname) )
+            continue;
+
+        std::vector<size_t> counts(nthreads, 0);
+        std::atomic<bool> stop(false), failed(false);
+        size_t c0[BENCH_NCOUNTERS], c1[BENCH_NCOUNTERS];
+        bench_counters(c0);
+        BenchClock::time_point t0 = BenchClock::now();
+        {
+            PyAllowThreads allowThreads;
+            std::vector<std::thread> threads;
+            for( int k = 0; k < nthreads; k++ )
+                threads.push_back(std::thread([&, k]() {
+                    PyEnsureGIL gil;
+                    size_t count = 0;
+                    while( !stop.load() )
+                    {
+                        PyObject* r = PyObject_Call(func, args, NULL);
+                        if( !r )
+                        {
+                            PyErr_Clear();
+                            failed.store(true);
+                            break;
+                        }
+                        Py_DECREF(r);
+                        count++;
+                    }
+                    counts[k] = count;
+                }));
+            std::this_thread::sleep_for(std::chrono::duration<double>(minTime));
+            stop.store(true);
+            for( int k = 0; k < nthreads; k++ )
+                threads[k].join();
+        }
+        double t = std::chrono::duration<double, std::nano>(BenchClock::now() - t0).count();
+        bench_counters(c1);
+        if( failed.load() )
+        {
+            fail(tname);
+            return;
+        }
+
+        size_t total = 0;
+        for( int k = 0; k < nthreads; k++ )
+            total += counts[k];
+        BenchResult r;
+        r.name = tname;
+        r.ns = r.nsMin = t / std::max(total, (size_t)1);
+        r.iterations = total;
+        for( int j = 0; j < BENCH_NCOUNTERS; j++ )
+            r.perCall[j] = (double)(c1[j] - c0[j]) / std::max(total, (size_t)1);
+        r.threads = nthreads;
+        if( nthreads == 1 )
+            base = r.ns;
+        r.speedup = base > 0 ? base / r.ns : 0;
+        results.push_back(r);
+        fprintf(stderr, "%-48s %12.1f ns  %6.2fx\n", tname.c_str(), r.ns, r.speedup);
+    }
+}
+
+void Bench::writeJSON(FILE* f) const
+{
+    fprintf(f, "{\n  \"python\": \"%s\",\n  \"opencv\": \"%s\",\n  \"hardware_threads\": %u,\n  \"min_time\": %g,\n  \"results\": [",
+            PY_VERSION, CV_VERSION, std::thread::hardware_concurrency(), minTime);
+    for( size_t i = 0; i < results.size(); i++ )
+    {
+        const BenchResult& r = results[i];
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"ns_per_call\": %.2f, \"ns_min\": %.2f, \"iterations\": %lu, \"threads\": %d, \"speedup\": %.3f",
+                i > 0 ? "," : "", r.name.c_str(), r.ns, r.nsMin, (unsigned long)r.iterations, r.threads, r.speedup);
+        for( int j = 0; j < BENCH_NCOUNTERS; j++ )
+            fprintf(f, ", \"%s_per_call\": %.3f", bench_counter_names[j], r.perCall[j]);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+// the baseline is read with the json module of the embedded interpreter
+int Bench::compare(const std::string& path) const
+{
+    std::string code = "{r['name']: r['ns_per_call'] for r in __import__('json').load(open(" +
+                       std::string("r'") + path + "'))['results']}";
+    PyObject* base = PyRun_String(code.c_str(), Py_eval_input, env, env);
+    if( !base )
+    {
+        fprintf(stderr, "cannot read the baseline %s\n", path.c_str());
+        PyErr_Print();
+        return 2;
+    }
+
+    int nworse = 0, nbetter = 0;
+    fprintf(stderr, "\n%-48s %12s %12s %8s\n", "case", "baseline ns", "current ns", "change");
+    for( size_t i = 0; i < results.size(); i++ )
+    {
+        const BenchResult& r = results[i];
+        PyObject* v = PyDict_GetItemString(base, r.name.c_str());
+        if( !v )
+        {
+            fprintf(stderr, "%-48s %12s %12.1f %8s\n", r.name.c_str(), "-", r.ns, "new");
+            continue;
+        }
+        double b = PyFloat_AsDouble(v);
+        double change = b > 0 ? r.ns / b - 1 : 0;
+        const char* mark = change > tolerance ? "  SLOWER" : change < -tolerance ? "  faster" : "";
+        nworse += change > tolerance;
+        nbetter += change < -tolerance;
+        fprintf(stderr, "%-48s %12.1f %12.1f %+7.1f%%%s\n", r.name.c_str(), b, r.ns, change*100, mark);
+    }
+    Py_DECREF(base);
+    fprintf(stderr, "%d slower, %d faster by more than %.0f%%\n", nworse, nbetter, tolerance*100);
+    return nworse > 0 ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// cases
+
+struct BenchDepth { const char* name; int depth; };
+static const BenchDepth bench_depths[] =
+    { {"uint8", CV_8U}, {"int16", CV_16S}, {"float32", CV_32F}, {"float64", CV_64F} };
+
+struct BenchShape { const char* name; const char* numpy; int rows, cols, cn; };
+static const BenchShape bench_shapes[] =
+{
+    {"8x8", "(8, 8)", 8, 8, 1},
+    {"480x640", "(480, 640)", 480, 640, 1},
+    {"480x640x3", "(480, 640, 3)", 480, 640, 3},
+    {"1080x1920x3", "(1080, 1920, 3)", 1080, 1920, 3}
+};
+
+struct BenchLayout { const char* name; const char* suffix; };
+static const BenchLayout bench_layouts[] =
+{
+    {"contiguous", ""},
+    {"transposed", ".swapaxes(0, 1)"},
+    {"flipped", "[::-1]"},
+    {"strided", "[:, ::2]"}
+};
+
+static const int bench_vec_sizes[] = { 1, 16, 256, 4096, 65536 };
+
+static void bench_mats(Bench& b)
+{
+    for( const BenchDepth& d : bench_depths )
+        for( const BenchShape& s : bench_shapes )
+        {
+            for( const BenchLayout& l : bench_layouts )
+            {
+                std::string name = std::string("to_mat/") + d.name + "/" + s.name + "/" + l.name;
+                if( !b.want(name) )
+                    continue;
+                PyObject* o = b.eval(std::string("np.zeros(") + s.numpy + ", np." + d.name + ")" + l.suffix);
+                if( !o )
+                    continue;
+                b.measure(name, [o]() {
+                    Mat m;
+                    return pyopencv_to(o, m, ArgInfo("src", 0));
+                });
+                Py_DECREF(o);
+            }
+
+            for( int numpyAlloc = 1; numpyAlloc >= 0; numpyAlloc-- )
+            {
+                std::string name = std::string("from_mat/") + d.name + "/" + s.name + (numpyAlloc ? "/numpy" : "/opencv");
+                if( !b.want(name) )
+                    continue;
+                Mat m;
+                if( numpyAlloc )
+                    m.allocator = &g_numpyAllocator;
+                m.create(s.rows, s.cols, CV_MAKETYPE(d.depth, s.cn));
+                b.measure(name, [&m]() {
+                    PyObject* r = pyopencv_from(m);
+                    Py_XDECREF(r);
+                    return r != 0;
+                });
+            }
+        }
+}
+
+template<typename _Tp> static void bench_vec(Bench& b, const char* type, const char* source, const char* expr)
+{
+    for( int n : bench_vec_sizes )
+    {
+        char buf[32];
+        sprintf(buf, "/%d", n);
+        std::string name = std::string("to_vec/") + type + "/" + source + buf;
+        if( !b.want(name) )
+            continue;
+        sprintf(buf, "%d", n);
+        std::string e = expr;
+        e.replace(e.find("N"), 1, buf);
+        PyObject* o = b.eval(e);
+        if( !o )
+            continue;
+        b.measure(name, [o]() {
+            std::vector<_Tp> v;
+            if( pyopencv_to(o, v, ArgInfo("vec", 0)) )
+                return true;
+            if( !PyErr_Occurred() )
+                PyErr_SetString(PyExc_TypeError, "the conversion failed");
+            return false;
+        });
+        Py_DECREF(o);
+    }
+}
+
+template<typename _Tp> static void bench_vec_from(Bench& b, const char* type)
+{
+    for( int n : bench_vec_sizes )
+    {
+        char buf[32];
+        sprintf(buf, "/%d", n);
+        std::string name = std::string("from_vec/") + type + buf;
+        if( !b.want(name) )
+            continue;
+        std::vector<_Tp> v(n);
+        b.measure(name, [&v]() {
+            PyObject* r = pyopencv_from(v);
+            Py_XDECREF(r);
+            return r != 0;
+        });
+    }
+}
+
+static void bench_vecs(Bench& b)
+{
+    bench_vec<Point2f>(b, "Point2f", "array", "np.zeros((N, 1, 2), np.float32)");
+    bench_vec<Point2f>(b, "Point2f", "list", "[(float(i), 0.5) for i in range(N)]");
+    bench_vec<Point>(b, "Point", "array", "np.zeros((N, 2), np.int32)");
+    bench_vec<int>(b, "int", "list", "list(range(N))");
+    bench_vec<Mat>(b, "Mat", "array", "np.zeros((N, 8, 8, 3), np.uint8)");
+    bench_vec_from<Point2f>(b, "Point2f");
+    bench_vec_from<int>(b, "int");
+}
+
+// the wrappers missing from the build are skipped
+struct BenchCall { const char* name; const char* func; const char* args; const char* kw; };
+static const BenchCall bench_calls[] =
+{
+    {"call/getTickCount/none", "cv2.getTickCount", "()", 0},
+    {"call/add/8x8", "cv2.add", "(np.zeros((8, 8), np.uint8), np.zeros((8, 8), np.uint8))", 0},
+    {"call/add/8x8_dst", "cv2.add", "(np.zeros((8, 8), np.uint8), np.zeros((8, 8), np.uint8), np.zeros((8, 8), np.uint8))", 0},
+    {"call/add/480x640x3", "cv2.add", "(np.zeros((480, 640, 3), np.uint8), np.zeros((480, 640, 3), np.uint8))", 0},
+    {"call/norm/64x64", "cv2.norm", "(np.zeros((64, 64), np.float32),)", 0},
+    {"call/blur/8x8_kw", "cv2.blur", "(np.zeros((8, 8), np.uint8),)", "{'ksize': (3, 3)}"},
+    {"call/boundingRect/points256", "cv2.boundingRect", "(np.zeros((256, 1, 2), np.float32),)", 0},
+};
+
+static const BenchCall bench_thread_calls[] =
+{
+    {"threads/blur/720x1280x3", "cv2.blur", "(np.zeros((720, 1280, 3), np.uint8), (5, 5))", 0},
+    {"threads/blur/64x64", "cv2.blur", "(np.zeros((64, 64), np.uint8), (5, 5))", 0},
+    {"threads/add/8x8", "cv2.add", "(np.zeros((8, 8), np.uint8), np.zeros((8, 8), np.uint8))", 0},
+};
+
+static void bench_wrappers(Bench& b)
+{
+    for( const BenchCall& c : bench_calls )
+    {
+        if( !b.want(c.name) )
+            continue;
+        PyObject* func = b.eval(std::string("getattr(cv2, '") + (c.func + 4) + "', None)");
+        if( func == Py_None )
+            fprintf(stderr, "%s: skipped, %s is not wrapped\n", c.name, c.func);
+        PyObject* args = func && func != Py_None ? b.eval(c.args) : 0;
+        PyObject* kw = args && c.kw ? b.eval(c.kw) : 0;
+        if( args && (kw || !c.kw) )
+            b.measure(c.name, [func, args, kw]() {
+                PyObject* r = PyObject_Call(func, args, kw);
+                Py_XDECREF(r);
+                return r != 0;
+            });
+        Py_XDECREF(func);
+        Py_XDECREF(args);
+        Py_XDECREF(kw);
+    }
+
+    for( const BenchCall& c : bench_thread_calls )
+    {
+        PyObject* func = b.eval(std::string("getattr(cv2, '") + (c.func + 4) + "', None)");
+        if( func == Py_None )
+            fprintf(stderr, "%s: skipped, %s is not wrapped\n", c.name, c.func);
+        PyObject* args = func && func != Py_None ? b.eval(c.args) : 0;
+        if( args )
+            b.measureThreads(c.name, func, args);
+        Py_XDECREF(func);
+        Py_XDECREF(args);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+static void bench_usage()
+{
+    fprintf(stderr,
+        "bench_convert [--json FILE] [--baseline FILE] [--tolerance FRACTION] [--filter TEXT]\n"
+        "              [--min-time SECONDS] [--threads N]\n"
+        "  --json FILE         write the results to FILE (default: stdout)\n"
+        "  --baseline FILE     compare the results with a previous --json output\n"
+        "  --tolerance F       the relative slowdown reported as a regression (default: 0.1)\n"
+        "  --filter TEXT       run only the cases with TEXT in the name\n"
+        "  --min-time S        the time spent on each case (default: 0.1)\n"
+        "  --threads N         the maximum number of threads of the scaling cases (default: all cores)\n");
+}
+
+int main(int argc, char** argv)
+{
+    Bench b;
+    std::string jsonPath, baselinePath;
+    for( int i = 1; i < argc; i++ )
+    {
+        std::string a = argv[i];
+        const char* v = i + 1 < argc ? argv[i+1] : 0;
+        if( a == "--help" || a == "-h" || !v )
+        {
+            bench_usage();
+            return a == "--help" || a == "-h" ? 0 : 2;
+        }
+        if( a == "--json" )
+            jsonPath = v;
+        else if( a == "--baseline" )
+            baselinePath = v;
+        else if( a == "--tolerance" )
+            b.tolerance = atof(v);
+        else if( a == "--filter" )
+            b.filter = v;
+        else if( a == "--min-time" )
+            b.minTime = atof(v);
+        else if( a == "--threads" )
+            b.maxThreads = std::max(atoi(v), 1);
+        else
+        {
+            bench_usage();
+            return 2;
+        }
+        i++;
+    }
+
+    PyImport_AppendInittab(MODULESTR, PyInit_cv2);
+    Py_Initialize();
+    bench_hook_pymem();
+    if( !b.init() )
+    {
+        PyErr_Print();
+        return 2;
+    }
+
+    bench_mats(b);
+    bench_vecs(b);
+    bench_wrappers(b);
+
+    FILE* f = jsonPath.empty() || jsonPath == "-" ? stdout : fopen(jsonPath.c_str(), "wt");
+    if( !f )
+    {
+        fprintf(stderr, "cannot write %s\n", jsonPath.c_str());
+        return 2;
+    }
+    b.writeJSON(f);
+    if( f != stdout )
+        fclose(f);
+
+    int status = baselinePath.empty() ? 0 : b.compare(baselinePath);
+    Py_Finalize();
+    return status;
+}
@@ -0,0 +1,104 @@
+#!/usr/bin/env python
+
+'''
+Video decoding with VideoCapture.read() compared with cv2.FrameRing().
+
+The loop reads each frame and processes it (a blur standing for the real work).
+With VideoCapture.read() the decoding and the processing alternate and every
+frame is a new numpy array; the FrameRing decodes on its own thread into a few
+preallocated frames while the previous ones are processed. Both loops must see
+the same frames.
+
+Without a source, a test video (MJPG in .avi) or an image sequence (with -s) is
+written to a temporary directory first.
+
+Usage:
+    bench_framering.py [SOURCE] [-f FRAMES] [-n COUNT] [-s] [--size WxH]
+'''
+
+from __future__ import print_function
+import os, time, shutil, tempfile, argparse
+import numpy as np
+import cv2
+
+def write_test_source(dirname, count, size, sequence):
+    w, h = size
+    rng = np.random.RandomState(0)
+    base = rng.randint(0, 255, (h, w, 3)).astype(np.uint8)
+    if sequence:
+        source = os.path.join(dirname, "frame_%04d.png")
+    else:
+        source = os.path.join(dirname, "test.avi")
+        writer = cv2.VideoWriter(source, cv2.VideoWriter_fourcc(*"MJPG"), 30, (w, h))
+    for i in range(count):
+        frame = np.roll(base, i * 4, axis=1)
+        cv2.putText(frame, str(i), (20, 60), cv2.FONT_HERSHEY_SIMPLEX, 2, (255, 255, 255), 3)
+        if sequence:
+            cv2.imwrite(source % i, frame)
+        else:
+            writer.write(frame)
+    if not sequence:
+        writer.release()
+    return source
+
+def process(frame):
+    return cv2.GaussianBlur(frame, (9, 9), 0)
+
+def run_read(source):
+    cap = cv2.VideoCapture(source)
+    sums = []
+    while True:
+        ok, frame = cap.read()
+        if not ok:
+            break
+        sums.append(int(process(frame).sum()))
+    return sums
+
+def run_ring(source, frames):
+    sums = []
+    with cv2.FrameRing(source, frames) as ring:
+        while True:
+            i, frame = ring.acquire()
+            if frame is None:
+                break
+            sums.append(int(process(frame).sum()))
+            ring.release(i)
+        stats = ring.stats()
+    return sums, stats
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("source", nargs="?", help="a video file or an image sequence pattern (frame_%%04d.png)")
+    parser.add_argument("-f", "--frames", type=int, default=4, help="the frames in the ring")
+    parser.add_argument("-n", "--count", type=int, default=300, help="the frames of the test source")
+    parser.add_argument("-s", "--sequence", action="store_true", help="the test source is an image sequence")
+    parser.add_argument("--size", default="1920x1080")
+    args = parser.parse_args()
+
+    tmpdir = None
+    source = args.source
+    if source is None:
+        tmpdir = tempfile.mkdtemp()
+        size = tuple(int(v) for v in args.size.split("x"))
+        source = write_test_source(tmpdir, args.count, size, args.sequence)
+    try:
+        t = time.perf_counter()
+        sums_read = run_read(source)
+        t_read = time.perf_counter() - t
+        t = time.perf_counter()
+        sums_ring, stats = run_ring(source, args.frames)
+        t_ring = time.perf_counter() - t
+    finally:
+        if tmpdir:
+            shutil.rmtree(tmpdir)
+
+    assert sums_read == sums_ring, "the frames differ"
+    n = max(len(sums_read), 1)
+    print("%s: %d frames" % (source, len(sums_read)))
+    print("%-12s %10.3f s  %8.2f ms/frame" % ("read()", t_read, t_read * 1e3 / n))
+    print("%-12s %10.3f s  %8.2f ms/frame" % ("FrameRing", t_ring, t_ring * 1e3 / n))
+    print("speedup      %10.2fx" % (t_read / t_ring))
+    print("ring: %(frames)d frames, the decoder waited %(decoder_waits)d times, the consumer %(consumer_waits)d times" % stats)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,53 @@
+#!/usr/bin/env python
+
+'''
+Create/destroy throughput of the wrapper objects of the generated types.
+
+The wrappers of the simple types (KeyPoint, DMatch) and of the Ptr-holding
+types (the algorithms) are created and dropped in a loop, either one by one
+or as the lists returned by detectors and matchers. Compare the numbers with
+a build without the freelists (see PYOPENCV_FREELIST_SIZE in cv2.cpp) to see
+the effect.
+
+Usage:
+    bench_freelist.py [-n NUMBER]
+'''
+
+from __future__ import print_function
+import timeit, argparse
+import numpy as np
+import cv2
+
+def rate(stmt, env, number, objects_per_call=1):
+    t = min(timeit.repeat(stmt, globals=env, number=number, repeat=5))
+    return number * objects_per_call / t
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", "--number", type=int, default=200000)
+    args = parser.parse_args()
+
+    img = np.random.randint(0, 255, (480, 640), np.uint8)
+    img = cv2.GaussianBlur(img, (5, 5), 0)
+    fast = cv2.FastFeatureDetector_create()
+    kps = fast.detect(img)
+    orb = cv2.ORB_create(nfeatures=1000)
+    kps_orb, des = orb.detectAndCompute(img, None)
+    matcher = cv2.BFMatcher(cv2.NORM_HAMMING)
+    env = {"cv2": cv2, "img": img, "fast": fast, "des": des, "matcher": matcher}
+
+    cases = [
+        ("KeyPoint()", "cv2.KeyPoint()", 1),
+        ("DMatch()", "cv2.DMatch()", 1),
+        ("[KeyPoint() x 100]", "[cv2.KeyPoint() for i in range(100)]", 100),
+        ("FastFeatureDetector.detect", "fast.detect(img)", len(kps)),
+        ("BFMatcher.match", "matcher.match(des, des)", len(des)),
+        ("ORB_create()", "cv2.ORB_create()", 1),
+    ]
+    print("%-30s %14s" % ("case", "objects/s"))
+    for name, stmt, nobj in cases:
+        number = max(args.number // nobj, 10)
+        print("%-30s %14.0f" % (name, rate(stmt, env, number, nobj)))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,80 @@
+#!/usr/bin/env python
+
+'''
+Effect of the GIL release policy of the wrappers.
+
+Single-threaded: the latency of small calls, where releasing and re-acquiring
+the GIL is comparable to the work itself.
+Multithreaded: the throughput of the calls made from several Python threads,
+for small images (where holding the GIL avoids the thread switches) and for
+large images (where releasing it lets the calls run in parallel).
+
+Each case is run with the GIL always released (threshold 0), never released
+(threshold = inf) and with the default threshold.
+
+Usage (Python 3.5+):
+    bench_gil.py [-n NUMBER] [-t THREADS]
+'''
+
+from __future__ import print_function
+import time, timeit, argparse, threading
+import numpy as np
+import cv2
+
+def latency(stmt, env, number):
+    return min(timeit.repeat(stmt, globals=env, number=number, repeat=3)) * 1e9 / number
+
+def throughput(func, nthreads, seconds=1.0):
+    counts = [0] * nthreads
+    stop = [False]
+    def worker(i):
+        n = 0
+        while not stop[0]:
+            func()
+            n += 1
+        counts[i] = n
+    threads = [threading.Thread(target=worker, args=(i,)) for i in range(nthreads)]
+    for t in threads:
+        t.start()
+    time.sleep(seconds)
+    stop[0] = True
+    for t in threads:
+        t.join()
+    return sum(counts) / seconds
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", "--number", type=int, default=100000)
+    parser.add_argument("-t", "--threads", type=int, default=4)
+    args = parser.parse_args()
+
+    small = np.random.randint(0, 255, (16, 16, 3), np.uint8)
+    large = np.random.randint(0, 255, (1080, 1920, 3), np.uint8)
+    env = {"cv2": cv2, "small": small, "a": np.ones((3, 3)), "b": np.ones((3, 3))}
+    default = cv2.getGILReleaseThreshold()
+    policies = [("always", 0), ("default", default), ("never", 1 << 62)]
+
+    print("single-threaded latency, ns/call")
+    print("%-36s" % "call" + "".join(["%12s" % p for p, t in policies]))
+    for stmt in ["cv2.getTickCount()", "cv2.add(a, b)", "cv2.blur(small, (3, 3))",
+                 "cv2.cvtColor(small, cv2.COLOR_BGR2GRAY)"]:
+        row = []
+        for p, t in policies:
+            cv2.setGILReleaseThreshold(t)
+            row.append(latency(stmt, env, args.number))
+        print("%-36s" % stmt + "".join(["%12.1f" % x for x in row]))
+
+    print("\n%d-threaded throughput, calls/s" % args.threads)
+    print("%-36s" % "call" + "".join(["%12s" % p for p, t in policies]))
+    cases = [("blur(16x16x3)", lambda: cv2.blur(small, (3, 3))),
+             ("GaussianBlur(1920x1080x3)", lambda: cv2.GaussianBlur(large, (5, 5), 0))]
+    for name, func in cases:
+        row = []
+        for p, t in policies:
+            cv2.setGILReleaseThreshold(t)
+            row.append(throughput(func, args.threads))
+        print("%-36s" % name + "".join(["%12.0f" % x for x in row]))
+    cv2.setGILReleaseThreshold(default)
+
+if __name__ == '__main__':
+    main()
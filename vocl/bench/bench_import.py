@@ -0,0 +1,57 @@
+#!/usr/bin/env python
+
+'''
+Import time of cv2 with the lazy and the eager module init.
+
+Each measurement imports cv2 in a fresh interpreter, the way a short-lived
+worker does on a cold start (the shared library is in the page cache after
+the first run). The eager init is requested with OPENCV_PYTHON_EAGER_INIT=1.
+Also printed are the per-phase breakdown of the init from cv2._init_timings()
+and the cost of the first access to a lazily created constant.
+
+Usage (Python 3.7+):
+    bench_import.py [-n RUNS]
+'''
+
+from __future__ import print_function
+import os, sys, json, argparse, subprocess
+
+probe = r'''
+import time, json
+t = time.perf_counter()
+import cv2
+t_import = time.perf_counter() - t
+t = time.perf_counter()
+cv2.COLOR_BGR2GRAY
+t_const = time.perf_counter() - t
+r = cv2._init_timings()
+r["import"] = t_import
+r["first_const"] = t_const
+print(json.dumps(r))
+'''
+
+def measure(eager, runs):
+    env = dict(os.environ)
+    env["OPENCV_PYTHON_EAGER_INIT"] = "1" if eager else "0"
+    results = []
+    for i in range(runs):
+        out = subprocess.check_output([sys.executable, "-c", probe], env=env)
+        results.append(json.loads(out.decode()))
+    # the median run of each key
+    keys = results[0].keys()
+    return dict((k, sorted(r[k] for r in results)[len(results)//2]) for k in keys)
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", "--runs", type=int, default=21)
+    args = parser.parse_args()
+
+    phases = ["import_array", "types", "module", "constants", "total", "import", "first_const"]
+    modes = [("eager", measure(True, args.runs)), ("lazy", measure(False, args.runs))]
+    print("median of %d runs, ms" % args.runs)
+    print("%-14s" % "phase" + "".join(["%12s" % m for m, r in modes]))
+    for p in phases:
+        print("%-14s" % p + "".join(["%12.3f" % (r[p] * 1e3) for m, r in modes]))
+
+if __name__ == '__main__':
+    main()
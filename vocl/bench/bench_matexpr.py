@@ -0,0 +1,53 @@
+#!/usr/bin/env python
+
+'''
+Blend, normalize and mask expressions written with numpy arrays compared with
+the same expressions over cv2.MatExpr(), which cv::MatExpr folds into one call
+each (addWeighted(), convertTo(), compare()).
+
+Usage:
+    bench_matexpr.py [-n ITERATIONS] [--size WxH]
+'''
+
+from __future__ import print_function
+import time, argparse
+import numpy as np
+import cv2
+
+def timeit(f, n):
+    f()
+    t = time.perf_counter()
+    for i in range(n):
+        r = f()
+    return (time.perf_counter() - t) * 1e3 / n, r
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", "--iterations", type=int, default=50)
+    parser.add_argument("--size", default="1920x1080")
+    args = parser.parse_args()
+
+    w, h = (int(v) for v in args.size.split("x"))
+    rng = np.random.RandomState(0)
+    a = rng.rand(h, w).astype(np.float32)
+    b = rng.rand(h, w).astype(np.float32)
+    alpha, mean, std = 0.3, 0.5, 0.25
+    ea, eb = cv2.MatExpr(a), cv2.MatExpr(b)
+
+    cases = [("blend", lambda: a * alpha + b * (1 - alpha),
+                       lambda: (ea * alpha + eb * (1 - alpha)).eval()),
+             ("normalize", lambda: (a - mean) * (1. / std),
+                           lambda: ((ea - mean) * (1. / std)).eval()),
+             ("mask", lambda: (a > 0.5).astype(np.uint8) * 255,
+                      lambda: (ea > 0.5).eval())]
+
+    print("%dx%d float32, ms per expression" % (w, h))
+    print("%-12s %10s %10s %8s" % ("", "numpy", "MatExpr", "speedup"))
+    for name, f_np, f_expr in cases:
+        t_np, r_np = timeit(f_np, args.iterations)
+        t_expr, r_expr = timeit(f_expr, args.iterations)
+        assert np.allclose(r_np, r_expr, atol=1e-4), name
+        print("%-12s %10.3f %10.3f %7.2fx" % (name, t_np, t_expr, t_np / t_expr))
+
+if __name__ == '__main__':
+    main()
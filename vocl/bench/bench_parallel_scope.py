@@ -0,0 +1,68 @@
+#!/usr/bin/env python
+
+'''
+Tail latency of concurrent requests sharing the module thread pool.
+
+Several Python threads serve requests, each of which resizes a batch of crops
+with cv2.batch(). Without a limit, every request fans out over all the pool
+threads and the requests compete for them; with cv2.parallel_scope(threads=N)
+in each serving thread, the cores are split between the requests.
+
+Usage:
+    bench_parallel_scope.py [-t THREADS] [-n REQUESTS] [-s SCOPE ...]
+'''
+
+from __future__ import print_function
+import time, argparse, threading, multiprocessing
+import numpy as np
+import cv2
+
+def serve(frame, boxes, nrequests, scope, latencies):
+    def request():
+        b = cv2.batch()
+        for x, y, w, h in boxes:
+            b.resize(frame[y:y+h, x:x+w], (128, 128))
+        return b.run()
+    for i in range(nrequests):
+        t = time.perf_counter()
+        if scope:
+            with cv2.parallel_scope(threads=scope):
+                request()
+        else:
+            request()
+        latencies.append(time.perf_counter() - t)
+
+def main():
+    ncpu = multiprocessing.cpu_count()
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-t", "--threads", type=int, default=4, help="serving threads")
+    parser.add_argument("-n", "--requests", type=int, default=50, help="requests per thread")
+    parser.add_argument("-s", "--scope", type=int, nargs="*", default=[0, 1, max(ncpu // 4, 1)],
+                        help="thread limits to compare, 0 - no limit")
+    args = parser.parse_args()
+
+    rng = np.random.RandomState(0)
+    frame = rng.randint(0, 255, (1080, 1920, 3)).astype(np.uint8)
+    boxes = []
+    for i in range(64):
+        w, h = rng.randint(64, 512, 2)
+        boxes.append((rng.randint(0, 1920 - w), rng.randint(0, 1080 - h), w, h))
+
+    print("%d serving threads, %d cores" % (args.threads, ncpu))
+    print("%-8s %12s %12s %12s %14s" % ("scope", "p50, ms", "p99, ms", "max, ms", "requests/s"))
+    for scope in args.scope:
+        latencies = []
+        threads = [threading.Thread(target=serve, args=(frame, boxes, args.requests, scope, latencies))
+                   for i in range(args.threads)]
+        t = time.perf_counter()
+        for th in threads:
+            th.start()
+        for th in threads:
+            th.join()
+        elapsed = time.perf_counter() - t
+        lat = np.array(latencies) * 1e3
+        print("%-8s %12.2f %12.2f %12.2f %14.1f" % (scope or "none", np.percentile(lat, 50),
+              np.percentile(lat, 99), lat.max(), len(latencies) / elapsed))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,71 @@
+#!/usr/bin/env python
+
+'''
+Frames passed between processes: pickled numpy arrays compared with
+cv2.SharedFrame() handles of arrays in shared memory.
+
+A worker process receives the frames through a multiprocessing queue, computes
+the mean of each and sends it back. With the arrays pickled, each frame is
+serialized, written to the pipe and copied again on the other side; with the
+shared memory output arrays (cv2.setUseSharedMemory()) only the handle goes
+through the pipe and the worker maps the frame.
+
+Usage (POSIX):
+    bench_shm.py [-n FRAMES] [--size WxH]
+'''
+
+from __future__ import print_function
+import time, argparse
+import multiprocessing as mp
+import numpy as np
+import cv2
+
+def worker(qin, qout):
+    while True:
+        item = qin.get()
+        if item is None:
+            break
+        frame = getattr(item, "array", item)
+        qout.put(float(frame.mean()))
+
+def run(frames, shared):
+    cv2.setUseSharedMemory(shared)
+    qin, qout = mp.Queue(4), mp.Queue()
+    p = mp.Process(target=worker, args=(qin, qout))
+    p.start()
+    means = []
+    t = time.perf_counter()
+    for frame in frames:
+        out = cv2.blur(frame, (3, 3))
+        qin.put(cv2.SharedFrame(out).transfer() if shared else out)
+        del out
+        means.append(qout.get())
+    t = time.perf_counter() - t
+    qin.put(None)
+    p.join()
+    cv2.setUseSharedMemory(False)
+    return t, means
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", "--frames", type=int, default=200)
+    parser.add_argument("--size", default="1920x1080")
+    args = parser.parse_args()
+
+    w, h = (int(v) for v in args.size.split("x"))
+    rng = np.random.RandomState(0)
+    frames = [rng.randint(0, 255, (h, w, 3)).astype(np.uint8) for i in range(8)]
+    frames = [frames[i % len(frames)] for i in range(args.frames)]
+
+    t_pickle, m_pickle = run(frames, False)
+    t_shared, m_shared = run(frames, True)
+    assert m_pickle == m_shared
+
+    mb = frames[0].nbytes / float(1 << 20)
+    print("%d frames of %dx%d (%.1f MB)" % (args.frames, w, h, mb))
+    print("%-12s %10.3f ms/frame  %8.0f MB/s" % ("pickled", t_pickle * 1e3 / args.frames, mb * args.frames / t_pickle))
+    print("%-12s %10.3f ms/frame  %8.0f MB/s" % ("SharedFrame", t_shared * 1e3 / args.frames, mb * args.frames / t_shared))
+    print("speedup      %10.2fx" % (t_pickle / t_shared))
+
+if __name__ == '__main__':
+    main()
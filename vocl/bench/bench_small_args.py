@@ -0,0 +1,50 @@
+#!/usr/bin/env python
+
+'''
+Per-call overhead of the small fixed-size argument converters (Point, Size, Rect, Scalar)
+and of numbers passed where a Mat is expected.
+
+The drawing calls are made on a tiny image, so the time is dominated by the wrapper,
+not by the rasterization.
+
+Usage (Python 3.5+):
+    bench_small_args.py [-n NUMBER] [-r REPEAT]
+'''
+
+from __future__ import print_function
+import timeit, argparse
+import numpy as np
+import cv2
+
+cases = [
+    ("rectangle(Point, Point, Scalar)", "cv2.rectangle(img, (1, 1), (6, 6), (255, 0, 0))"),
+    ("rectangle(.., thickness, lineType)", "cv2.rectangle(img, (1, 1), (6, 6), (255, 0, 0), 1, cv2.LINE_8)"),
+    ("rectangle(Rect, Scalar) (2nd overload)", "cv2.rectangle(img, (1, 1, 5, 5), (255, 0, 0))"),
+    ("circle(Point, radius, Scalar)", "cv2.circle(img, (4, 4), 2, (0, 255, 0))"),
+    ("circle(.., thickness=, lineType=)", "cv2.circle(img, (4, 4), 2, (0, 255, 0), thickness=2, lineType=cv2.LINE_AA)"),
+    ("circle(list Point, list Scalar)", "cv2.circle(img, [4, 4], 2, [0, 255, 0])"),
+    ("line(Point, Point, Scalar)", "cv2.line(img, (0, 0), (7, 7), (0, 0, 255))"),
+    ("add(Mat, number)", "cv2.add(small, 5)"),
+    ("add(Mat, tuple)", "cv2.add(small, (5, 5, 5, 0))"),
+    ("boundingRect", "cv2.boundingRect(pts)"),
+]
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-n", "--number", type=int, default=200000)
+    parser.add_argument("-r", "--repeat", type=int, default=5)
+    args = parser.parse_args()
+
+    env = {
+        "cv2": cv2,
+        "img": np.zeros((8, 8, 3), np.uint8),
+        "small": np.zeros((4, 1), np.float64),
+        "pts": np.array([[0, 0], [3, 5], [7, 1]], np.int32),
+    }
+    print("%-40s %10s" % ("call", "ns/call"))
+    for name, stmt in cases:
+        t = min(timeit.repeat(stmt, globals=env, number=args.number, repeat=args.repeat))
+        print("%-40s %10.1f" % (name, t * 1e9 / args.number))
+
+if __name__ == '__main__':
+    main()
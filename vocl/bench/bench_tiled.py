@@ -0,0 +1,71 @@
+#!/usr/bin/env python
+
+'''
+cv2.tiledApply() on a file-backed image compared with the op on the whole image
+in memory.
+
+A random image is written to a raw file in a temporary directory and mapped with
+np.memmap; the op (a color conversion and a blur) is applied tile by tile into
+another memmap, then, for reference, to the whole image loaded into memory. The
+results must be equal. The peak resident memory of the process is printed after
+each step (Linux/macOS); for the tiled run it counts the pages of the mapped
+files too, which the system can drop, unlike the heap of the in-memory run.
+
+Usage:
+    bench_tiled.py [--size WxH] [--tile WxH] [-s SIGMA] [-t THREADS]
+'''
+
+from __future__ import print_function
+import os, time, shutil, tempfile, argparse, resource
+import numpy as np
+import cv2
+
+def peak_mb():
+    r = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return r / 1024.0 if not os.uname()[0] == "Darwin" else r / float(1 << 20)
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--size", default="12000x8000")
+    parser.add_argument("--tile", default="1024x1024")
+    parser.add_argument("-s", "--sigma", type=float, default=4)
+    parser.add_argument("-t", "--threads", type=int, default=0)
+    args = parser.parse_args()
+    w, h = (int(v) for v in args.size.split("x"))
+    tile = tuple(int(v) for v in args.tile.split("x"))
+    ksize = int(args.sigma * 4) * 2 + 1
+    halo = ksize // 2
+
+    stages = [("cvtColor", {"src": "in", "dst": "gray"}, {"code": cv2.COLOR_BGR2GRAY}),
+              ("GaussianBlur", {"src": "gray", "dst": "out"}, {"ksize": (ksize, ksize), "sigmaX": args.sigma})]
+
+    tmpdir = tempfile.mkdtemp()
+    try:
+        src = np.memmap(os.path.join(tmpdir, "src.raw"), np.uint8, "w+", shape=(h, w, 3))
+        rng = np.random.RandomState(0)
+        for y in range(0, h, 1024):
+            src[y:y+1024] = rng.randint(0, 255, src[y:y+1024].shape).astype(np.uint8)
+        src.flush()
+        del src
+        print("%dx%d image, %.0f MB on disk, peak RSS %.0f MB" % (w, h, w * h * 3 / 1e6, peak_mb()))
+
+        src = np.memmap(os.path.join(tmpdir, "src.raw"), np.uint8, "r", shape=(h, w, 3))
+        dst = np.memmap(os.path.join(tmpdir, "dst.raw"), np.uint8, "w+", shape=(h, w))
+        t = time.perf_counter()
+        cv2.tiledApply(src, dst, stages, halo, tile, args.threads)
+        dst.flush()
+        t = time.perf_counter() - t
+        print("%-12s %10.3f s   peak RSS %.0f MB" % ("tiledApply", t, peak_mb()))
+
+        t = time.perf_counter()
+        whole = np.array(src)
+        ref = cv2.GaussianBlur(cv2.cvtColor(whole, cv2.COLOR_BGR2GRAY), (ksize, ksize), args.sigma)
+        t = time.perf_counter() - t
+        print("%-12s %10.3f s   peak RSS %.0f MB" % ("in memory", t, peak_mb()))
+        assert np.array_equal(ref, dst), "the results differ"
+        del src, dst
+    finally:
+        shutil.rmtree(tmpdir)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,322 @@
+/*
+  Native replay of a capture log written by cv2.startCapture() (see pycapture.hpp).
+
+  The recorded calls are run again in the order of the log against the OpenCV libraries the
+  tool is linked with, without Python. Every call is repeated (--repeat) with its arguments
+  read from the log again each time, and the fastest run is its replayed kernel time. It is
+  reported next to the times measured in the captured process: the kernel time and the binding
+  overhead, i.e. the conversion of the arguments and of the results by the wrapper. So the
+  replay of a log tells how much of the Python workload is spent in the bindings, and the
+  replays of the same log with two builds of OpenCV compare their kernels. The calls made by
+  several threads are replayed one after another.
+
+  The summary has, per function: the calls replayed, failed (by an exception) and skipped (the
+  function or the overload is not in the generated table of this build), and the total times
+  in milliseconds. With --calls every call is listed as well, in microseconds; with --json the
+  results are written as JSON.
+
+  Build, with the headers generated by gen2.py for the module in <gen>:
+    g++ -O2 -std=c++11 -I<gen> cv2_replay.cpp -o cv2_replay -lopencv_imgproc -lopencv_core ...
+    (the same OpenCV libraries as the cv2 module)
+
+  Usage:
+    cv2_replay LOG [--repeat N] [--filter TEXT] [--calls] [--json FILE]
+*/
+
+#include "pyopencv_generated_include.h"
+#include "opencv2/opencv_modules.hpp"
+
+#include <chrono>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace cv;
+
+#include "../pycapture.hpp"
+#include "pyopencv_generated_replay.h"
+
+static const pyopencv_ReplayFunc replay_funcs[] = {
+#include "pyopencv_generated_replay_tab.h"
+};
+
+static const pyopencv_ReplayFunc* findReplayFunc(const std::string& name, int variant)
+{
+    const pyopencv_ReplayFunc* end = replay_funcs + sizeof(replay_funcs)/sizeof(replay_funcs[0]);
+    const pyopencv_ReplayFunc* f = std::lower_bound(replay_funcs, end, std::make_pair(name.c_str(), variant),
+        [](const pyopencv_ReplayFunc& a, const std::pair<const char*, int>& b)
+        {
+            int c = strcmp(a.name, b.first);
+            return c < 0 || (c == 0 && a.variant < b.second);
+        });
+    return f != end && name == f->name && f->variant == variant ? f : 0;
+}
+
+static double nowNs()
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct FuncStats
+{
+    FuncStats() : calls(0), failed(0), skipped(0), convertIn(0), kernel(0), convertOut(0), replay(0) {}
+
+    size_t calls, failed, skipped;
+    double convertIn, kernel, convertOut, replay;   // ns, of the replayed calls
+};
+
+struct CallResult
+{
+    size_t index;
+    uint32_t thread;
+    std::string func;
+    int variant;
+    double binding, kernel, replay;                 // ns; replay < 0 - failed or skipped
+};
+
+static bool readFile(const char* filename, std::vector<uint8_t>& data)
+{
+    FILE* f = fopen(filename, "rb");
+    if( !f )
+        return false;
+    uint8_t buf[1 << 16];
+    size_t n;
+    while( (n = fread(buf, 1, sizeof(buf), f)) > 0 )
+        data.insert(data.end(), buf, buf + n);
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+// replays one call; returns the fastest time of the runs in ns, or -1
+static double replayCall(const pyopencv_ReplayFunc* rf, const uint8_t* payload, size_t size, int repeat, std::string& error)
+{
+    double best = -1;
+    for( int k = 0; k < repeat; k++ )
+    {
+        std::unique_ptr<pyopencv_ReplayCall> call(rf->create());
+        pyopencv_CaptureReader reader(payload, size);
+        if( !call->read(reader) || !reader.atEnd() )
+        {
+            error = "the arguments in the log do not match the declaration of the function";
+            return -1;
+        }
+        double t0 = nowNs();
+        try
+        {
+            call->run();
+        }
+        catch(const std::exception& e)
+        {
+            error = e.what();
+            return -1;
+        }
+        double t = nowNs() - t0;
+        best = best < 0 ? t : std::min(best, t);
+    }
+    return best;
+}
+
+static void writeJSON(const char* filename, const char* log, const std::map<std::string, FuncStats>& stats,
+                      const std::vector<CallResult>& calls)
+{
+    FILE* f = fopen(filename, "wt");
+    if( !f )
+    {
+        fprintf(stderr, "cannot write %s\n", filename);
+        exit(2);
+    }
+    fprintf(f, "{\n  \"log\": \"%s\",\n  \"functions\": {", log);
+    bool first = true;
+    for( std::map<std::string, FuncStats>::const_iterator it = stats.begin(); it != stats.end(); ++it )
+    {
+        const FuncStats& s = it->second;
+        fprintf(f, "%s\n    \"%s\": {\"calls\": %zu, \"failed\": %zu, \"skipped\": %zu, \"convert_in_ns\": %.0f, "
+                "\"kernel_ns\": %.0f, \"convert_out_ns\": %.0f, \"replay_ns\": %.0f}",
+                first ? "" : ",", it->first.c_str(), s.calls, s.failed, s.skipped, s.convertIn, s.kernel,
+                s.convertOut, s.replay);
+        first = false;
+    }
+    fprintf(f, "\n  }");
+    if( !calls.empty() )
+    {
+        fprintf(f, ",\n  \"calls\": [");
+        for( size_t i = 0; i < calls.size(); i++ )
+        {
+            const CallResult& c = calls[i];
+            fprintf(f, "%s\n    {\"index\": %zu, \"thread\": %u, \"function\": \"%s\", \"variant\": %d, "
+                    "\"binding_ns\": %.0f, \"kernel_ns\": %.0f, \"replay_ns\": %.0f}",
+                    i ? "," : "", c.index, c.thread, c.func.c_str(), c.variant, c.binding, c.kernel, c.replay);
+        }
+        fprintf(f, "\n  ]");
+    }
+    fprintf(f, "\n}\n");
+    fclose(f);
+}
+
+int main(int argc, char** argv)
+{
+    const char* log = 0;
+    const char* json = 0;
+    std::string filter;
+    int repeat = 3;
+    bool listCalls = false;
+    for( int i = 1; i < argc; i++ )
+    {
+        std::string a = argv[i];
+        if( a == "--repeat" && i + 1 < argc )
+            repeat = std::max(atoi(argv[++i]), 1);
+        else if( a == "--filter" && i + 1 < argc )
+            filter = argv[++i];
+        else if( a == "--calls" )
+            listCalls = true;
+        else if( a == "--json" && i + 1 < argc )
+            json = argv[++i];
+        else if( a[0] != '-' && !log )
+            log = argv[i];
+        else
+        {
+            fprintf(stderr, "usage: %s LOG [--repeat N] [--filter TEXT] [--calls] [--json FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+    if( !log )
+    {
+        fprintf(stderr, "usage: %s LOG [--repeat N] [--filter TEXT] [--calls] [--json FILE]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> data;
+    if( !readFile(log, data) )
+    {
+        fprintf(stderr, "cannot read %s\n", log);
+        return 2;
+    }
+    pyopencv_CaptureHeader h;
+    if( data.size() < sizeof(h) || (memcpy(&h, data.data(), sizeof(h)), memcmp(h.magic, PYOPENCV_CAPTURE_MAGIC, sizeof(PYOPENCV_CAPTURE_MAGIC))) )
+    {
+        fprintf(stderr, "%s is not a capture log\n", log);
+        return 2;
+    }
+    if( h.version != PYOPENCV_CAPTURE_VERSION || h.byteOrder != PYOPENCV_CAPTURE_BYTE_ORDER )
+    {
+        fprintf(stderr, "%s is written by another version or on another kind of machine\n", log);
+        return 2;
+    }
+
+    std::vector<std::string> names;
+    std::map<std::string, FuncStats> stats;
+    std::map<std::string, std::string> errors;
+    std::vector<CallResult> calls;
+    size_t pos = sizeof(h), index = 0;
+    while( pos < data.size() )
+    {
+        pyopencv_CaptureRecord r;
+        if( data.size() - pos < sizeof(r) )
+        {
+            fprintf(stderr, "the log is truncated\n");
+            break;
+        }
+        memcpy(&r, &data[pos], sizeof(r));
+        pos += sizeof(r);
+        if( r.size > data.size() - pos )
+        {
+            fprintf(stderr, "the log is truncated\n");
+            break;
+        }
+        const uint8_t* payload = &data[pos];
+        pos += (size_t)r.size;
+
+        if( r.kind == PYOPENCV_CAPTURE_FUNC_NAME )
+        {
+            if( names.size() <= r.func )
+                names.resize(r.func + 1);
+            names[r.func] = std::string((const char*)payload, (size_t)r.size);
+            continue;
+        }
+        if( r.kind != PYOPENCV_CAPTURE_CALL || r.func >= names.size() )
+        {
+            fprintf(stderr, "a bad record in the log at %zu\n", pos - (size_t)r.size - sizeof(r));
+            return 2;
+        }
+        const std::string& name = names[r.func];
+        if( !filter.empty() && name.find(filter) == std::string::npos )
+            continue;
+
+        FuncStats& s = stats[name];
+        CallResult c;
+        c.index = index++;
+        c.thread = r.thread;
+        c.func = name;
+        c.variant = (int)r.variant;
+        c.binding = (double)(r.convertIn + r.convertOut);
+        c.kernel = (double)r.kernel;
+        c.replay = -1;
+        const pyopencv_ReplayFunc* rf = findReplayFunc(name, c.variant);
+        if( !rf )
+            s.skipped++;
+        else
+        {
+            std::string error;
+            c.replay = replayCall(rf, payload, (size_t)r.size, repeat, error);
+            if( c.replay < 0 )
+            {
+                s.failed++;
+                errors.insert(std::make_pair(name, error));
+            }
+            else
+            {
+                s.calls++;
+                s.convertIn += (double)r.convertIn;
+                s.kernel += (double)r.kernel;
+                s.convertOut += (double)r.convertOut;
+                s.replay += c.replay;
+            }
+        }
+        if( listCalls )
+        {
+            if( c.replay < 0 )
+                printf("%8zu  t%-3u %-36s %12.1f %12.1f %12s\n", c.index, c.thread,
+                       (name + "/" + std::to_string(c.variant)).c_str(), c.binding*1e-3, c.kernel*1e-3, rf ? "failed" : "skipped");
+            else
+                printf("%8zu  t%-3u %-36s %12.1f %12.1f %12.1f\n", c.index, c.thread,
+                       (name + "/" + std::to_string(c.variant)).c_str(), c.binding*1e-3, c.kernel*1e-3, c.replay*1e-3);
+            calls.push_back(c);
+        }
+    }
+
+    if( listCalls )
+        printf("\n");
+    printf("%-36s %8s %8s %8s %12s %12s %12s %8s\n", "function", "calls", "failed", "skipped",
+           "binding_ms", "kernel_ms", "replay_ms", "replay/kernel");
+    FuncStats total;
+    for( std::map<std::string, FuncStats>::const_iterator it = stats.begin(); it != stats.end(); ++it )
+    {
+        const FuncStats& s = it->second;
+        printf("%-36s %8zu %8zu %8zu %12.3f %12.3f %12.3f %8.2f\n", it->first.c_str(), s.calls, s.failed, s.skipped,
+               (s.convertIn + s.convertOut)*1e-6, s.kernel*1e-6, s.replay*1e-6, s.kernel > 0 ? s.replay/s.kernel : 0.);
+        total.calls += s.calls;
+        total.failed += s.failed;
+        total.skipped += s.skipped;
+        total.convertIn += s.convertIn;
+        total.kernel += s.kernel;
+        total.convertOut += s.convertOut;
+        total.replay += s.replay;
+    }
+    printf("%-36s %8zu %8zu %8zu %12.3f %12.3f %12.3f %8.2f\n", "total", total.calls, total.failed, total.skipped,
+           (total.convertIn + total.convertOut)*1e-6, total.kernel*1e-6, total.replay*1e-6,
+           total.kernel > 0 ? total.replay/total.kernel : 0.);
+    for( std::map<std::string, std::string>::const_iterator it = errors.begin(); it != errors.end(); ++it )
+        fprintf(stderr, "%s failed: %s\n", it->first.c_str(), it->second.c_str());
+
+    if( json )
+        writeJSON(json, log, stats, calls);
+    return total.failed > 0;
+}
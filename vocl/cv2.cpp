@@ -22,6 +22,13 @@
 
 #include "pycompat.hpp"
 
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
 
 static PyObject* opencv_error = 0;
 
@@ -52,35 +59,127 @@ struct ArgInfo
     operator const char *() const { return name; }
 };
 
+#include "pygilprof.hpp"
+
+// The GIL guards. The site, if given (PYOPENCV_GIL_SITE), collects the GIL wait and hold
+// times with PYOPENCV_ENABLE_GIL_PROFILE, see pygilprof.hpp.
 class PyAllowThreads
 {
 public:
-    PyAllowThreads() : _state(PyEval_SaveThread()) {}
+    PyAllowThreads(pyopencv_GILSite* site = 0) : _probe(site), _state(PyEval_SaveThread()) {}
     ~PyAllowThreads()
     {
+        _probe.acquiring();
         PyEval_RestoreThread(_state);
+        _probe.acquired();
     }
 private:
+    pyopencv_GILProbe _probe;
     PyThreadState* _state;
 };
 
 class PyEnsureGIL
 {
 public:
-    PyEnsureGIL() : _state(PyGILState_Ensure()) {}
+    PyEnsureGIL(pyopencv_GILSite* site = 0) : _probe(site)
+    {
+        _probe.acquiring();
+        _state = PyGILState_Ensure();
+        _probe.acquired();
+    }
     ~PyEnsureGIL()
     {
+        _probe.releasing();
         PyGILState_Release(_state);
     }
 private:
+    pyopencv_GILProbe _probe;
     PyGILState_STATE _state;
 };
 
+// Serializes the one-time initialization (lazily readied types, the thread pool). With the GIL
+// it is implied; the free-threaded build uses a PyMutex, which detaches the waiting thread,
+// so a stop-the-world pause of the interpreter cannot deadlock on it.
+class PyInitLock
+{
+public:
+#ifdef Py_GIL_DISABLED
+    PyInitLock() { PyMutex_Lock(&mutex); }
+    ~PyInitLock() { PyMutex_Unlock(&mutex); }
+private:
+    static PyMutex mutex;
+#else
+    PyInitLock() {}
+    ~PyInitLock() {}
+#endif
+};
+
+#ifdef Py_GIL_DISABLED
+PyMutex PyInitLock::mutex;
+#endif
+
+// Whether a lazily readied type is ready, for the check outside of PyInitLock: tp_flags is not
+// atomic, so the flag is published once PyType_Ready() has succeeded (under the lock)
+class PyTypeReadyFlag
+{
+public:
+    constexpr PyTypeReadyFlag() : ready(false) {}
+    operator bool() const { return ready.load(std::memory_order_acquire); }
+    bool set(bool ok)
+    {
+        if( ok )
+            ready.store(true, std::memory_order_release);
+        return ok;
+    }
+private:
+    std::atomic<bool> ready;
+};
+
+class PyAllowThreadsIf
+{
+public:
+    PyAllowThreadsIf(bool cond, pyopencv_GILSite* site = 0) : _probe(site), _state(cond ? PyEval_SaveThread() : 0) {}
+    ~PyAllowThreadsIf()
+    {
+        if(_state)
+        {
+            _probe.acquiring();
+            PyEval_RestoreThread(_state);
+            _probe.acquired();
+        }
+    }
+private:
+    pyopencv_GILProbe _probe;
+    PyThreadState* _state;
+};
+
+#include "pytrace.hpp"
+#include "pytelemetry.hpp"
+#include "pycapture.hpp"
+#include "pyshm.hpp"
+
 #define ERRWRAP2(expr) \
 try \
 { \
-    PyAllowThreads allowThreads; \
+    PYOPENCV_TRACE_PHASE(PYOPENCV_TRACE_KERNEL); \
+    PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("ERRWRAP2")); \
+    expr; \
+    PYOPENCV_TRACE_PHASE(PYOPENCV_TRACE_GIL); \
+} \
+catch (const cv::Exception &e) \
+{ \
+    PyErr_SetString(opencv_error, e.what()); \
+    return 0; \
+}
+
+// the same as ERRWRAP2, but the GIL is only released if cond is true
+#define ERRWRAP2_IF(cond, expr) \
+try \
+{ \
+    PYOPENCV_TRACE_PHASE(PYOPENCV_TRACE_KERNEL); \
+    PyAllowThreadsIf allowThreads(cond, PYOPENCV_GIL_SITE("ERRWRAP2_IF")); \
     expr; \
+    PYOPENCV_TRACE_PHASE(PYOPENCV_TRACE_GIL); \
 } \
 catch (const cv::Exception &e) \
 { \
@@ -88,6 +187,77 @@ catch (const cv::Exception &e) \
     return 0; \
 }
 
+// GIL cost model of the generated wrappers. Releasing and re-acquiring the GIL costs more
+// than a call on small data, and makes the other Python threads contend for the GIL, so
+// by default the GIL is only released if the Mat arguments take at least
+// pyopencv_gil_threshold bytes. The output Mat's that are not allocated yet are estimated
+// to be as large as the largest argument. Functions can override it with CV_GIL_KEEP,
+// CV_GIL_RELEASE and CV_GIL_RELEASE_ABOVE(n) (see hdr_parser.py and gen2.py).
+static std::atomic<size_t> pyopencv_gil_threshold(32 << 10);
+
+static inline size_t pyopencv_nbytes(const cv::Mat& m)
+{
+    return m.dims > 0 ? m.total()*m.elemSize() : 0;
+}
+
+// Counters of the conversion layer, compiled in with PYOPENCV_ENABLE_STATS (bench/bench_convert.cpp
+// builds the module with it); cv2._stats() returns them. Without it the updates compile to nothing.
+enum
+{
+    PYOPENCV_STAT_TO_MAT,          // pyopencv_to(Mat) from an array
+    PYOPENCV_STAT_FROM_MAT,        // pyopencv_from(Mat)
+    PYOPENCV_STAT_NUMPY_ALLOCS,    // arrays created by NumpyAllocator
+    PYOPENCV_STAT_NUMPY_BYTES,
+    PYOPENCV_STAT_COPIES,          // the data copied by the converters (layout, cast, foreign allocator)
+    PYOPENCV_STAT_BYTES_COPIED,
+    PYOPENCV_NSTATS
+};
+
+#ifdef PYOPENCV_ENABLE_STATS
+static std::atomic<size_t> pyopencv_stats[PYOPENCV_NSTATS];
+#define PYOPENCV_STAT_ADD(i, n) pyopencv_stats[i].fetch_add((size_t)(n), std::memory_order_relaxed)
+
+static PyObject* pycvStats(PyObject*, PyObject* args)
+{
+    static const char* names[] = { "to_mat", "from_mat", "numpy_allocs", "numpy_bytes", "copies", "bytes_copied" };
+    int reset = 0;
+    if( !PyArg_ParseTuple(args, "|i:_stats", &reset) )
+        return NULL;
+    PyObject* d = PyDict_New();
+    for( int i = 0; d && i < PYOPENCV_NSTATS; i++ )
+    {
+        PyObject* v = PyLong_FromSize_t(reset ? pyopencv_stats[i].exchange(0) : pyopencv_stats[i].load());
+        if( !v || PyDict_SetItemString(d, names[i], v) < 0 )
+            Py_CLEAR(d);
+        Py_XDECREF(v);
+    }
+    return d;
+}
+#else
+#define PYOPENCV_STAT_ADD(i, n) (void)0
+#endif
+
+static inline size_t pyopencv_nbytes(const std::vector<cv::Mat>& mv)
+{
+    size_t i, n = 0;
+    for( i = 0; i < mv.size(); i++ )
+        n += pyopencv_nbytes(mv[i]);
+    return n;
+}
+
+template<typename... _Ts> static inline bool pyopencv_release_gil(size_t threshold, const _Ts&... mats)
+{
+    const size_t nbytes[] = { pyopencv_nbytes(mats)... };
+    size_t i, total = 0, largest = 0, nempty = 0;
+    for( i = 0; i < sizeof...(_Ts); i++ )
+    {
+        total += nbytes[i];
+        largest = std::max(largest, nbytes[i]);
+        nempty += nbytes[i] == 0;
+    }
+    return total + largest*nempty >= threshold;
+}
+
 using namespace cv;
 using cv::flann::IndexParams;
 using cv::flann::SearchParams;
@@ -136,6 +306,51 @@ static PyObject* failmsgp(const char *fmt, ...)
   return 0;
 }
 
+// Mat depth <-> numpy type number mapping. Both functions fold to constants for constant arguments;
+// the run-time lookups below go through the tables built from them.
+static constexpr int pyopencv_depth_to_typenum(int depth)
+{
+    return depth == CV_8U ? NPY_UBYTE : depth == CV_8S ? NPY_BYTE :
+           depth == CV_16U ? NPY_USHORT : depth == CV_16S ? NPY_SHORT :
+           depth == CV_32S ? NPY_INT : depth == CV_32F ? NPY_FLOAT :
+           depth == CV_64F ? NPY_DOUBLE : -1;
+}
+
+static constexpr int pyopencv_typenum_to_depth(int typenum)
+{
+    return typenum == NPY_UBYTE ? CV_8U : typenum == NPY_BYTE ? CV_8S :
+           typenum == NPY_USHORT ? CV_16U : typenum == NPY_SHORT ? CV_16S :
+           typenum == NPY_INT ? CV_32S : typenum == NPY_INT32 ? CV_32S :
+           typenum == NPY_FLOAT ? CV_32F : typenum == NPY_DOUBLE ? CV_64F : -1;
+}
+
+static const int pyopencv_depth_typenum_tab[] =
+{
+    pyopencv_depth_to_typenum(0), pyopencv_depth_to_typenum(1), pyopencv_depth_to_typenum(2),
+    pyopencv_depth_to_typenum(3), pyopencv_depth_to_typenum(4), pyopencv_depth_to_typenum(5),
+    pyopencv_depth_to_typenum(6), pyopencv_depth_to_typenum(7)
+};
+
+// indexed by the numpy type numbers up to NPY_DOUBLE, which cover all the types Mat can hold
+static const signed char pyopencv_typenum_depth_tab[] =
+{
+    pyopencv_typenum_to_depth(0), pyopencv_typenum_to_depth(1), pyopencv_typenum_to_depth(2),
+    pyopencv_typenum_to_depth(3), pyopencv_typenum_to_depth(4), pyopencv_typenum_to_depth(5),
+    pyopencv_typenum_to_depth(6), pyopencv_typenum_to_depth(7), pyopencv_typenum_to_depth(8),
+    pyopencv_typenum_to_depth(9), pyopencv_typenum_to_depth(10), pyopencv_typenum_to_depth(11),
+    pyopencv_typenum_to_depth(12)
+};
+
+static inline int pyopencv_typenum(int depth)
+{
+    return pyopencv_depth_typenum_tab[depth & CV_MAT_DEPTH_MASK];
+}
+
+static inline int pyopencv_depth(int typenum)
+{
+    return (unsigned)typenum <= (unsigned)NPY_DOUBLE ? pyopencv_typenum_depth_tab[typenum] : -1;
+}
+
 class NumpyAllocator : public MatAllocator
 {
 public:
@@ -163,24 +378,26 @@ public:
             // probably this is safe to do in such extreme case
             return stdAllocator->allocate(dims0, sizes, type, data, step, flags, usageFlags);
         }
-        PyEnsureGIL gil;
+        PYOPENCV_TRACE_SPAN(PYOPENCV_TRACE_ALLOC);
+        PyEnsureGIL gil(PYOPENCV_GIL_SITE("NumpyAllocator::allocate"));
 
         int depth = CV_MAT_DEPTH(type);
         int cn = CV_MAT_CN(type);
         const int f = (int)(sizeof(size_t)/8);
-        int typenum = depth == CV_8U ? NPY_UBYTE : depth == CV_8S ? NPY_BYTE :
-        depth == CV_16U ? NPY_USHORT : depth == CV_16S ? NPY_SHORT :
-        depth == CV_32S ? NPY_INT : depth == CV_32F ? NPY_FLOAT :
-        depth == CV_64F ? NPY_DOUBLE : f*NPY_ULONGLONG + (f^1)*NPY_UINT;
+        int typenum = pyopencv_typenum(depth);
+        if( typenum < 0 )
+            typenum = f*NPY_ULONGLONG + (f^1)*NPY_UINT;
         int i, dims = dims0;
         cv::AutoBuffer<npy_intp> _sizes(dims + 1);
         for( i = 0; i < dims; i++ )
             _sizes[i] = sizes[i];
         if( cn > 1 )
             _sizes[dims++] = cn;
-        PyObject* o = PyArray_SimpleNew(dims, _sizes, typenum);
+        PyObject* o = pyopencv_new_array(dims, _sizes, typenum);
         if(!o)
             CV_Error_(Error::StsError, ("The numpy array of typenum=%d, ndims=%d can not be created", typenum, dims));
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_NUMPY_ALLOCS, 1);
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_NUMPY_BYTES, PyArray_NBYTES((PyArrayObject*)o));
         return allocate(o, dims0, sizes, type, step);
     }
 
@@ -193,7 +410,7 @@ public:
     {
         if(u)
         {
-            PyEnsureGIL gil;
+            PyEnsureGIL gil(PYOPENCV_GIL_SITE("NumpyAllocator::deallocate"));
             PyObject* o = (PyObject*)u->userdata;
             Py_XDECREF(o);
             delete u;
@@ -214,8 +431,52 @@ PyObject* pyopencv_from(const T& src);
 
 enum { ARG_NONE = 0, ARG_MAT = 1, ARG_SCALAR = 2 };
 
+// Numbers and numerical tuples passed where a Mat is expected become a CV_64F column
+// (4 rows for a single number, so that it acts as a Scalar). If the caller provides storage
+// for 4 doubles, the Mat is put on top of it instead of the heap; the storage must then
+// outlive all the uses of the Mat.
+static bool pyopencv_to_scalar_mat(PyObject* o, Mat& m, const ArgInfo info, double* scalarbuf)
+{
+    PyObject** items = &o;
+    int i, sz = 1, rows = 4;
+    if( PyTuple_Check(o) )
+    {
+        rows = sz = (int)PyTuple_GET_SIZE(o);
+        items = &PyTuple_GET_ITEM(o, 0);
+    }
+
+    if( scalarbuf && rows <= 4 )
+        m = Mat(rows, 1, CV_64F, scalarbuf);
+    else
+        m = Mat(rows, 1, CV_64F);
+
+    double* data = (double*)m.data;
+    for( i = sz; i < rows; i++ )
+        data[i] = 0.;
+    for( i = 0; i < sz; i++ )
+    {
+        PyObject* oi = items[i];
+        if( PyFloat_CheckExact(oi) )
+            data[i] = PyFloat_AS_DOUBLE(oi);
+        else if( PyInt_Check(oi) )
+            data[i] = (double)PyInt_AsLong(oi);
+        else if( PyFloat_Check(oi) )
+            data[i] = PyFloat_AsDouble(oi);
+        else
+        {
+            failmsg("%s is not a numerical tuple", info.name);
+            m.release();
+            return false;
+        }
+    }
+    return true;
+}
+
 // special case, when the convertor needs full ArgInfo structure
-static bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
+static bool pyopencv_matexpr_check(PyObject* o);
+static bool pyopencv_matexpr_eval(PyObject* o, Mat& m, const ArgInfo info);
+
+static bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info, double* scalarbuf)
 {
     bool allowND = true;
     if(!o || o == Py_None)
@@ -225,38 +486,11 @@ static bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
         return true;
     }
 
-    if( PyInt_Check(o) )
-    {
-        double v[] = {PyInt_AsLong((PyObject*)o), 0., 0., 0.};
-        m = Mat(4, 1, CV_64F, v).clone();
-        return true;
-    }
-    if( PyFloat_Check(o) )
-    {
-        double v[] = {PyFloat_AsDouble((PyObject*)o), 0., 0., 0.};
-        m = Mat(4, 1, CV_64F, v).clone();
-        return true;
-    }
-    if( PyTuple_Check(o) )
-    {
-        int i, sz = (int)PyTuple_Size((PyObject*)o);
-        m = Mat(sz, 1, CV_64F);
-        for( i = 0; i < sz; i++ )
-        {
-            PyObject* oi = PyTuple_GET_ITEM(o, i);
-            if( PyInt_Check(oi) )
-                m.at<double>(i) = (double)PyInt_AsLong(oi);
-            else if( PyFloat_Check(oi) )
-                m.at<double>(i) = (double)PyFloat_AsDouble(oi);
-            else
-            {
-                failmsg("%s is not a numerical tuple", info.name);
-                m.release();
-                return false;
-            }
-        }
-        return true;
-    }
+    if( pyopencv_matexpr_check(o) )
+        return pyopencv_matexpr_eval(o, m, info);
+
+    if( PyInt_Check(o) || PyFloat_Check(o) || PyTuple_Check(o) )
+        return pyopencv_to_scalar_mat(o, m, info, scalarbuf);
 
     if( !PyArray_Check(o) )
     {
@@ -265,21 +499,15 @@ static bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
     }
 
     PyArrayObject* oarr = (PyArrayObject*) o;
+    PYOPENCV_STAT_ADD(PYOPENCV_STAT_TO_MAT, 1);
 
     bool needcopy = false, needcast = false;
     int typenum = PyArray_TYPE(oarr), new_typenum = typenum;
-    int type = typenum == NPY_UBYTE ? CV_8U :
-               typenum == NPY_BYTE ? CV_8S :
-               typenum == NPY_USHORT ? CV_16U :
-               typenum == NPY_SHORT ? CV_16S :
-               typenum == NPY_INT ? CV_32S :
-               typenum == NPY_INT32 ? CV_32S :
-               typenum == NPY_FLOAT ? CV_32F :
-               typenum == NPY_DOUBLE ? CV_64F : -1;
+    int type = pyopencv_depth(typenum);
 
     if( type < 0 )
     {
-        if( typenum == NPY_INT64 || typenum == NPY_UINT64 || type == NPY_LONG )
+        if( typenum == NPY_INT64 || typenum == NPY_UINT64 || typenum == NPY_LONG )
         {
             needcopy = needcast = true;
             new_typenum = NPY_INT;
@@ -340,6 +568,8 @@ static bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
             oarr = PyArray_GETCONTIGUOUS(oarr);
             o = (PyObject*) oarr;
         }
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_COPIES, 1);
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_BYTES_COPIED, PyArray_NBYTES(oarr));
 
         _strides = PyArray_STRIDES(oarr);
     }
@@ -378,27 +608,242 @@ static bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
         Py_INCREF(o);
     }
     m.allocator = &g_numpyAllocator;
+    PYOPENCV_TRACE_SHAPE(info.name, m);
+    PYOPENCV_TELEMETRY_BYTES(false, pyopencv_nbytes(m));
 
     return true;
 }
 
+static bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
+{
+    return pyopencv_to(o, m, info, 0);
+}
+
 template<>
 PyObject* pyopencv_from(const Mat& m)
 {
     if( !m.data )
         Py_RETURN_NONE;
+    PYOPENCV_STAT_ADD(PYOPENCV_STAT_FROM_MAT, 1);
+    PYOPENCV_TRACE_SHAPE("out", m);
+    PYOPENCV_TELEMETRY_BYTES(true, pyopencv_nbytes(m));
     Mat temp, *p = (Mat*)&m;
     if(!p->u || p->allocator != &g_numpyAllocator)
     {
         temp.allocator = &g_numpyAllocator;
         ERRWRAP2(m.copyTo(temp));
         p = &temp;
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_COPIES, 1);
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_BYTES_COPIED, pyopencv_nbytes(temp));
     }
     PyObject* o = (PyObject*)p->u->userdata;
     Py_INCREF(o);
     return o;
 }
 
+// Mat-valued properties of the wrapped types. The getter returns an array sharing the memory
+// of the member instead of a copy; the array keeps the data alive through a capsule holding
+// a Mat header, so it stays valid even if the member is reallocated later. The setter copies
+// into the existing storage of the member if the size and the type match, so the arrays
+// previously returned by the getter see the new values. The arrays of the read-only properties
+// are read-only views. A member wrapping user memory (no reference counter) is copied instead,
+// as nothing would keep that memory alive for the array.
+static void pyopencv_release_mat_capsule(PyObject* capsule)
+{
+    delete (Mat*)PyCapsule_GetPointer(capsule, "cv2.Mat");
+}
+
+static PyObject* pyopencv_from_view(const Mat& m, bool readonly = false)
+{
+    int typenum = pyopencv_typenum(m.depth());
+    // the numpy-allocated matrices are returned as is anyway, through a view if read-only,
+    // so the array of the member stays writable; pyopencv_from() copies the user memory
+    if( !m.data || !m.u || m.allocator == &g_numpyAllocator || typenum < 0 )
+    {
+        PyObject* o = pyopencv_from(m);
+        if( !readonly || !o || !PyArray_Check(o) )
+            return o;
+        PyObject* v = PyArray_View((PyArrayObject*)o, NULL, NULL);
+        Py_DECREF(o);
+        if( v )
+            PyArray_CLEARFLAGS((PyArrayObject*)v, NPY_ARRAY_WRITEABLE);
+        return v;
+    }
+
+    int i, dims = m.dims, cn = m.channels();
+    npy_intp sizes[CV_MAX_DIM+1], steps[CV_MAX_DIM+1];
+    for( i = 0; i < dims; i++ )
+    {
+        sizes[i] = m.size[i];
+        steps[i] = (npy_intp)m.step[i];
+    }
+    if( cn > 1 )
+    {
+        sizes[dims] = cn;
+        steps[dims++] = (npy_intp)m.elemSize1();
+    }
+
+    Mat* header = new Mat(m);
+    PyObject* capsule = PyCapsule_New(header, "cv2.Mat", pyopencv_release_mat_capsule);
+    if( !capsule )
+    {
+        delete header;
+        return NULL;
+    }
+    PyObject* o = PyArray_New(&PyArray_Type, dims, sizes, typenum, steps, m.data, 0,
+                              readonly ? 0 : NPY_ARRAY_WRITEABLE, NULL);
+    if( !o )
+    {
+        Py_DECREF(capsule);
+        return NULL;
+    }
+    // steals the reference to the capsule, even on failure
+    if( PyArray_SetBaseObject((PyArrayObject*)o, capsule) < 0 )
+    {
+        Py_DECREF(o);
+        return NULL;
+    }
+    return o;
+}
+
+static PyObject* pyopencv_from_readonly_view(const Mat& m)
+{
+    return pyopencv_from_view(m, true);
+}
+
+static bool pyopencv_assign(PyObject* o, Mat& m)
+{
+    Mat temp;
+    if( !pyopencv_to(o, temp, ArgInfo("value", 0)) )
+        return false;
+    if( m.data && temp.data != m.data && temp.size == m.size && temp.type() == m.type() )
+    {
+        // with the GIL (the thread attached): the setters call this in the critical section of
+        // the object, which a detached thread would suspend, letting another setter copy too
+        ERRWRAP2_IF(false, temp.copyTo(m));
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_COPIES, 1);
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_BYTES_COPIED, pyopencv_nbytes(m));
+    }
+    else
+        m = temp;
+    return true;
+}
+
+// Fixed-size tuple converters for the small value types (Size, Rect, Point, ...).
+// The element types are known at compile time, so the tuples are packed and unpacked
+// element by element instead of interpreting a format string on every call.
+// Unpacking accepts tuples and lists of the exact length.
+template<typename... _Ts> static bool pyopencv_unpack(PyObject* obj, const char* name, _Ts&... vs);
+template<typename... _Ts> static PyObject* pyopencv_pack(const _Ts&... vs);
+
+static inline bool pyopencv_to_elem(PyObject* o, double& v)
+{
+    if( PyFloat_CheckExact(o) )
+    {
+        v = PyFloat_AS_DOUBLE(o);
+        return true;
+    }
+    v = PyFloat_AsDouble(o);
+    return v != -1 || !PyErr_Occurred();
+}
+
+static inline bool pyopencv_to_elem(PyObject* o, float& v)
+{
+    double d;
+    if( !pyopencv_to_elem(o, d) )
+        return false;
+    v = (float)d;
+    return true;
+}
+
+static inline bool pyopencv_to_elem(PyObject* o, int& v)
+{
+    if( PyFloat_Check(o) )
+        return false;
+    long l = PyInt_AsLong(o);
+    if( l == -1 && PyErr_Occurred() )
+        return false;
+    if( l < INT_MIN || l > INT_MAX )
+    {
+        PyErr_SetString(PyExc_OverflowError, "signed integer is out of range");
+        return false;
+    }
+    v = (int)l;
+    return true;
+}
+
+template<typename _Tp> static inline bool pyopencv_to_elem(PyObject* o, Point_<_Tp>& p)
+{
+    return pyopencv_unpack(o, "<element>", p.x, p.y);
+}
+
+template<typename _Tp> static inline bool pyopencv_to_elem(PyObject* o, Size_<_Tp>& sz)
+{
+    return pyopencv_unpack(o, "<element>", sz.width, sz.height);
+}
+
+static inline PyObject* pyopencv_from_elem(int v) { return PyInt_FromLong(v); }
+static inline PyObject* pyopencv_from_elem(float v) { return PyFloat_FromDouble(v); }
+static inline PyObject* pyopencv_from_elem(double v) { return PyFloat_FromDouble(v); }
+
+template<typename _Tp> static inline PyObject* pyopencv_from_elem(const Point_<_Tp>& p)
+{
+    return pyopencv_pack(p.x, p.y);
+}
+
+template<typename _Tp> static inline PyObject* pyopencv_from_elem(const Size_<_Tp>& sz)
+{
+    return pyopencv_pack(sz.width, sz.height);
+}
+
+static inline bool pyopencv_unpack_items(PyObject**)
+{
+    return true;
+}
+
+template<typename _T0, typename... _Ts> static inline
+bool pyopencv_unpack_items(PyObject** items, _T0& v0, _Ts&... vs)
+{
+    return pyopencv_to_elem(items[0], v0) && pyopencv_unpack_items(items + 1, vs...);
+}
+
+template<typename... _Ts> static bool pyopencv_unpack(PyObject* obj, const char* name, _Ts&... vs)
+{
+    const Py_ssize_t n = (Py_ssize_t)sizeof...(_Ts);
+    PyObject** items = 0;
+    if( PyTuple_Check(obj) && PyTuple_GET_SIZE(obj) == n )
+        items = &PyTuple_GET_ITEM(obj, 0);
+    else if( PyList_Check(obj) && PyList_GET_SIZE(obj) == n )
+        items = &PyList_GET_ITEM(obj, 0);
+
+    if( items && pyopencv_unpack_items(items, vs...) )
+        return true;
+    if( !PyErr_Occurred() )
+        failmsg("%s must be a tuple of %d numbers", name, (int)n);
+    return false;
+}
+
+template<typename... _Ts> static PyObject* pyopencv_pack(const _Ts&... vs)
+{
+    const int n = (int)sizeof...(_Ts);
+    PyObject* items[] = { pyopencv_from_elem(vs)... };
+    PyObject* t = PyTuple_New(n);
+    int i;
+    bool ok = t != 0;
+    for( i = 0; i < n; i++ )
+        ok = ok && items[i] != 0;
+    if( !ok )
+    {
+        Py_XDECREF(t);
+        for( i = 0; i < n; i++ )
+            Py_XDECREF(items[i]);
+        return 0;
+    }
+    for( i = 0; i < n; i++ )
+        PyTuple_SET_ITEM(t, i, items[i]);
+    return t;
+}
+
 template<>
 bool pyopencv_to(PyObject *o, Scalar& s, const char *name)
 {
@@ -408,16 +853,22 @@ bool pyopencv_to(PyObject *o, Scalar& s, const char *name)
         PyObject *fi = PySequence_Fast(o, name);
         if (fi == NULL)
             return false;
-        if (4 < PySequence_Fast_GET_SIZE(fi))
+        Py_ssize_t i, n = PySequence_Fast_GET_SIZE(fi);
+        PyObject** items = PySequence_Fast_ITEMS(fi);
+        if (4 < n)
         {
+            Py_DECREF(fi);
             failmsg("Scalar value for argument '%s' is longer than 4", name);
             return false;
         }
-        for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(fi); i++) {
-            PyObject *item = PySequence_Fast_GET_ITEM(fi, i);
-            if (PyFloat_Check(item) || PyInt_Check(item)) {
+        for (i = 0; i < n; i++) {
+            PyObject *item = items[i];
+            if (PyFloat_CheckExact(item)) {
+                s[(int)i] = PyFloat_AS_DOUBLE(item);
+            } else if (PyFloat_Check(item) || PyInt_Check(item)) {
                 s[(int)i] = PyFloat_AsDouble(item);
             } else {
+                Py_DECREF(fi);
                 failmsg("Scalar value for argument '%s' is not numeric", name);
                 return false;
             }
@@ -437,7 +888,7 @@ bool pyopencv_to(PyObject *o, Scalar& s, const char *name)
 template<>
 PyObject* pyopencv_from(const Scalar& src)
 {
-    return Py_BuildValue("(dddd)", src[0], src[1], src[2], src[3]);
+    return pyopencv_pack(src[0], src[1], src[2], src[3]);
 }
 
 template<>
@@ -594,13 +1045,13 @@ bool pyopencv_to(PyObject* obj, Size& sz, const char* name)
     (void)name;
     if(!obj || obj == Py_None)
         return true;
-    return PyArg_ParseTuple(obj, "ii", &sz.width, &sz.height) > 0;
+    return pyopencv_unpack(obj, name, sz.width, sz.height);
 }
 
 template<>
 PyObject* pyopencv_from(const Size& sz)
 {
-    return Py_BuildValue("(ii)", sz.width, sz.height);
+    return pyopencv_pack(sz.width, sz.height);
 }
 
 template<>
@@ -609,13 +1060,13 @@ bool pyopencv_to(PyObject* obj, Rect& r, const char* name)
     (void)name;
     if(!obj || obj == Py_None)
         return true;
-    return PyArg_ParseTuple(obj, "iiii", &r.x, &r.y, &r.width, &r.height) > 0;
+    return pyopencv_unpack(obj, name, r.x, r.y, r.width, r.height);
 }
 
 template<>
 PyObject* pyopencv_from(const Rect& r)
 {
-    return Py_BuildValue("(iiii)", r.x, r.y, r.width, r.height);
+    return pyopencv_pack(r.x, r.y, r.width, r.height);
 }
 
 template<>
@@ -629,13 +1080,13 @@ bool pyopencv_to(PyObject* obj, Range& r, const char* name)
         r = Range::all();
         return true;
     }
-    return PyArg_ParseTuple(obj, "ii", &r.start, &r.end) > 0;
+    return pyopencv_unpack(obj, name, r.start, r.end);
 }
 
 template<>
 PyObject* pyopencv_from(const Range& r)
 {
-    return Py_BuildValue("(ii)", r.start, r.end);
+    return pyopencv_pack(r.start, r.end);
 }
 
 template<>
@@ -651,7 +1102,7 @@ bool pyopencv_to(PyObject* obj, Point& p, const char* name)
         p.y = saturate_cast<int>(c.imag);
         return true;
     }
-    return PyArg_ParseTuple(obj, "ii", &p.x, &p.y) > 0;
+    return pyopencv_unpack(obj, name, p.x, p.y);
 }
 
 template<>
@@ -667,7 +1118,7 @@ bool pyopencv_to(PyObject* obj, Point2f& p, const char* name)
         p.y = saturate_cast<float>(c.imag);
         return true;
     }
-    return PyArg_ParseTuple(obj, "ff", &p.x, &p.y) > 0;
+    return pyopencv_unpack(obj, name, p.x, p.y);
 }
 
 template<>
@@ -683,20 +1134,20 @@ bool pyopencv_to(PyObject* obj, Point2d& p, const char* name)
         p.y = saturate_cast<double>(c.imag);
         return true;
     }
-    return PyArg_ParseTuple(obj, "dd", &p.x, &p.y) > 0;
+    return pyopencv_unpack(obj, name, p.x, p.y);
 }
 
 
 template<>
 PyObject* pyopencv_from(const Point& p)
 {
-    return Py_BuildValue("(ii)", p.x, p.y);
+    return pyopencv_pack(p.x, p.y);
 }
 
 template<>
 PyObject* pyopencv_from(const Point2f& p)
 {
-    return Py_BuildValue("(dd)", p.x, p.y);
+    return pyopencv_pack(p.x, p.y);
 }
 
 template<>
@@ -705,67 +1156,233 @@ bool pyopencv_to(PyObject* obj, Vec3d& v, const char* name)
     (void)name;
     if(!obj)
         return true;
-    return PyArg_ParseTuple(obj, "ddd", &v[0], &v[1], &v[2]) > 0;
+    return pyopencv_unpack(obj, name, v[0], v[1], v[2]);
 }
 
 template<>
 PyObject* pyopencv_from(const Vec3d& v)
 {
-    return Py_BuildValue("(ddd)", v[0], v[1], v[2]);
+    return pyopencv_pack(v[0], v[1], v[2]);
 }
 
 template<>
 PyObject* pyopencv_from(const Vec2d& v)
 {
-    return Py_BuildValue("(dd)", v[0], v[1]);
+    return pyopencv_pack(v[0], v[1]);
 }
 
 template<>
 PyObject* pyopencv_from(const Point2d& p)
 {
-    return Py_BuildValue("(dd)", p.x, p.y);
+    return pyopencv_pack(p.x, p.y);
 }
 
-template<typename _Tp> struct pyopencvVecConverter
+// Reads a single element of a numeric sequence. The exact int and float types are checked first,
+// so the common case costs a pointer comparison and a direct read; subclasses (e.g. numpy.float64
+// and bool) go through the generic protocol.
+template<typename _Cp> static inline bool pyopencv_to_number(PyObject* o, _Cp& dst)
 {
-    static bool to(PyObject* obj, std::vector<_Tp>& value, const ArgInfo info)
+    if( PyFloat_CheckExact(o) )
     {
-        typedef typename DataType<_Tp>::channel_type _Cp;
-        if(!obj || obj == Py_None)
-            return true;
-        if (PyArray_Check(obj))
-        {
-            Mat m;
-            pyopencv_to(obj, m, info);
-            m.copyTo(value);
-        }
-        if (!PySequence_Check(obj))
-            return false;
-        PyObject *seq = PySequence_Fast(obj, info.name);
-        if (seq == NULL)
+        dst = saturate_cast<_Cp>(PyFloat_AS_DOUBLE(o));
+        return true;
+    }
+    if( PyInt_Check(o) || PyLong_Check(o) )
+    {
+        long v = PyLong_AsLong(o);
+        if( v == -1 && PyErr_Occurred() )
             return false;
-        int i, j, n = (int)PySequence_Fast_GET_SIZE(seq);
-        value.resize(n);
+        dst = saturate_cast<_Cp>((int64)v);
+        return true;
+    }
+    if( PyFloat_Check(o) )
+    {
+        dst = saturate_cast<_Cp>(PyFloat_AsDouble(o));
+        return true;
+    }
+    return false;
+}
 
-        int type = DataType<_Tp>::type;
-        int depth = CV_MAT_DEPTH(type), channels = CV_MAT_CN(type);
-        PyObject** items = PySequence_Fast_ITEMS(seq);
+// Converts a list/tuple of plain numbers. The element type is detected once; for homogeneous
+// lists of exact ints or floats the items are then read without any per-item type checks.
+// Returns -1 if the list is not homogeneous, so that the caller can use the generic path.
+template<typename _Cp> static int pyopencv_to_numbers(PyObject** items, int n, _Cp* data)
+{
+    int i = 0;
+    PyTypeObject* itemtype = n > 0 ? Py_TYPE(items[0]) : 0;
+    while( i < n && Py_TYPE(items[i]) == itemtype )
+        i++;
 
+    if( i == n && itemtype == &PyFloat_Type )
+    {
+        for( i = 0; i < n; i++ )
+            data[i] = saturate_cast<_Cp>(PyFloat_AS_DOUBLE(items[i]));
+        return 1;
+    }
+    if( i == n && itemtype == &PyLong_Type )
+    {
         for( i = 0; i < n; i++ )
         {
-            PyObject* item = items[i];
-            PyObject* seq_i = 0;
-            PyObject** items_i = &item;
-            _Cp* data = (_Cp*)&value[i];
+            long v = PyLong_AsLong(items[i]);
+            if( v == -1 && PyErr_Occurred() )
+                return 0;
+            data[i] = saturate_cast<_Cp>((int64)v);
+        }
+        return 1;
+    }
+    return -1;
+}
 
-            if( channels == 2 && PyComplex_CheckExact(item) )
-            {
-                Py_complex c = PyComplex_AsCComplex(obj);
-                data[0] = saturate_cast<_Cp>(c.real);
+template<typename _Cp, typename _Sp> static void pyopencv_cvt_buffer(const void* src, _Cp* dst, Py_ssize_t n)
+{
+    const _Sp* s = (const _Sp*)src;
+    for( Py_ssize_t i = 0; i < n; i++ )
+        dst[i] = saturate_cast<_Cp>(s[i]);
+}
+
+// Converts the contents of an object exporting the buffer protocol (array.array, memoryview, bytes, ...)
+// in a single typed pass. Returns -1 if the buffer format is not a numeric one of the native byte
+// order, so that the caller can fall back to the sequence protocol.
+template<typename _Tp> static int pyopencv_to_vec_buffer(PyObject* obj, std::vector<_Tp>& value)
+{
+    typedef typename DataType<_Tp>::channel_type _Cp;
+    int channels = DataType<_Tp>::channels;
+    Py_buffer view;
+
+    if( PyObject_GetBuffer(obj, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0 )
+    {
+        PyErr_Clear();
+        return -1;
+    }
+
+    const char* fmt = view.format ? view.format : "B";
+    if( *fmt == '@' || *fmt == '=' ||
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        *fmt == '<' )
+#else
+        *fmt == '>' || *fmt == '!' )
+#endif
+        fmt++;
+
+    Py_ssize_t count = view.itemsize > 0 ? view.len / view.itemsize : 0;
+    if( fmt[0] == '\0' || fmt[1] != '\0' || count % channels != 0 )
+    {
+        PyBuffer_Release(&view);
+        return -1;
+    }
+
+    value.resize(count / channels);
+    _Cp* data = value.empty() ? 0 : (_Cp*)&value[0];
+    int ok = 1;
+    switch( fmt[0] )
+    {
+    case 'b': pyopencv_cvt_buffer<_Cp, schar>(view.buf, data, count); break;
+    case 'B': pyopencv_cvt_buffer<_Cp, uchar>(view.buf, data, count); break;
+    case 'h': pyopencv_cvt_buffer<_Cp, short>(view.buf, data, count); break;
+    case 'H': pyopencv_cvt_buffer<_Cp, ushort>(view.buf, data, count); break;
+    case 'i': pyopencv_cvt_buffer<_Cp, int>(view.buf, data, count); break;
+    case 'I': pyopencv_cvt_buffer<_Cp, unsigned>(view.buf, data, count); break;
+    // the size of long is native with '@' and 4 bytes with '=' and '<', as given by itemsize
+    case 'l':
+        if( view.itemsize == 8 ) pyopencv_cvt_buffer<_Cp, int64>(view.buf, data, count);
+        else pyopencv_cvt_buffer<_Cp, int>(view.buf, data, count);
+        break;
+    case 'L':
+        if( view.itemsize == 8 ) pyopencv_cvt_buffer<_Cp, uint64>(view.buf, data, count);
+        else pyopencv_cvt_buffer<_Cp, unsigned>(view.buf, data, count);
+        break;
+    case 'q': pyopencv_cvt_buffer<_Cp, int64>(view.buf, data, count); break;
+    case 'Q': pyopencv_cvt_buffer<_Cp, uint64>(view.buf, data, count); break;
+    case 'f': pyopencv_cvt_buffer<_Cp, float>(view.buf, data, count); break;
+    case 'd': pyopencv_cvt_buffer<_Cp, double>(view.buf, data, count); break;
+    default:
+        ok = -1;
+    }
+    PyBuffer_Release(&view);
+    return ok;
+}
+
+template<typename _Tp> struct pyopencvVecConverter
+{
+    static bool to(PyObject* obj, std::vector<_Tp>& value, const ArgInfo info)
+    {
+        typedef typename DataType<_Tp>::channel_type _Cp;
+        if(!obj || obj == Py_None)
+            return true;
+
+        int type = DataType<_Tp>::type;
+        int depth = CV_MAT_DEPTH(type), channels = CV_MAT_CN(type);
+
+        if (PyArray_Check(obj))
+        {
+            Mat m;
+            if( !pyopencv_to(obj, m, info) )
+                return false;
+            // checkVector() and reshape() need the elements without gaps
+            if( !m.isContinuous() )
+                m = m.clone();
+            int n = m.checkVector(channels);
+            if( n < 0 )
+            {
+                failmsg("%s can not be converted to a vector of %d-channel elements", info.name, channels);
+                return false;
+            }
+            value.resize(n);
+            if( n > 0 )
+            {
+                Mat dst(n, 1, type, &value[0]);
+                m.reshape(channels, n).convertTo(dst, type);
+            }
+            return true;
+        }
+        if (!PyList_Check(obj) && !PyTuple_Check(obj) && PyObject_CheckBuffer(obj))
+        {
+            int r = pyopencv_to_vec_buffer(obj, value);
+            if( r >= 0 )
+                return r > 0;
+        }
+        if (!PySequence_Check(obj))
+            return false;
+        PyObject *seq = PySequence_Fast(obj, info.name);
+        if (seq == NULL)
+            return false;
+        int i, j, n = (int)PySequence_Fast_GET_SIZE(seq);
+        value.resize(n);
+
+        PyObject** items = PySequence_Fast_ITEMS(seq);
+
+        if( channels == 1 && n > 0 )
+        {
+            int r = pyopencv_to_numbers(items, n, (_Cp*)&value[0]);
+            if( r >= 0 )
+            {
+                Py_DECREF(seq);
+                return r > 0;
+            }
+        }
+
+        for( i = 0; i < n; i++ )
+        {
+            PyObject* item = items[i];
+            PyObject* seq_i = 0;
+            PyObject** items_i = &item;
+            _Cp* data = (_Cp*)&value[i];
+
+            if( channels == 2 && PyComplex_CheckExact(item) )
+            {
+                Py_complex c = PyComplex_AsCComplex(item);
+                data[0] = saturate_cast<_Cp>(c.real);
                 data[1] = saturate_cast<_Cp>(c.imag);
                 continue;
             }
-            if( channels > 1 )
+            // the nested tuples and lists are accessed in-place
+            if( channels == 1 && !PyArray_Check(item) )
+                ;
+            else if( PyTuple_CheckExact(item) && PyTuple_GET_SIZE(item) == channels )
+                items_i = &PyTuple_GET_ITEM(item, 0);
+            else if( PyList_CheckExact(item) && PyList_GET_SIZE(item) == channels )
+                items_i = &PyList_GET_ITEM(item, 0);
+            else
             {
                 if( PyArray_Check(item))
                 {
@@ -793,29 +1410,7 @@ template<typename _Tp> struct pyopencvVecConverter
 
             for( j = 0; j < channels; j++ )
             {
-                PyObject* item_ij = items_i[j];
-                if( PyInt_Check(item_ij))
-                {
-                    int v = (int)PyInt_AsLong(item_ij);
-                    if( v == -1 && PyErr_Occurred() )
-                        break;
-                    data[j] = saturate_cast<_Cp>(v);
-                }
-                else if( PyLong_Check(item_ij))
-                {
-                    int v = (int)PyLong_AsLong(item_ij);
-                    if( v == -1 && PyErr_Occurred() )
-                        break;
-                    data[j] = saturate_cast<_Cp>(v);
-                }
-                else if( PyFloat_Check(item_ij))
-                {
-                    double v = PyFloat_AsDouble(item_ij);
-                    if( PyErr_Occurred() )
-                        break;
-                    data[j] = saturate_cast<_Cp>(v);
-                }
-                else
+                if( !pyopencv_to_number(items_i[j], data[j]) )
                     break;
             }
             Py_XDECREF(seq_i);
@@ -904,15 +1499,156 @@ template<typename _Tp> struct pyopencvVecConverter<std::vector<_Tp> >
     }
 };
 
+// Views a stacked (N,H,W) or (N,H,W,C) numpy array as N Mat headers, one per slice of the
+// leading axis. All the headers share the array buffer and a single reference to the array,
+// so no per-item numpy views are created and nothing is copied unless the layout of an input
+// array is not compatible with cv::Mat. Returns false without setting an error when the array
+// can not be viewed this way; the caller then falls back to the per-item conversion.
+static bool pyopencv_batch_item_layout_ok(const npy_intp* _sizes, const npy_intp* _strides, int ndims, size_t elemsize)
+{
+    if( (size_t)_strides[ndims-1] != elemsize )
+        return false;
+    if( ndims == 4 && _strides[2] != (npy_intp)elemsize*_sizes[3] )
+        return false;
+    // transposed and flipped items
+    return _strides[1] >= _strides[2]*_sizes[2];
+}
+
+static bool pyopencv_to_mat_batch(PyObject* o, std::vector<Mat>& value, const ArgInfo info)
+{
+    PyArrayObject* oarr = (PyArrayObject*) o;
+    int ndims = PyArray_NDIM(oarr);
+    if( ndims != 3 && ndims != 4 )
+        return false;
+
+    const npy_intp* _sizes = PyArray_DIMS(oarr);
+    // the items of a 4-d array are (H,W,C) images, handled as multi-channel, the same as in pyopencv_to(Mat)
+    if( ndims == 4 && _sizes[3] > CV_CN_MAX )
+        return false;
+
+    bool needcopy = false, needcast = false;
+    int typenum = PyArray_TYPE(oarr), new_typenum = typenum;
+    int type = pyopencv_depth(typenum);
+
+    if( type < 0 )
+    {
+        if( typenum != NPY_INT64 && typenum != NPY_UINT64 && typenum != NPY_LONG )
+            return false;
+        needcopy = needcast = true;
+        new_typenum = NPY_INT;
+        type = CV_32S;
+    }
+
+    int i, n = (int)_sizes[0], cn = ndims == 4 ? (int)_sizes[3] : 1;
+    size_t elemsize = CV_ELEM_SIZE1(type);
+    const npy_intp* _strides = PyArray_STRIDES(oarr);
+
+    if( n == 0 )
+    {
+        value.clear();
+        return true;
+    }
+
+    // the batch stride may be anything; only the layout inside each item has to match cv::Mat
+    if( !pyopencv_batch_item_layout_ok(_sizes, _strides, ndims, elemsize) )
+        needcopy = true;
+
+    if( needcopy )
+    {
+        if( info.outputarg )
+            return false;
+
+        if( needcast )
+            o = PyArray_Cast(oarr, new_typenum);
+        else
+            o = (PyObject*)PyArray_GETCONTIGUOUS(oarr);
+        if( !o )
+        {
+            PyErr_Clear();
+            return false;
+        }
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_COPIES, 1);
+        PYOPENCV_STAT_ADD(PYOPENCV_STAT_BYTES_COPIED, PyArray_NBYTES((PyArrayObject*)o));
+        oarr = (PyArrayObject*) o;
+        _strides = PyArray_STRIDES(oarr);
+        if( !pyopencv_batch_item_layout_ok(_sizes, _strides, ndims, elemsize) )
+        {
+            Py_DECREF(o);
+            return false;
+        }
+    }
+    else
+        Py_INCREF(o);
+
+    type = CV_MAKETYPE(type, cn);
+    int size[] = { (int)_sizes[0], (int)_sizes[1], (int)_sizes[2] };
+    size_t step[] = { (size_t)_strides[0], (size_t)_strides[1], (size_t)_strides[2] };
+    // one UMatData owns the reference to the whole array; every item header adds to its refcount
+    UMatData* u = g_numpyAllocator.allocate(o, 3, size, type, step);
+    uchar* data = (uchar*)PyArray_DATA(oarr);
+
+    value.resize(n);
+    for( i = 0; i < n; i++ )
+    {
+        Mat& m = value[i];
+        m = Mat(size[1], size[2], type, data + (npy_intp)i*_strides[0], (size_t)_strides[1]);
+        m.u = u;
+        m.addref();
+        m.allocator = &g_numpyAllocator;
+    }
+    return true;
+}
+
+// The counterpart of pyopencv_to_mat_batch: when all the output Mat's are still the slices of
+// one stacked numpy array (i.e. the caller passed a stacked array for the output and the function
+// filled it in-place), the stacked array itself is returned instead of a list of arrays.
+static PyObject* pyopencv_from_mat_batch(const std::vector<Mat>& value)
+{
+    int i, n = (int)value.size();
+    if( n == 0 || !value[0].u || value[0].allocator != &g_numpyAllocator )
+        return 0;
+
+    UMatData* u = value[0].u;
+    PyObject* o = (PyObject*)u->userdata;
+    if( !o || !PyArray_Check(o) )
+        return 0;
+
+    PyArrayObject* oarr = (PyArrayObject*) o;
+    int ndims = PyArray_NDIM(oarr);
+    if( (ndims != 3 && ndims != 4) || PyArray_DIMS(oarr)[0] != n )
+        return 0;
+
+    const npy_intp* _sizes = PyArray_DIMS(oarr);
+    const npy_intp* _strides = PyArray_STRIDES(oarr);
+    const uchar* data = (const uchar*)PyArray_DATA(oarr);
+    int cn = ndims == 4 ? (int)_sizes[3] : 1;
+
+    for( i = 0; i < n; i++ )
+    {
+        const Mat& m = value[i];
+        if( m.u != u || m.dims != 2 || m.rows != _sizes[1] || m.cols != _sizes[2] ||
+            m.channels() != cn || m.data != data + (npy_intp)i*_strides[0] ||
+            m.step[0] != (size_t)_strides[1] )
+            return 0;
+    }
+    Py_INCREF(o);
+    return o;
+}
+
 template<> struct pyopencvVecConverter<Mat>
 {
     static bool to(PyObject* obj, std::vector<Mat>& value, const ArgInfo info)
     {
+        if( obj && PyArray_Check(obj) && pyopencv_to_mat_batch(obj, value, info) )
+            return true;
         return pyopencv_to_generic_vec(obj, value, info);
     }
 
     static PyObject* from(const std::vector<Mat>& value)
     {
+        PyObject* batch = pyopencv_from_mat_batch(value);
+        if( batch )
+            return batch;
         return pyopencv_from_generic_vec(value);
     }
 };
@@ -962,13 +1698,13 @@ bool pyopencv_to(PyObject *obj, TermCriteria& dst, const char *name)
     (void)name;
     if(!obj)
         return true;
-    return PyArg_ParseTuple(obj, "iid", &dst.type, &dst.maxCount, &dst.epsilon) > 0;
+    return pyopencv_unpack(obj, name, dst.type, dst.maxCount, dst.epsilon);
 }
 
 template<>
 PyObject* pyopencv_from(const TermCriteria& src)
 {
-    return Py_BuildValue("(iid)", src.type, src.maxCount, src.epsilon);
+    return pyopencv_pack(src.type, src.maxCount, src.epsilon);
 }
 
 template<>
@@ -977,13 +1713,13 @@ bool pyopencv_to(PyObject *obj, RotatedRect& dst, const char *name)
     (void)name;
     if(!obj)
         return true;
-    return PyArg_ParseTuple(obj, "(ff)(ff)f", &dst.center.x, &dst.center.y, &dst.size.width, &dst.size.height, &dst.angle) > 0;
+    return pyopencv_unpack(obj, name, dst.center, dst.size, dst.angle);
 }
 
 template<>
 PyObject* pyopencv_from(const RotatedRect& src)
 {
-    return Py_BuildValue("((ff)(ff)f)", src.center.x, src.center.y, src.size.width, src.size.height, src.angle);
+    return pyopencv_pack(src.center, src.size, src.angle);
 }
 
 template<>
@@ -1108,8 +1844,7 @@ PyObject* pyopencv_from(CvDTreeNode* const & node)
 
 static void OnMouse(int event, int x, int y, int flags, void* param)
 {
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
+    PyEnsureGIL gil(PYOPENCV_GIL_SITE("OnMouse"));
 
     PyObject *o = (PyObject*)param;
     PyObject *args = Py_BuildValue("iiiiO", event, x, y, flags, PyTuple_GetItem(o, 1));
@@ -1120,7 +1855,6 @@ static void OnMouse(int event, int x, int y, int flags, void* param)
     else
         Py_DECREF(r);
     Py_DECREF(args);
-    PyGILState_Release(gstate);
 }
 
 static PyObject *pycvSetMouseCallback(PyObject*, PyObject *args, PyObject *kw)
@@ -1145,16 +1879,16 @@ static PyObject *pycvSetMouseCallback(PyObject*, PyObject *args, PyObject *kw)
 
 static void OnChange(int pos, void *param)
 {
-    PyGILState_STATE gstate;
-    gstate = PyGILState_Ensure();
+    PyEnsureGIL gil(PYOPENCV_GIL_SITE("OnChange"));
 
     PyObject *o = (PyObject*)param;
     PyObject *args = Py_BuildValue("(i)", pos);
     PyObject *r = PyObject_Call(PyTuple_GetItem(o, 0), args, NULL);
     if (r == NULL)
         PyErr_Print();
+    else
+        Py_DECREF(r);
     Py_DECREF(args);
-    PyGILState_Release(gstate);
 }
 
 static PyObject *pycvCreateTrackbar(PyObject*, PyObject *args)
@@ -1175,6 +1909,24 @@ static PyObject *pycvCreateTrackbar(PyObject*, PyObject *args)
     Py_RETURN_NONE;
 }
 
+static PyObject *pycvSetGILReleaseThreshold(PyObject*, PyObject *args)
+{
+    Py_ssize_t nbytes;
+    if (!PyArg_ParseTuple(args, "n", &nbytes))
+        return NULL;
+    if (nbytes < 0) {
+        PyErr_SetString(PyExc_ValueError, "the threshold must be non-negative");
+        return NULL;
+    }
+    pyopencv_gil_threshold.store((size_t)nbytes);
+    Py_RETURN_NONE;
+}
+
+static PyObject *pycvGetGILReleaseThreshold(PyObject*, PyObject*)
+{
+    return PyLong_FromSize_t(pyopencv_gil_threshold.load());
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////
 
 static int convert_to_char(PyObject *o, char *dst, const char *name = "no_name")
@@ -1188,74 +1940,1237 @@ static int convert_to_char(PyObject *o, char *dst, const char *name = "no_name")
   }
 }
 
-#if PY_MAJOR_VERSION >= 3
-#define MKTYPE2(NAME) pyopencv_##NAME##_specials(); if (!to_ok(&pyopencv_##NAME##_Type)) return NULL;
-#else
-#define MKTYPE2(NAME) pyopencv_##NAME##_specials(); if (!to_ok(&pyopencv_##NAME##_Type)) return
-#endif
+///////////////////////////////////////////////////////////////////////////////////////
+// Argument binding for the generated wrappers.
+//
+// Each variant of a wrapped function has a static pyopencv_kwparser describing its
+// Python signature. It binds the positional and keyword arguments of a call to the
+// parameter slots (borrowed references, NULL for the omitted optional parameters)
+// without interpreting a format string; the slots are then converted by pyopencv_to
+// and pyopencv_to_arg. If report is false (when trying the variants of an overloaded
+// function), a mismatch is returned silently.
+
+struct pyopencv_kwparser
+{
+    const char* fname;
+    const char** keywords;
+    int nmin, nmax;
+    std::atomic<PyObject**> names; // interned keywords, created on the first keyword call
+
+    bool parse(PyObject* args, PyObject* kw, PyObject** vals, bool report)
+    {
+        int i, npos = (int)PyTuple_GET_SIZE(args);
+        if( !bind_positional(npos, report) )
+            return false;
+        for( i = 0; i < npos; i++ )
+            vals[i] = PyTuple_GET_ITEM(args, i);
+        for( ; i < nmax; i++ )
+            vals[i] = 0;
+        if( kw && PyDict_Size(kw) > 0 )
+        {
+            PyObject *key, *value;
+            Py_ssize_t pos = 0;
+            while( PyDict_Next(kw, &pos, &key, &value) )
+                if( !bind_keyword(key, value, npos, vals, report) )
+                    return false;
+        }
+        return check_required(vals, report);
+    }
 
-#ifdef __GNUC__
-#  pragma GCC diagnostic ignored "-Wunused-parameter"
-#  pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#ifdef PYOPENCV_FASTCALL
+    bool parse(PyObject* const* args, Py_ssize_t nargs, PyObject* kwnames, PyObject** vals, bool report)
+    {
+        int i, npos = (int)nargs;
+        if( !bind_positional(npos, report) )
+            return false;
+        for( i = 0; i < npos; i++ )
+            vals[i] = args[i];
+        for( ; i < nmax; i++ )
+            vals[i] = 0;
+        if( kwnames )
+        {
+            Py_ssize_t k, nkw = PyTuple_GET_SIZE(kwnames);
+            for( k = 0; k < nkw; k++ )
+                if( !bind_keyword(PyTuple_GET_ITEM(kwnames, k), args[npos + k], npos, vals, report) )
+                    return false;
+        }
+        return check_required(vals, report);
+    }
 #endif
 
-#include "pyopencv_generated_types.h"
-#include "pyopencv_generated_funcs.h"
+    bool bind_positional(int npos, bool report) const
+    {
+        if( npos <= nmax )
+            return true;
+        if( report )
+            PyErr_Format(PyExc_TypeError, "%s() takes at most %d argument%s (%d given)",
+                         fname, nmax, nmax == 1 ? "" : "s", npos);
+        return false;
+    }
 
-static PyMethodDef methods[] = {
+    bool bind_keyword(PyObject* key, PyObject* value, int npos, PyObject** vals, bool report)
+    {
+        int j = find_keyword(key);
+        if( j < 0 )
+        {
+            if( report && !PyErr_Occurred() )
+            {
+                const char* keystr = PyString_Check(key) ? PyString_AsString(key) : 0;
+                if( keystr )
+                    PyErr_Format(PyExc_TypeError, "'%s' is an invalid keyword argument for %s()", keystr, fname);
+                else if( !PyErr_Occurred() )
+                    PyErr_Format(PyExc_TypeError, "keywords must be strings");
+            }
+            else if( !report )
+                PyErr_Clear();
+            return false;
+        }
+        if( j < npos || vals[j] )
+        {
+            if( report )
+                PyErr_Format(PyExc_TypeError, "argument for %s() given by name ('%s') and position (%d)",
+                             fname, keywords[j], j + 1);
+            return false;
+        }
+        vals[j] = value;
+        return true;
+    }
 
-#include "pyopencv_generated_func_tab.h"
-  {"createTrackbar", pycvCreateTrackbar, METH_VARARGS, "createTrackbar(trackbarName, windowName, value, count, onChange) -> None"},
-  {"setMouseCallback", (PyCFunction)pycvSetMouseCallback, METH_VARARGS | METH_KEYWORDS, "setMouseCallback(windowName, onMouse [, param]) -> None"},
-  {NULL, NULL},
+    int find_keyword(PyObject* key)
+    {
+        int j;
+        PyObject** names = this->names.load(std::memory_order_acquire);
+        if( !names )
+        {
+            // the threads racing on the first keyword call (free-threaded build) build their
+            // own arrays; the first one published is kept
+            PyObject** created = new PyObject*[nmax > 0 ? nmax : 1];
+            for( j = 0; j < nmax; j++ )
+#if PY_MAJOR_VERSION >= 3
+                created[j] = PyUnicode_InternFromString(keywords[j]);
+#else
+                created[j] = PyString_InternFromString(keywords[j]);
+#endif
+            if( this->names.compare_exchange_strong(names, created, std::memory_order_acq_rel) )
+                names = created;
+            else
+            {
+                for( j = 0; j < nmax; j++ )
+                    Py_XDECREF(created[j]);
+                delete[] created;
+            }
+        }
+        // the keyword names in the calls are normally interned too
+        for( j = 0; j < nmax; j++ )
+            if( key == names[j] )
+                return j;
+        if( !PyString_Check(key) )
+            return -1;
+        const char* keystr = PyString_AsString(key);
+        if( !keystr )
+            return -1;
+        for( j = 0; j < nmax; j++ )
+            if( strcmp(keystr, keywords[j]) == 0 )
+                return j;
+        return -1;
+    }
+
+    bool check_required(PyObject** vals, bool report) const
+    {
+        for( int j = 0; j < nmin; j++ )
+            if( !vals[j] )
+            {
+                if( report )
+                    PyErr_Format(PyExc_TypeError, "%s() missing required argument '%s' (pos %d)",
+                                 fname, keywords[j], j + 1);
+                return false;
+            }
+        return true;
+    }
 };
 
-/************************************************************************/
-/* Module init */
+// Converters for the arguments of the simple types. They follow the rules of the
+// respective PyArg_ParseTuple format units ("i", "f", "d", "b", "s"), except that
+// an omitted optional argument keeps its default value.
 
-static int to_ok(PyTypeObject *to)
+static bool pyopencv_to_arg(PyObject* o, int& value, const ArgInfo info)
 {
-  to->tp_alloc = PyType_GenericAlloc;
-  to->tp_new = PyType_GenericNew;
-  to->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE;
-  return (PyType_Ready(to) == 0);
+    if( !o )
+        return true;
+    if( PyFloat_Check(o) )
+    {
+        failmsg("integer argument expected for '%s', got float", info.name);
+        return false;
+    }
+    long v = PyInt_AsLong(o);
+    if( v == -1 && PyErr_Occurred() )
+        return false;
+    if( v < INT_MIN || v > INT_MAX )
+    {
+        PyErr_Format(PyExc_OverflowError, "argument '%s' is out of the int range", info.name);
+        return false;
+    }
+    value = (int)v;
+    return true;
 }
 
-
-#if PY_MAJOR_VERSION >= 3
-extern "C" CV_EXPORTS PyObject* PyInit_cv2();
-static struct PyModuleDef cv2_moduledef =
+static bool pyopencv_to_arg(PyObject* o, double& value, const ArgInfo info)
 {
-    PyModuleDef_HEAD_INIT,
-    MODULESTR,
-    "Python wrapper for OpenCV.",
-    -1,     /* size of per-interpreter state of the module,
-               or -1 if the module keeps state in global variables. */
-    methods
-};
+    (void)info;
+    if( !o )
+        return true;
+    if( PyFloat_CheckExact(o) )
+    {
+        value = PyFloat_AS_DOUBLE(o);
+        return true;
+    }
+    value = PyFloat_AsDouble(o);
+    return value != -1 || !PyErr_Occurred();
+}
 
-PyObject* PyInit_cv2()
-#else
-extern "C" CV_EXPORTS void initcv2();
+static bool pyopencv_to_arg(PyObject* o, float& value, const ArgInfo info)
+{
+    double v = 0;
+    if( !o )
+        return true;
+    if( !pyopencv_to_arg(o, v, info) )
+        return false;
+    value = (float)v;
+    return true;
+}
 
-void initcv2()
+static bool pyopencv_to_arg(PyObject* o, bool& value, const ArgInfo info)
+{
+    int v = 0;
+    if( !o )
+        return true;
+    if( !pyopencv_to_arg(o, v, info) )
+        return false;
+    if( v < 0 || v > UCHAR_MAX )
+    {
+        PyErr_Format(PyExc_OverflowError, "argument '%s' is out of the unsigned char range", info.name);
+        return false;
+    }
+    value = v != 0;
+    return true;
+}
+
+static bool pyopencv_to_arg(PyObject* o, char*& value, const ArgInfo info)
+{
+    if( !o )
+        return true;
+    if( !PyString_Check(o) && !PyUnicode_Check(o) )
+    {
+        failmsg("string argument expected for '%s'", info.name);
+        return false;
+    }
+    value = (char*)PyString_AsString(o);
+    return value != 0;
+}
+
+// Cheap checks whether an argument may be converted to T, used by the generated wrappers
+// of the overloaded functions to skip the variants that can not match before any argument
+// is converted. They must never reject an object that pyopencv_to or pyopencv_to_arg would accept.
+template<typename T> static inline bool pyopencv_check(PyObject*)
+{
+    return true;
+}
+
+static inline bool pyopencv_check_seq(PyObject* o, Py_ssize_t n)
+{
+    return (PyTuple_Check(o) && PyTuple_GET_SIZE(o) == n) || (PyList_Check(o) && PyList_GET_SIZE(o) == n);
+}
+
+template<> inline bool pyopencv_check<int>(PyObject* o)
+{
+    // Python 2 still accepts floats for the integer arguments
+    return !o || (PyNumber_Check(o) && (PY_MAJOR_VERSION < 3 || !PyFloat_Check(o)));
+}
+
+template<> inline bool pyopencv_check<double>(PyObject* o)
+{
+    return !o || PyNumber_Check(o);
+}
+
+template<> inline bool pyopencv_check<Mat>(PyObject* o)
+{
+    return !o || o == Py_None || PyArray_Check(o) || PyInt_Check(o) || PyFloat_Check(o) || PyTuple_Check(o) ||
+           pyopencv_matexpr_check(o);
+}
+
+template<> inline bool pyopencv_check<Point>(PyObject* o)
+{
+    return !o || o == Py_None || PyComplex_CheckExact(o) || pyopencv_check_seq(o, 2);
+}
+
+template<> inline bool pyopencv_check<Size>(PyObject* o)
+{
+    return !o || o == Py_None || pyopencv_check_seq(o, 2);
+}
+
+template<> inline bool pyopencv_check<Rect>(PyObject* o)
+{
+    return !o || o == Py_None || pyopencv_check_seq(o, 4);
+}
+
+template<> inline bool pyopencv_check<Scalar>(PyObject* o)
+{
+    return !o || o == Py_None || PyFloat_Check(o) || PyInt_Check(o) ||
+        (PySequence_Check(o) && PySequence_Size(o) <= 4);
+}
+
+template<> inline bool pyopencv_check<String>(PyObject* o)
+{
+    return !o || o == Py_None || PyString_Check(o) || PyUnicode_Check(o);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// The native thread pool of the module, which runs the cv2.batch() calls and the
+// <name>_async() calls. Every worker has its own deque of tasks: it takes the tasks from
+// the back of it and, when it is empty, steals them from the front of the other deques.
+// The tasks submitted from outside of the pool are spread over the workers round-robin and
+// queued at the front, so each worker takes them in the order of submission and an old
+// future is not starved by the new ones.
+//
+// A parallel region uses as many threads as the pool has workers, the calling one included.
+// cv2.parallel_scope(threads=N) limits the number of threads (including the calling one)
+// a parallel region started by the current thread may use. A region started from a worker,
+// i.e. a nested one, is run serially by that worker, so the pool is never oversubscribed.
+// The scope does not limit the parallel loops inside OpenCV functions, which still use the
+// OpenCV backend (cv2.setNumThreads).
+
+struct pyopencv_Task
+{
+    virtual ~pyopencv_Task() {}
+    virtual void run() = 0;
+};
+
+class pyopencv_ThreadPool
+{
+public:
+    // starts the pool on the first call; must be called with the GIL held
+    static pyopencv_ThreadPool* get();
+    static bool inWorker() { return isWorker; }
+    // the number of the workers the pool starts with
+    static int defaultSize() { return std::max((int)std::thread::hardware_concurrency(), 1); }
+
+    // takes the ownership of the task; fails after the shutdown
+    bool submit(pyopencv_Task* task);
+    // runs body over the range with at most nthreads threads, including the calling one,
+    // which takes part in the work; must be called without the GIL
+    void parallel_for(const Range& range, const ParallelLoopBody& body, int nthreads);
+    void shutdown();
+    int size() const { return (int)threads.size(); }
+
+protected:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<pyopencv_Task*> tasks;
+    };
+
+    pyopencv_ThreadPool() : pending(0), nextQueue(0), stopping(false) {}
+    bool start(int nthreads);
+    void worker(int idx);
+    pyopencv_Task* take(int idx);
+
+    std::vector<Ptr<Queue> > queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> pending;
+    std::atomic<unsigned> nextQueue;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool stopping;
+
+    static thread_local bool isWorker;
+};
+
+thread_local bool pyopencv_ThreadPool::isWorker = false;
+
+// never destroyed: the workers are joined by the atexit hook, while the interpreter is still alive
+static std::atomic<pyopencv_ThreadPool*> pyopencv_thread_pool(0);
+
+// the limit set by the innermost cv2.parallel_scope() of the thread, 0 - no limit, and
+// the limits of the outer scopes, restored on exit
+static thread_local int pyopencv_scope_threads = 0;
+static thread_local std::vector<int> pyopencv_scope_saved;
+
+static int pyopencv_region_threads(const pyopencv_ThreadPool* pool)
+{
+    return pyopencv_scope_threads > 0 ? pyopencv_scope_threads : pool->size();
+}
+
+static PyObject* pyopencv_pool_shutdown(PyObject*, PyObject*)
+{
+    pyopencv_ThreadPool* pool = pyopencv_thread_pool.load();
+    if( pool )
+    {
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("pool shutdown"));
+        pool->shutdown();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pyopencv_pool_shutdown_def =
+    {"_poolShutdown", pyopencv_pool_shutdown, METH_NOARGS, "Completes the submitted tasks and stops the worker threads"};
+
+pyopencv_ThreadPool* pyopencv_ThreadPool::get()
+{
+    pyopencv_ThreadPool* pool = pyopencv_thread_pool.load();
+    if( pool )
+        return pool;
+
+    PyInitLock lock;
+    pool = pyopencv_thread_pool.load();
+    if( pool )
+        return pool;
+    PyObject* atexit = PyImport_ImportModule("atexit");
+    PyObject* hook = PyCFunction_New(&pyopencv_pool_shutdown_def, NULL);
+    PyObject* r = atexit && hook ? PyObject_CallMethod(atexit, (char*)"register", (char*)"(O)", hook) : 0;
+    Py_XDECREF(atexit);
+    Py_XDECREF(hook);
+    if( !r )
+        return 0;
+    Py_DECREF(r);
+
+#if PY_VERSION_HEX < 0x03070000
+    PyEval_InitThreads();
 #endif
+    pool = new pyopencv_ThreadPool;
+    pool->start(defaultSize());
+    pyopencv_thread_pool.store(pool);
+    return pool;
+}
+
+bool pyopencv_ThreadPool::start(int nthreads)
 {
-  import_array();
+    int i;
+    for( i = 0; i < nthreads; i++ )
+        queues.push_back(makePtr<Queue>());
+    for( i = 0; i < nthreads; i++ )
+        threads.push_back(std::thread(&pyopencv_ThreadPool::worker, this, i));
+    return true;
+}
 
-#include "pyopencv_generated_type_reg.h"
+bool pyopencv_ThreadPool::submit(pyopencv_Task* task)
+{
+    {
+        // the task is queued and counted under the mutex checking stopping, so that a worker
+        // going to sleep can not miss it and shutdown() can not stop the workers before it is run
+        std::lock_guard<std::mutex> lock(mutex);
+        if( stopping )
+        {
+            delete task;
+            return false;
+        }
+        Queue& q = *queues[nextQueue++ % queues.size()];
+        std::lock_guard<std::mutex> qlock(q.mutex);
+        if( isWorker )
+            q.tasks.push_back(task);
+        else
+            q.tasks.push_front(task);
+        pending++;
+    }
+    cond.notify_one();
+    return true;
+}
 
-#if PY_MAJOR_VERSION >= 3
-  PyObject* m = PyModule_Create(&cv2_moduledef);
+pyopencv_Task* pyopencv_ThreadPool::take(int idx)
+{
+    int i, n = (int)queues.size();
+    for( i = 0; i < n; i++ )
+    {
+        Queue& q = *queues[(idx + i) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if( q.tasks.empty() )
+            continue;
+        pyopencv_Task* task;
+        if( i == 0 )
+        {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+        }
+        else
+        {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+        }
+        pending--;
+        return task;
+    }
+    return 0;
+}
+
+void pyopencv_ThreadPool::worker(int idx)
+{
+    isWorker = true;
+    for(;;)
+    {
+        pyopencv_Task* task = take(idx);
+        if( task )
+        {
+            task->run();
+            delete task;
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        while( pending <= 0 && !stopping )
+            cond.wait(lock);
+        // the queued tasks are completed even on shutdown
+        if( pending <= 0 && stopping )
+            return;
+    }
+}
+
+void pyopencv_ThreadPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cond.notify_all();
+    for( size_t i = 0; i < threads.size(); i++ )
+        threads[i].join();
+    threads.clear();
+}
+
+// the state of a parallel region shared by the calling thread and the helper tasks;
+// the helpers that start after all the stripes are taken only drop their reference
+struct pyopencv_ParallelRegion
+{
+    pyopencv_ParallelRegion(const Range& _range, const ParallelLoopBody& _body, int _nstripes)
+        : range(_range), body(_body), nstripes(_nstripes), next(0), done(0) {}
+
+    // runs the stripes until there are none left
+    void work()
+    {
+        int len = range.end - range.start, k;
+        while( (k = next++) < nstripes )
+        {
+            body(Range(range.start + (int)((int64)len*k/nstripes), range.start + (int)((int64)len*(k + 1)/nstripes)));
+            std::lock_guard<std::mutex> lock(mutex);
+            if( ++done == nstripes )
+                cond.notify_all();
+        }
+    }
+
+    Range range;
+    const ParallelLoopBody& body;
+    int nstripes;
+    std::atomic<int> next;
+    int done;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+struct pyopencv_ParallelTask : public pyopencv_Task
+{
+    pyopencv_ParallelTask(const std::shared_ptr<pyopencv_ParallelRegion>& _region) : region(_region) {}
+    void run() { region->work(); }
+
+    std::shared_ptr<pyopencv_ParallelRegion> region;
+};
+
+void pyopencv_ThreadPool::parallel_for(const Range& range, const ParallelLoopBody& body, int nthreads)
+{
+    int len = range.end - range.start;
+    if( len <= 0 )
+        return;
+    nthreads = std::min(std::min(nthreads, size() + 1), len);
+    if( isWorker || nthreads <= 1 )
+    {
+        body(range);
+        return;
+    }
+
+    // a few stripes per thread, so that a slow stripe is balanced by the others
+    std::shared_ptr<pyopencv_ParallelRegion> region =
+        std::make_shared<pyopencv_ParallelRegion>(range, body, std::min(len, nthreads*4));
+    for( int i = 1; i < nthreads; i++ )
+        if( !submit(new pyopencv_ParallelTask(region)) )
+            break;
+    region->work();
+
+    std::unique_lock<std::mutex> lock(region->mutex);
+    while( region->done < region->nstripes )
+        region->cond.wait(lock);
+}
+
+// cv2.parallel_scope(threads=N): a context manager setting the limit of the thread
+struct pyopencv_ParallelScope_t
+{
+    PyObject_HEAD
+    int threads;
+};
+
+// the previous limit is kept per entry, so a scope object can be re-entered
+static PyObject* pyopencv_ParallelScope_enter(PyObject* self, PyObject*)
+{
+    pyopencv_scope_saved.push_back(pyopencv_scope_threads);
+    pyopencv_scope_threads = ((pyopencv_ParallelScope_t*)self)->threads;
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject* pyopencv_ParallelScope_exit(PyObject*, PyObject*)
+{
+    if( !pyopencv_scope_saved.empty() )
+    {
+        pyopencv_scope_threads = pyopencv_scope_saved.back();
+        pyopencv_scope_saved.pop_back();
+    }
+    Py_RETURN_FALSE;
+}
+
+static PyMethodDef pyopencv_ParallelScope_methods[] =
+{
+    {"__enter__", (PyCFunction)pyopencv_ParallelScope_enter, METH_NOARGS, "Sets the thread limit of the current thread"},
+    {"__exit__", (PyCFunction)pyopencv_ParallelScope_exit, METH_VARARGS, "Restores the previous limit"},
+    {NULL, NULL}
+};
+
+static PyTypeObject pyopencv_ParallelScope_Type =
+{
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    MODULESTR".ParallelScope",
+    sizeof(pyopencv_ParallelScope_t),
+};
+
+static bool pyopencv_ParallelScope_ready()
+{
+    static PyTypeReadyFlag ready;
+    if( ready )
+        return true;
+    PyInitLock lock;
+    if( pyopencv_ParallelScope_Type.tp_flags & Py_TPFLAGS_READY )
+        return ready.set(true);
+    pyopencv_ParallelScope_Type.tp_dealloc = (destructor)PyObject_Del;
+    pyopencv_ParallelScope_Type.tp_methods = pyopencv_ParallelScope_methods;
+    pyopencv_ParallelScope_Type.tp_flags = Py_TPFLAGS_DEFAULT;
+    pyopencv_ParallelScope_Type.tp_doc = (char*)"Context manager limiting the threads of the parallel regions, see cv2.parallel_scope()";
+    return ready.set(PyType_Ready(&pyopencv_ParallelScope_Type) == 0);
+}
+
+static PyObject* pycvParallelScope(PyObject*, PyObject* args, PyObject* kw)
+{
+    const char* keywords[] = { "threads", NULL };
+    int threads = 0;
+    if( !PyArg_ParseTupleAndKeywords(args, kw, "|i:parallel_scope", (char**)keywords, &threads) )
+        return NULL;
+    if( threads < 0 )
+    {
+        PyErr_SetString(PyExc_ValueError, "the number of threads must be non-negative");
+        return NULL;
+    }
+    if( !pyopencv_ParallelScope_ready() )
+        return NULL;
+    pyopencv_ParallelScope_t* s = PyObject_NEW(pyopencv_ParallelScope_t, &pyopencv_ParallelScope_Type);
+    if( !s )
+        return NULL;
+    s->threads = threads;
+    return (PyObject*)s;
+}
+
+// a query, it does not start the pool
+static PyObject* pycvGetParallelScopeThreads(PyObject*, PyObject*)
+{
+    pyopencv_ThreadPool* pool = pyopencv_thread_pool.load();
+    int poolSize = pool ? pool->size() : pyopencv_ThreadPool::defaultSize();
+    return PyInt_FromLong(pyopencv_scope_threads > 0 ? std::min(pyopencv_scope_threads, poolSize + 1) : poolSize);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// cv2.batch(): a command buffer. The methods of a Batch object have the same signatures
+// as the module functions, but they only convert the arguments and record the call.
+// run() then executes all the recorded calls at once on the module thread pool
+// without the GIL and returns the list of their results.
+// The recorded calls must be independent, i.e. they must not write to the same arrays.
+
+enum { PYOPENCV_ARG_IN = 1, PYOPENCV_ARG_OUT = 2 };
+
+struct pyopencv_DeferredCall
+{
+    virtual ~pyopencv_DeferredCall() {}
+    virtual void run() = 0;
+    virtual PyObject* result() = 0;
+
+    // runs the call, storing the message of the exception if any (cleared first, as the calls of
+    // a pipeline are re-run); the GIL is not needed
+    void execute()
+    {
+        error.clear();
+        try
+        {
+            run();
+        }
+        catch (const cv::Exception &e)
+        {
+            error = e.what();
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+        }
+        catch (...)
+        {
+            error = "unknown exception";
+        }
+    }
+
+    // the i-th Mat argument, with its name and PYOPENCV_ARG_IN/OUT flags; 0 after the last one
+    virtual Mat* mat(int i, const char*& name, int& flags) = 0;
+    virtual Ptr<pyopencv_DeferredCall> clone() const = 0;
+
+    String error;
+};
+
+struct pyopencv_Batch_t
+{
+    PyObject_HEAD
+    std::vector<Ptr<pyopencv_DeferredCall> > calls;
+};
+
+static PyObject* pyopencv_Batch_add(PyObject* self, const Ptr<pyopencv_DeferredCall>& c)
+{
+    PYOPENCV_BEGIN_CRITICAL_SECTION(self)
+    ((pyopencv_Batch_t*)self)->calls.push_back(c);
+    PYOPENCV_END_CRITICAL_SECTION()
+    Py_RETURN_NONE;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// <name>_async(): the deferred call is submitted to the module thread pool and
+// a concurrent.futures.Future is returned at once. A worker runs the call without the GIL
+// and takes the GIL only to complete the future. asyncio code awaits the future via
+// asyncio.wrap_future(), which hands the result over to the event loop thread-safely.
+// A submitted call can not be cancelled.
+
+static std::atomic<PyObject*> pyopencv_Future_Type(0);
+
+struct pyopencv_AsyncTask : public pyopencv_Task
+{
+    void run()
+    {
+        call->execute();
+        complete();
+    }
+
+    void complete();
+
+    Ptr<pyopencv_DeferredCall> call;
+    PyObject* future;
+};
+
+void pyopencv_AsyncTask::complete()
+{
+    PyEnsureGIL gil(PYOPENCV_GIL_SITE("async completion"));
+    PyObject* res = 0;
+    if( call->error.empty() )
+        res = call->result();
+    else
+        PyErr_SetString(opencv_error, call->error.c_str());
+    // set_exception() needs an exception object
+    if( !res && !PyErr_Occurred() )
+        PyErr_SetString(PyExc_SystemError, "the result of the async call could not be converted");
+
+    PyObject* r;
+    if( res )
+    {
+        r = PyObject_CallMethod(future, (char*)"set_result", (char*)"(O)", res);
+        Py_DECREF(res);
+    }
+    else
+    {
+        PyObject *type, *value, *tb;
+        PyErr_Fetch(&type, &value, &tb);
+        PyErr_NormalizeException(&type, &value, &tb);
+        r = PyObject_CallMethod(future, (char*)"set_exception", (char*)"(O)", value);
+        Py_XDECREF(type);
+        Py_XDECREF(value);
+        Py_XDECREF(tb);
+    }
+    if( r )
+        Py_DECREF(r);
+    else
+        PyErr_WriteUnraisable(future);
+    // the arguments may refer to numpy arrays, so they are released under the GIL as well
+    call.release();
+    Py_DECREF(future);
+}
+
+static PyObject* pyopencv_async_submit(PyObject*, const Ptr<pyopencv_DeferredCall>& c)
+{
+    if( !pyopencv_Future_Type )
+    {
+        // the import is not done under PyInitLock, as it may run arbitrary Python code
+        PyObject* futures = PyImport_ImportModule("concurrent.futures");
+        if( !futures )
+            return NULL;
+        PyObject* type = PyObject_GetAttrString(futures, "Future");
+        Py_DECREF(futures);
+        if( !type )
+            return NULL;
+        PyObject* expected = 0;
+        if( !pyopencv_Future_Type.compare_exchange_strong(expected, type) )
+            Py_DECREF(type);
+    }
+    pyopencv_ThreadPool* pool = pyopencv_ThreadPool::get();
+    if( !pool )
+        return NULL;
+
+    PyObject* future = PyObject_CallObject(pyopencv_Future_Type.load(), NULL);
+    if( !future )
+        return NULL;
+    PyObject* r = PyObject_CallMethod(future, (char*)"set_running_or_notify_cancel", NULL);
+    if( !r )
+    {
+        Py_DECREF(future);
+        return NULL;
+    }
+    Py_DECREF(r);
+
+    // the task owns one reference to the future until it is completed
+    pyopencv_AsyncTask* task = new pyopencv_AsyncTask;
+    task->call = c;
+    task->future = future;
+    Py_INCREF(future);
+    if( !pool->submit(task) )
+    {
+        Py_DECREF(future);
+        Py_DECREF(future);
+        PyErr_SetString(PyExc_RuntimeError, "cannot submit the call after the interpreter shutdown");
+        return NULL;
+    }
+    return future;
+}
+
+// Freelists of the wrapper objects of the generated types. The objects are put to the list
+// of their type on dealloc, up to PYOPENCV_FREELIST_SIZE of them, and reused by the next
+// allocations instead of going through the allocator. The lists are only used under the GIL;
+// the free-threaded build goes to the allocator directly (mimalloc has per-thread heaps anyway).
+enum { PYOPENCV_FREELIST_SIZE = 64 };
+
+template<typename T> struct pyopencv_FreeList
+{
+    static T* items[PYOPENCV_FREELIST_SIZE];
+    static int count;
+};
+
+template<typename T> T* pyopencv_FreeList<T>::items[PYOPENCV_FREELIST_SIZE];
+template<typename T> int pyopencv_FreeList<T>::count = 0;
+
+template<typename T> static inline T* pyopencv_alloc(PyTypeObject* type)
+{
+#ifdef Py_GIL_DISABLED
+    return PyObject_NEW(T, type);
 #else
-  PyObject* m = Py_InitModule(MODULESTR, methods);
+    typedef pyopencv_FreeList<T> FreeList;
+    if( FreeList::count == 0 )
+        return PyObject_NEW(T, type);
+    T* o = FreeList::items[--FreeList::count];
+    (void)PyObject_INIT(o, type);
+    return o;
+#endif
+}
+
+template<typename T> static inline void pyopencv_free(PyObject* self, PyTypeObject* type)
+{
+    // the instances of the Python subclasses are allocated differently
+    if( Py_TYPE(self) != type )
+        Py_TYPE(self)->tp_free(self);
+#ifndef Py_GIL_DISABLED
+    else if( pyopencv_FreeList<T>::count < PYOPENCV_FREELIST_SIZE )
+        pyopencv_FreeList<T>::items[pyopencv_FreeList<T>::count++] = (T*)self;
+#endif
+    else
+        PyObject_Del(self);
+}
+
+static int to_ok(PyTypeObject *to)
+{
+  to->tp_alloc = PyType_GenericAlloc;
+  to->tp_new = PyType_GenericNew;
+  to->tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE;
+  return (PyType_Ready(to) == 0);
+}
+
+#define MKTYPE2(NAME) if (!pyopencv_##NAME##_ready()) return -1;
+
+#ifdef __GNUC__
+#  pragma GCC diagnostic ignored "-Wunused-parameter"
+#  pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#endif
+
+#include "pyopencv_generated_types.h"
+#include "pyopencv_generated_funcs.h"
+#include "pyopencv_generated_deferred.h"
+
+class pyopencv_DeferredBody : public ParallelLoopBody
+{
+public:
+    pyopencv_DeferredBody(std::vector<Ptr<pyopencv_DeferredCall> >& _calls) : calls(_calls) {}
+
+    void operator()(const Range& range) const
+    {
+        for( int i = range.start; i < range.end; i++ )
+            calls[i]->execute();
+    }
+
+protected:
+    std::vector<Ptr<pyopencv_DeferredCall> >& calls;
+};
+
+static PyObject* pyopencv_Batch_run(PyObject* self, PyObject* args, PyObject* kw)
+{
+    const char* keywords[] = { "threads", NULL };
+    int threads = 0;
+    if( !PyArg_ParseTupleAndKeywords(args, kw, "|i:run", (char**)keywords, &threads) )
+        return NULL;
+    pyopencv_ThreadPool* pool = pyopencv_ThreadPool::get();
+    if( !pool )
+        return NULL;
+    if( threads <= 0 )
+        threads = pyopencv_region_threads(pool);
+
+    std::vector<Ptr<pyopencv_DeferredCall> > calls;
+    // the batch is empty again once run() is called, even if some of the calls fail
+    PYOPENCV_BEGIN_CRITICAL_SECTION(self)
+    calls.swap(((pyopencv_Batch_t*)self)->calls);
+    PYOPENCV_END_CRITICAL_SECTION()
+    int i, n = (int)calls.size();
+
+    if( n > 0 )
+    {
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("Batch.run"));
+        pool->parallel_for(Range(0, n), pyopencv_DeferredBody(calls), threads);
+    }
+
+    for( i = 0; i < n; i++ )
+        if( !calls[i]->error.empty() )
+        {
+            PyErr_Format(opencv_error, "call #%d of the batch failed: %s", i, calls[i]->error.c_str());
+            return NULL;
+        }
+
+    PyObject* result = PyList_New(n);
+    if( !result )
+        return NULL;
+    for( i = 0; i < n; i++ )
+    {
+        PyObject* item = calls[i]->result();
+        if( !item )
+        {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyList_SET_ITEM(result, i, item);
+    }
+    return result;
+}
+
+static PyObject* pyopencv_Batch_clear(PyObject* self, PyObject*)
+{
+    // the calls are released outside of the critical section, as it may run Python code
+    std::vector<Ptr<pyopencv_DeferredCall> > calls;
+    PYOPENCV_BEGIN_CRITICAL_SECTION(self)
+    calls.swap(((pyopencv_Batch_t*)self)->calls);
+    PYOPENCV_END_CRITICAL_SECTION()
+    Py_RETURN_NONE;
+}
+
+static Py_ssize_t pyopencv_Batch_len(PyObject* self)
+{
+    Py_ssize_t n;
+    PYOPENCV_BEGIN_CRITICAL_SECTION(self)
+    n = (Py_ssize_t)((pyopencv_Batch_t*)self)->calls.size();
+    PYOPENCV_END_CRITICAL_SECTION()
+    return n;
+}
+
+static void pyopencv_Batch_dealloc(PyObject* self)
+{
+    typedef std::vector<Ptr<pyopencv_DeferredCall> > CallList;
+    ((pyopencv_Batch_t*)self)->calls.~CallList();
+    PyObject_Del(self);
+}
+
+static PyMethodDef pyopencv_Batch_methods[] =
+{
+#include "pyopencv_generated_deferred_tab.h"
+    {"run", (PyCFunction)pyopencv_Batch_run, METH_VARARGS | METH_KEYWORDS, "run([, threads]) -> results. Executes the recorded calls in parallel, with at most threads threads (by default as allowed by cv2.parallel_scope()), and returns the list of their results"},
+    {"clear", (PyCFunction)pyopencv_Batch_clear, METH_NOARGS, "clear() -> None. Drops the recorded calls"},
+    {NULL, NULL}
+};
+
+static PySequenceMethods pyopencv_Batch_as_sequence;
+
+static PyTypeObject pyopencv_Batch_Type =
+{
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    MODULESTR".Batch",
+    sizeof(pyopencv_Batch_t),
+};
+
+static void pyopencv_Batch_specials(void)
+{
+    pyopencv_Batch_as_sequence.sq_length = pyopencv_Batch_len;
+    pyopencv_Batch_Type.tp_as_sequence = &pyopencv_Batch_as_sequence;
+    pyopencv_Batch_Type.tp_dealloc = pyopencv_Batch_dealloc;
+    pyopencv_Batch_Type.tp_methods = pyopencv_Batch_methods;
+    pyopencv_Batch_Type.tp_flags = Py_TPFLAGS_DEFAULT;
+    pyopencv_Batch_Type.tp_doc = (char*)"Command buffer of deferred OpenCV calls, see cv2.batch()";
+}
+
+static PyObject* pycvBatch(PyObject*, PyObject*)
+{
+    static PyTypeReadyFlag ready;
+    if( !ready )
+    {
+        PyInitLock lock;
+        if( !(pyopencv_Batch_Type.tp_flags & Py_TPFLAGS_READY) )
+        {
+            pyopencv_Batch_specials();
+            if( PyType_Ready(&pyopencv_Batch_Type) < 0 )
+                return NULL;
+        }
+        ready.set(true);
+    }
+    pyopencv_Batch_t* b = PyObject_NEW(pyopencv_Batch_t, &pyopencv_Batch_Type);
+    if( !b )
+        return NULL;
+    new (&b->calls) std::vector<Ptr<pyopencv_DeferredCall> >();
+    return (PyObject*)b;
+}
+
+#include "pypipeline.hpp"
+#include "pytiled.hpp"
+#include "pyframering.hpp"
+#include "pymatexpr.hpp"
+
+// The module is initialized lazily to cut the import time: the wrapped types are readied when
+// their first instance is created (pyopencv_<name>_ready()) and the constants are kept in a static
+// table sorted by name, from which cv2.__getattr__ (PEP 562) creates them on the first access.
+// With Python < 3.7, or with OPENCV_PYTHON_EAGER_INIT=1 in the environment, everything is done at
+// import, as before. cv2._init_timings() reports the time spent in each phase of the init.
+
+struct pyopencv_ConstDef
+{
+    const char* name;
+    long value;
+};
+
+static const pyopencv_ConstDef pyopencv_consts[] =
+{
+#include "pyopencv_generated_const_tab.h"
+    {NULL, 0}
+};
+
+static const int pyopencv_nconsts = (int)(sizeof(pyopencv_consts)/sizeof(pyopencv_consts[0])) - 1;
+
+static const pyopencv_ConstDef* pyopencv_find_const(const char* name)
+{
+    int a = 0, b = pyopencv_nconsts;
+    while( a < b )
+    {
+        int c = (a + b)/2, cmp = strcmp(pyopencv_consts[c].name, name);
+        if( cmp == 0 )
+            return &pyopencv_consts[c];
+        if( cmp < 0 )
+            a = c + 1;
+        else
+            b = c;
+    }
+    return 0;
+}
+
+// the constants already in the module dict (created before, or assigned by the user) are kept
+static bool pyopencv_publish_consts(PyObject* d)
+{
+    for( int i = 0; i < pyopencv_nconsts; i++ )
+    {
+        if( PyDict_GetItemString(d, pyopencv_consts[i].name) )
+            continue;
+        PyObject* v = PyLong_FromLong(pyopencv_consts[i].value);
+        if( !v || PyDict_SetItemString(d, pyopencv_consts[i].name, v) < 0 )
+        {
+            Py_XDECREF(v);
+            return false;
+        }
+        Py_DECREF(v);
+    }
+    return true;
+}
+
+enum { PYOPENCV_INIT_IMPORT_ARRAY=0, PYOPENCV_INIT_TYPES, PYOPENCV_INIT_MODULE, PYOPENCV_INIT_CONSTANTS, PYOPENCV_INIT_PHASES };
+static int64 pyopencv_init_ticks[PYOPENCV_INIT_PHASES];
+static bool pyopencv_eager_init = true;
+
+static PyObject* pycvInitTimings(PyObject*, PyObject*)
+{
+    static const char* names[] = { "import_array", "types", "module", "constants" };
+    PyObject* d = PyDict_New();
+    double total = 0, freq = getTickFrequency();
+    for( int i = 0; d && i < PYOPENCV_INIT_PHASES; i++ )
+    {
+        double t = pyopencv_init_ticks[i]/freq;
+        PyObject* v = PyFloat_FromDouble(t);
+        total += t;
+        if( !v || PyDict_SetItemString(d, names[i], v) < 0 )
+            Py_CLEAR(d);
+        Py_XDECREF(v);
+    }
+    PyObject* v = d ? PyFloat_FromDouble(total) : 0;
+    if( v )
+        PyDict_SetItemString(d, "total", v);
+    Py_XDECREF(v);
+    if( d )
+    {
+        v = PyBool_FromLong(!pyopencv_eager_init);
+        PyDict_SetItemString(d, "lazy", v);
+        Py_DECREF(v);
+    }
+    return d;
+}
+
+#if PY_VERSION_HEX >= 0x03070000
+static PyObject* pycvModuleGetAttr(PyObject* m, PyObject* name)
+{
+    const char* cname = PyUnicode_Check(name) ? PyUnicode_AsUTF8(name) : 0;
+    if( !cname )
+        return NULL;
+    PyObject* d = PyModule_GetDict(m);
+    const pyopencv_ConstDef* c = pyopencv_find_const(cname);
+    if( c )
+    {
+        PyObject* v = PyLong_FromLong(c->value);
+        // the next lookups of the name do not get here
+        if( v && PyDict_SetItemString(d, c->name, v) < 0 )
+            Py_CLEAR(v);
+        return v;
+    }
+    // "from cv2 import *" looks up __all__ first; the constants are published then,
+    // and the lookup falls back to the module dict
+    if( strcmp(cname, "__all__") == 0 && !pyopencv_publish_consts(d) )
+        return NULL;
+    PyErr_Format(PyExc_AttributeError, "module '%s' has no attribute '%s'", MODULESTR, cname);
+    return NULL;
+}
+
+static PyObject* pycvModuleDir(PyObject* m, PyObject*)
+{
+    PyObject* d = PyModule_GetDict(m);
+    PyObject* names = PyDict_Keys(d);
+    for( int i = 0; names && i < pyopencv_nconsts; i++ )
+    {
+        if( PyDict_GetItemString(d, pyopencv_consts[i].name) )
+            continue;
+        PyObject* s = PyUnicode_FromString(pyopencv_consts[i].name);
+        if( !s || PyList_Append(names, s) < 0 )
+            Py_CLEAR(names);
+        Py_XDECREF(s);
+    }
+    return names;
+}
+
+static PyMethodDef pyopencv_lazy_methods[] =
+{
+    {"__getattr__", pycvModuleGetAttr, METH_O, "Creates the constants on the first access"},
+    {"__dir__", pycvModuleDir, METH_NOARGS, "Lists the module attributes, including the constants not created yet"},
+    {NULL, NULL}
+};
+#endif
+
+static PyMethodDef methods[] = {
+
+#include "pyopencv_generated_func_tab.h"
+  {"createTrackbar", pycvCreateTrackbar, METH_VARARGS, "createTrackbar(trackbarName, windowName, value, count, onChange) -> None"},
+  {"setMouseCallback", (PyCFunction)pycvSetMouseCallback, METH_VARARGS | METH_KEYWORDS, "setMouseCallback(windowName, onMouse [, param]) -> None"},
+  {"setGILReleaseThreshold", pycvSetGILReleaseThreshold, METH_VARARGS, "setGILReleaseThreshold(nbytes) -> None. The GIL is released by the wrapped functions if their Mat arguments take at least nbytes (0 - always)"},
+  {"getGILReleaseThreshold", pycvGetGILReleaseThreshold, METH_NOARGS, "getGILReleaseThreshold() -> nbytes"},
+#ifdef PYOPENCV_ENABLE_CAPTURE
+  {"startCapture", pycvStartCapture, METH_VARARGS, "startCapture(filename[, arrays]) -> None. Starts writing the calls of the wrapped functions with their arguments to the log file, for bench/cv2_replay; the data of the arrays are stored in the given fraction of the calls (1 by default), the shapes in all"},
+  {"stopCapture", pycvStopCapture, METH_NOARGS, "stopCapture() -> ncalls. Stops the capture and closes the log"},
+#endif
+#ifdef PYOPENCV_ENABLE_TELEMETRY
+  {"getTelemetry", pycvGetTelemetry, METH_NOARGS, "getTelemetry() -> dict. For each wrapped function called so far: count, total_ns, bytes_in, bytes_out and the latency histogram, a list of (lower_ns, upper_ns, count)"},
+  {"startTelemetryDump", pycvStartTelemetryDump, METH_VARARGS, "startTelemetryDump(filename[, interval]) -> None. Writes the telemetry in the Prometheus text format to filename now and then every interval seconds (10 by default), from a background thread"},
+  {"stopTelemetryDump", pycvStopTelemetryDump, METH_NOARGS, "stopTelemetryDump() -> None. Stops the periodic telemetry dump, writing the last one"},
+#endif
+#ifdef PYOPENCV_ENABLE_GIL_PROFILE
+  {"startGILProfile", pycvStartGILProfile, METH_NOARGS, "startGILProfile() -> None. Clears the GIL profile and starts collecting it"},
+  {"stopGILProfile", pycvStopGILProfile, METH_NOARGS, "stopGILProfile() -> None. Stops collecting the GIL profile"},
+  {"getGILProfile", pycvGetGILProfile, METH_NOARGS, "getGILProfile() -> sites. For each site releasing or acquiring the GIL: its kind, function and line, and the histograms (count, total_ns, buckets, where buckets[i] counts the times in [2^i, 2^(i+1)) ns) of the GIL wait and hold times"},
+#endif
+#ifdef PYOPENCV_ENABLE_TRACE
+  {"startTrace", pycvStartTrace, METH_VARARGS, "startTrace([, events]) -> None. Starts recording the phases of the wrapped calls, up to the given number of the latest events per thread"},
+  {"stopTrace", pycvStopTrace, METH_NOARGS, "stopTrace() -> None. Stops recording; the recorded events are kept until the next startTrace()"},
+  {"dumpTrace", pycvDumpTrace, METH_VARARGS, "dumpTrace(filename) -> nevents. Writes the recorded events as a Chrome trace JSON file"},
+#endif
+#ifdef PYOPENCV_ENABLE_STATS
+  {"_stats", pycvStats, METH_VARARGS, "_stats([, reset]) -> dict. The counters of the conversion layer (conversions, arrays allocated, data copied), reset to 0 if reset is true"},
 #endif
+#include "pyopencv_generated_async_tab.h"
+  {"_init_timings", pycvInitTimings, METH_NOARGS, "_init_timings() -> dict. The time in seconds spent in each phase of the module init"},
+  {"parallel_scope", (PyCFunction)pycvParallelScope, METH_VARARGS | METH_KEYWORDS, "parallel_scope([, threads]) -> scope. Context manager limiting the number of threads the parallel regions started by the current thread (cv2.batch().run()) may use; 0 - no limit. It does not limit the threads of the OpenCV functions themselves, see cv2.setNumThreads()"},
+  {"getParallelScopeThreads", pycvGetParallelScopeThreads, METH_NOARGS, "getParallelScopeThreads() -> threads. The number of threads the parallel regions started by the current thread may use"},
+  {"batch", pycvBatch, METH_NOARGS, "batch() -> Batch. Creates an empty command buffer; its methods record calls of the same-name functions, run() executes them in parallel"},
+  {"Pipeline", (PyCFunction)pycvPipeline, METH_VARARGS | METH_KEYWORDS, "Pipeline(stages[, outputs[, band_rows]]) -> Pipeline. Creates a graph of calls: stages is a list of (function, {argument: buffer}[, {argument: value}]); run(inputs...) executes it natively in one call, fusing the row-local stages into parallel row bands"},
+  {"MatExpr", pycvMatExpr, METH_VARARGS, "MatExpr(array) -> MatExpr. Wraps the array into a lazy expression: the arithmetic on it is fused by cv::MatExpr (into addWeighted(), scaleAdd(), ...) and evaluated when materialized with eval() or passed to a function"},
+  {"tiledApply", (PyCFunction)pycvTiledApply, METH_VARARGS | METH_KEYWORDS, "tiledApply(source, sink, op, halo[, tile_size[, threads[, size]]]) -> None. Applies op (a Pipeline or its stages, one input and one output) to an image too large for memory: the tiles of source (an array, e.g. np.memmap, or a callable source(x, y, w, h) with the image size) extended by halo pixels are processed in parallel with the GIL released and written to sink (an array or a callable sink(x, y, tile))"},
+#ifdef PYOPENCV_HAVE_SHM
+  {"setUseSharedMemory", (PyCFunction)pycvSetUseSharedMemory, METH_VARARGS | METH_KEYWORDS, "setUseSharedMemory(flag[, min_bytes]) -> None. Allocates the output arrays of at least min_bytes in named POSIX shared memory, to pass them to other processes by cv2.SharedFrame()"},
+  {"useSharedMemory", pycvUseSharedMemory, METH_NOARGS, "useSharedMemory() -> retval. True if the output arrays are allocated in shared memory"},
+  {"SharedFrame", pycvSharedFrame, METH_VARARGS, "SharedFrame(array) -> SharedFrame. A handle of the array in shared memory (copied there if it is not), pickled as (name, shape, dtype, strides) without the data; transfer() hands the ownership of the segment to the process opening the next pickle"},
+  {"_openSharedFrame", pycvOpenSharedFrame, METH_VARARGS, "_openSharedFrame(name, shape, dtype, strides[, owner]) -> SharedFrame. Maps a frame pickled by another process"},
+#endif
+#ifdef HAVE_OPENCV_VIDEOIO
+  {"FrameRing", (PyCFunction)pycvFrameRing, METH_VARARGS | METH_KEYWORDS, "FrameRing(source[, frames]) -> FrameRing. Opens a video file, an image sequence or a camera and decodes it on a native thread into a ring of preallocated frames; acquire() returns the next frame, release() gives it back"},
+#endif
+  {NULL, NULL},
+};
+
+/************************************************************************/
+/* Module init */
+
+// The module keeps its state in global variables (single-phase init, m_size -1): the static
+// types, the error class, the interned keyword names and the freelists are shared by the
+// process, and the callbacks and the thread pool take the GIL with PyGILState_Ensure(), which
+// targets the main interpreter. It declares that it runs without the GIL on the free-threaded
+// build (PEP 703): the wrapped objects keep no Python state besides the freelists (disabled
+// there), their properties are accessed under the critical section of the object, and the
+// one-time initialization and the lazily readied types are guarded by PyInitLock and atomics.
+
+static int pyopencv_exec(PyObject* m)
+{
+  int64 t0 = getTickCount(), t1;
+  import_array1(-1);
+  t1 = getTickCount();
+  pyopencv_init_ticks[PYOPENCV_INIT_IMPORT_ARRAY] = t1 - t0;
+  t0 = t1;
+
+#if PY_VERSION_HEX >= 0x03070000
+  const char* eager = getenv("OPENCV_PYTHON_EAGER_INIT");
+  pyopencv_eager_init = eager && *eager && strcmp(eager, "0") != 0;
+#endif
+  if (pyopencv_eager_init)
+  {
+#include "pyopencv_generated_type_reg.h"
+  }
+  t1 = getTickCount();
+  pyopencv_init_ticks[PYOPENCV_INIT_TYPES] = t1 - t0;
+  t0 = t1;
+
   PyObject* d = PyModule_GetDict(m);
+#if PY_VERSION_HEX >= 0x03070000
+  if (!pyopencv_eager_init && PyModule_AddFunctions(m, pyopencv_lazy_methods) < 0)
+    return -1;
+#endif
 
   PyDict_SetItemString(d, "__version__", PyString_FromString(CV_VERSION));
 
   opencv_error = PyErr_NewException((char*)MODULESTR".error", NULL, NULL);
-  PyDict_SetItemString(d, "error", opencv_error);
+  if (!opencv_error || PyDict_SetItemString(d, "error", opencv_error) < 0)
+    return -1;
 
 #define PUBLISH(I) PyDict_SetItemString(d, #I, PyInt_FromLong(I))
 //#define PUBLISHU(I) PyDict_SetItemString(d, #I, PyLong_FromUnsignedLong(I))
@@ -1297,8 +3212,47 @@ void initcv2()
   PUBLISH(CV_64FC3);
   PUBLISH(CV_64FC4);
 
-#include "pyopencv_generated_const_reg.h"
+  t1 = getTickCount();
+  pyopencv_init_ticks[PYOPENCV_INIT_MODULE] = t1 - t0;
+  t0 = t1;
+
+  if (pyopencv_eager_init && !pyopencv_publish_consts(d))
+    return -1;
+  pyopencv_init_ticks[PYOPENCV_INIT_CONSTANTS] = getTickCount() - t0;
+  return 0;
+}
+
 #if PY_MAJOR_VERSION >= 3
-    return m;
+extern "C" CV_EXPORTS PyObject* PyInit_cv2();
+static struct PyModuleDef cv2_moduledef =
+{
+    PyModuleDef_HEAD_INIT,
+    MODULESTR,
+    "Python wrapper for OpenCV.",
+    -1,     /* size of per-interpreter state of the module,
+               or -1 if the module keeps state in global variables. */
+    methods
+};
+
+PyObject* PyInit_cv2()
+{
+  PyObject* m = PyModule_Create(&cv2_moduledef);
+  if (m && pyopencv_exec(m) < 0)
+    Py_CLEAR(m);
+#ifdef Py_GIL_DISABLED
+  if (m && PyUnstable_Module_SetGIL(m, Py_MOD_GIL_NOT_USED) < 0)
+    Py_CLEAR(m);
 #endif
+  return m;
 }
+#else
+extern "C" CV_EXPORTS void initcv2();
+
+void initcv2()
+{
+  PyObject* m = Py_InitModule(MODULESTR, methods);
+  // the error is reported by the import
+  if (m && pyopencv_exec(m) < 0 && !PyErr_Occurred())
+    PyErr_SetString(PyExc_ImportError, "cv2 initialization failed");
+}
+#endif
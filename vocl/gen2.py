@@ -1,7 +1,7 @@
 #!/usr/bin/env python
 
 from __future__ import print_function
-import hdr_parser, sys, re, os
+import hdr_parser, sys, re, os, hashlib, json
 from string import Template
 
 if sys.version_info[0] >= 3:
@@ -18,31 +18,175 @@ gen_template_check_self = Template("""    if(!PyObject_TypeCheck(self, &pyopencv
 
 gen_template_check_self_algo = Template("""    if(!PyObject_TypeCheck(self, &pyopencv_${name}_Type))
         return failmsgp("Incorrect type of self (must be '${name}' or its derivative)");
-    $cname* _self_ = dynamic_cast<$cname*>(${amp}((pyopencv_${name}_t*)self)->v.get());
+    $cname* _self_ = pyopencv_${name}_self(self);
 """)
 
-gen_template_call_constructor_prelude = Template("""self = PyObject_NEW(pyopencv_${name}_t, &pyopencv_${name}_Type);
-        new (&(self->v)) Ptr<$cname>(); // init Ptr with placement new
+gen_template_call_constructor_prelude = Template("""self = pyopencv_${name}_ready() ? pyopencv_alloc<pyopencv_${name}_t>(&pyopencv_${name}_Type) : 0;
+        if(self) new (&(self->v)) Ptr<$cname>(); // init Ptr with placement new
+        if(self) """)
+
+gen_template_call_constructor_prelude_algo = Template("""self = pyopencv_${name}_ready() ? pyopencv_alloc<pyopencv_${name}_t>(&pyopencv_${name}_Type) : 0;
+        if(self) pyopencv_${name}_init(self);
         if(self) """)
 
 gen_template_call_constructor = Template("""self->v.reset(new ${cname}${args})""")
 
-gen_template_simple_call_constructor_prelude = Template("""self = PyObject_NEW(pyopencv_${name}_t, &pyopencv_${name}_Type);
+gen_template_simple_call_constructor_prelude = Template("""self = pyopencv_${name}_ready() ? pyopencv_alloc<pyopencv_${name}_t>(&pyopencv_${name}_Type) : 0;
         if(self) """)
 
 gen_template_simple_call_constructor = Template("""self->v = ${cname}${args}""")
 
-gen_template_parse_args = Template("""const char* keywords[] = { $kw_list, NULL };
-    if( PyArg_ParseTupleAndKeywords(args, kw, "$fmtspec", (char**)keywords, $parse_arglist)$code_cvt )""")
+gen_template_keywords = Template("""static const char* keywords[] = { $kw_list, NULL };
+    static pyopencv_kwparser parser = { "$fullname", keywords, $nmin, $nmax };
+    PyObject* pyargs[$nmax];""")
+
+gen_template_keywords_noargs = Template("""static pyopencv_kwparser parser = { "$fullname", 0, 0, 0 };
+    PyObject** pyargs = 0;""")
+
+gen_template_parse_args = Template("""if( parser.parse(PYOPENCV_ARGS_PASS, pyargs, $report)$code_cvt )""")
 
 gen_template_func_body = Template("""$code_decl
     $code_parse
     {
-        ${code_prelude}ERRWRAP2($code_fcall);
+${code_capture}        ${code_prelude}${code_fcall};
+${code_capture_end}        PYOPENCV_TRACE_PHASE(PYOPENCV_TRACE_CONVERT_OUT);
         $code_ret;
     }
 """)
 
+# a variant of an overloaded function is only tried if the arguments may match it;
+# the error left by a previously tried variant is discarded then
+gen_template_overload_body = Template("""    {
+    $code_keywords
+    if( $code_dispatch )
+    {
+    PyErr_Clear();
+$code_body    }
+    }
+""")
+
+gen_template_overload_fail = Template("""
+    if( !PyErr_Occurred() )
+        PyErr_SetString(PyExc_TypeError, "no overload of $fullname() matches the arguments: $py_docstring");
+""")
+
+# deferred form of a function variant, recorded by cv2.batch() or submitted by <name>_async()
+# and executed later: the arguments are bound and converted by bind(), under the GIL, the function
+# is called by run() without the GIL, possibly on another thread, and the result is converted back
+# by result(). cv2.Pipeline() reaches the Mat arguments through mat() and copies the call
+# for each of its workers by clone(), which points the scalar Mats to the buffers of the copy
+gen_template_deferred_call = Template("""struct pyopencv_${name}_call${idx} : public pyopencv_DeferredCall
+{
+$code_decl
+    bool bind(PYOPENCV_ARGS_DECL, bool report)
+    {
+    $code_keywords
+    if( !($code_bind) )
+        return false;
+    PyErr_Clear();
+    return $code_cvt;
+    }
+
+    void run()
+    {
+        $code_fcall;
+    }
+
+    PyObject* result()
+    {
+        $code_ret;
+    }
+
+    Mat* mat($code_mat_args)
+    {
+$code_mats        return 0;
+    }
+
+    Ptr<pyopencv_DeferredCall> clone() const
+    {
+        Ptr<pyopencv_${name}_call${idx}> c = makePtr<pyopencv_${name}_call${idx}>(*this);
+$code_clone        return c;
+    }
+};
+
+""")
+
+gen_template_deferred_variant = Template("""    {
+    Ptr<pyopencv_${name}_call${idx}> c = makePtr<pyopencv_${name}_call${idx}>();
+    if( c->bind(PYOPENCV_ARGS_PASS, $report) )
+        return ${submit}(self, c);
+    }
+""")
+
+# a recorded call of a function variant, re-run by the native replay of a capture log
+# (see pycapture.hpp): the arguments are declared as by the wrapper, the input ones are read
+# from the log by read() and the function is called by run()
+gen_template_replay_call = Template("""struct pyopencv_${name}_replay${idx} : public pyopencv_ReplayCall
+{
+$code_decl
+    bool read(pyopencv_CaptureReader& _reader_)
+    {
+        return $code_read;
+    }
+
+    void run()
+    {
+        $code_fcall;
+    }
+};
+
+""")
+
+# the argument types stored by the capture log (see pyopencv_CaptureBuffer in pycapture.hpp),
+# and the vectors of them
+capture_arg_types = ["bool", "uchar", "char", "int", "int64", "size_t", "float", "double", "String",
+    "Mat", "Point", "Point2f", "Point2d", "Point3f", "Size", "Size2f", "Rect", "Range", "RotatedRect",
+    "TermCriteria", "Scalar", "Vec2f", "Vec3f", "Vec4f", "Vec6f", "Vec4i", "Vec2d", "Vec3d"]
+
+def is_capture_type(tp):
+    while tp.startswith("vector_"):
+        tp = tp[len("vector_"):]
+    return tp in capture_arg_types
+
+def capture_ctype(tp):
+    # the vector_* typedefs of cv2.cpp are spelled out, as the replay is built without it
+    if tp.startswith("vector_"):
+        return "std::vector<%s>" % (capture_ctype(tp[len("vector_"):]),)
+    return tp
+
+# the functions that are never deferred: GUI calls must be made from the thread owning the windows
+deferred_exclude_list = ["imshow", "namedWindow", "destroyWindow", "destroyAllWindows", "waitKey",
+    "moveWindow", "resizeWindow", "setWindowProperty", "getWindowProperty", "setWindowTitle",
+    "createTrackbar", "getTrackbarPos", "setTrackbarPos", "setMouseCallback", "startWindowThread",
+    "updateWindow", "setOpenGlContext", "setOpenGlDrawCallback", "displayOverlay", "displayStatusBar",
+    "selectROI", "selectROIs"]
+
+# GIL policies of the functions that can not be annotated in the headers
+# (see CV_GIL_KEEP, CV_GIL_RELEASE and CV_GIL_RELEASE_ABOVE in pygilpolicy.hpp)
+gil_policy_table = {
+    # trivial queries
+    "getTickCount": "keep", "getTickFrequency": "keep", "getCPUTickCount": "keep",
+    "getNumThreads": "keep", "getThreadNum": "keep", "getNumberOfCPUs": "keep",
+    "useOptimized": "keep", "checkHardwareSupport": "keep", "getOptimalDFTSize": "keep",
+    "borderInterpolate": "keep", "getTextSize": "keep", "getBuildInformation": "keep",
+    # I/O and GUI calls may block regardless of the data size
+    "imread": "release", "imwrite": "release", "imdecode": "release", "imencode": "release",
+    "imshow": "release", "waitKey": "release",
+    "VideoCapture.open": "release", "VideoCapture.read": "release", "VideoCapture.grab": "release",
+    "VideoCapture.retrieve": "release", "VideoCapture.release": "release",
+    "VideoWriter.open": "release", "VideoWriter.write": "release", "VideoWriter.release": "release"
+}
+
+# the return types of the functions, which are treated as trivial queries if they have no arguments
+gil_keep_rettypes = ["bool", "int", "int64", "size_t", "float", "double", "String"]
+
+# argument types, for which a cheap check is done before choosing an overloaded function variant
+dispatch_argtype_checks = {
+    "int": "int", "float": "double", "double": "double", "Mat": "Mat",
+    "Point": "Point", "Point2f": "Point", "Point2d": "Point", "Size": "Size", "Size2f": "Size",
+    "Rect": "Rect", "Scalar": "Scalar", "String": "String", "c_string": "String"
+}
+
 py_major_version = sys.version_info[0]
 if py_major_version >= 3:
     head_init_str = "PyVarObject_HEAD_INIT(&PyType_Type, 0)"
@@ -64,14 +208,18 @@ static PyTypeObject pyopencv_${name}_Type =
     sizeof(pyopencv_${name}_t),
 };
 
+static bool pyopencv_${name}_ready();
+
 static void pyopencv_${name}_dealloc(PyObject* self)
 {
-    PyObject_Del(self);
+    pyopencv_free<pyopencv_${name}_t>(self, &pyopencv_${name}_Type);
 }
 
 template<> PyObject* pyopencv_from(const ${cname}& r)
 {
-    pyopencv_${name}_t *m = PyObject_NEW(pyopencv_${name}_t, &pyopencv_${name}_Type);
+    if( !pyopencv_${name}_ready() )
+        return 0;
+    pyopencv_${name}_t *m = pyopencv_alloc<pyopencv_${name}_t>(&pyopencv_${name}_Type);
     m->v = r;
     return (PyObject*)m;
 }
@@ -95,7 +243,7 @@ gen_template_type_decl = Template("""
 struct pyopencv_${name}_t
 {
     PyObject_HEAD
-    Ptr<${cname1}> v;
+    Ptr<${cname}> v;
 };
 
 static PyTypeObject pyopencv_${name}_Type =
@@ -105,16 +253,20 @@ static PyTypeObject pyopencv_${name}_Type =
     sizeof(pyopencv_${name}_t),
 };
 
+static bool pyopencv_${name}_ready();
+
 static void pyopencv_${name}_dealloc(PyObject* self)
 {
     ((pyopencv_${name}_t*)self)->v.release();
-    PyObject_Del(self);
+    pyopencv_free<pyopencv_${name}_t>(self, &pyopencv_${name}_Type);
 }
 
 template<> PyObject* pyopencv_from(const Ptr<${cname}>& r)
 {
-    pyopencv_${name}_t *m = PyObject_NEW(pyopencv_${name}_t, &pyopencv_${name}_Type);
-    new (&(m->v)) Ptr<$cname1>(); // init Ptr with placement new
+    if( !pyopencv_${name}_ready() )
+        return 0;
+    pyopencv_${name}_t *m = pyopencv_alloc<pyopencv_${name}_t>(&pyopencv_${name}_Type);
+    new (&(m->v)) Ptr<$cname>(); // init Ptr with placement new
     m->v = r;
     return (PyObject*)m;
 }
@@ -134,6 +286,83 @@ template<> bool pyopencv_to(PyObject* src, Ptr<${cname}>& dst, const char* name)
 
 """ % head_init_str)
 
+# the wrapped algorithms are stored as Ptr<Algorithm>; the pointers to the wrapped classes
+# of the hierarchy are cached in the object, so the methods do not need dynamic_cast on each call
+gen_template_algo_type_decl = Template("""
+struct pyopencv_${name}_t
+{
+    PyObject_HEAD
+    Ptr<cv::Algorithm> v;
+    // v.get() cast to the wrapped classes of the hierarchy, indexed by their depth in it
+    std::atomic<void*> ptrs[PYOPENCV_ALGO_DEPTH];
+};
+
+static PyTypeObject pyopencv_${name}_Type =
+{
+    %s
+    MODULESTR".$wname",
+    sizeof(pyopencv_${name}_t),
+};
+
+static bool pyopencv_${name}_ready();
+
+static void pyopencv_${name}_init(pyopencv_${name}_t* m)
+{
+    new (&(m->v)) Ptr<cv::Algorithm>(); // init Ptr with placement new
+    for( int i = 0; i < PYOPENCV_ALGO_DEPTH; i++ )
+        m->ptrs[i].store(0, std::memory_order_relaxed);
+}
+
+// self must be checked to be ${name} or its derivative; the object is never changed after
+// it is constructed, so the dynamic_cast is done once per object. The threads racing on the
+// first call (free-threaded build) all store the same pointer, so a relaxed atomic is enough
+static inline ${cname}* pyopencv_${name}_self(PyObject* self)
+{
+    pyopencv_${name}_t* m = (pyopencv_${name}_t*)self;
+    void* p = m->ptrs[${depth}].load(std::memory_order_relaxed);
+    if( !p )
+    {
+        p = dynamic_cast<${cname}*>(m->v.get());
+        m->ptrs[${depth}].store(p, std::memory_order_relaxed);
+    }
+    CV_DbgAssert( p == dynamic_cast<${cname}*>(m->v.get()) );
+    return static_cast<${cname}*>(p);
+}
+
+static void pyopencv_${name}_dealloc(PyObject* self)
+{
+    ((pyopencv_${name}_t*)self)->v.release();
+    pyopencv_free<pyopencv_${name}_t>(self, &pyopencv_${name}_Type);
+}
+
+template<> PyObject* pyopencv_from(const Ptr<${cname}>& r)
+{
+    if( !pyopencv_${name}_ready() )
+        return 0;
+    pyopencv_${name}_t *m = pyopencv_alloc<pyopencv_${name}_t>(&pyopencv_${name}_Type);
+    pyopencv_${name}_init(m);
+    m->v = r;
+    // the static type of r is known here, so its pointer is cached right away
+    m->ptrs[${depth}].store(r.get(), std::memory_order_relaxed);
+    return (PyObject*)m;
+}
+
+template<> bool pyopencv_to(PyObject* src, Ptr<${cname}>& dst, const char* name)
+{
+    if( src == NULL || src == Py_None )
+        return true;
+    if(!PyObject_TypeCheck(src, &pyopencv_${name}_Type))
+    {
+        failmsg("Expected ${cname} for argument '%%s'", name);
+        return false;
+    }
+    // shares the ownership of v
+    dst = Ptr<${cname}>(((pyopencv_${name}_t*)src)->v, pyopencv_${name}_self(src));
+    return true;
+}
+
+""" % head_init_str)
+
 gen_template_map_type_cvt = Template("""
 template<> bool pyopencv_to(PyObject* src, ${cname}& dst, const char* name);
 """)
@@ -178,20 +407,44 @@ static void pyopencv_${name}_specials(void)
     pyopencv_${name}_Type.tp_getset = pyopencv_${name}_getseters;
     pyopencv_${name}_Type.tp_methods = pyopencv_${name}_methods;${extra_specials}
 }
+
+// the type is readied when its first instance is created (or at import, see PYOPENCV_EAGER_INIT);
+// the base type is readied first, as PyType_Ready() would take it without the specials otherwise
+static bool pyopencv_${name}_ready()
+{
+    static PyTypeReadyFlag ready;
+    if( ready )
+        return true;${base_ready}
+    PyInitLock lock;
+    if( pyopencv_${name}_Type.tp_flags & Py_TPFLAGS_READY )
+        return ready.set(true);
+    pyopencv_${name}_specials();
+    return ready.set(to_ok(&pyopencv_${name}_Type) != 0);
+}
 """)
 
 
+# the properties are read and written under the critical section of the object, as the
+# free-threaded build runs the accessors of one object concurrently
 gen_template_get_prop = Template("""
 static PyObject* pyopencv_${name}_get_${member}(pyopencv_${name}_t* p, void *closure)
 {
-    return pyopencv_from(p->v${access}${member});
+    PyObject* r;
+    PYOPENCV_BEGIN_CRITICAL_SECTION((PyObject*)p)
+    r = ${cvt_from}(p->v${access}${member});
+    PYOPENCV_END_CRITICAL_SECTION()
+    return r;
 }
 """)
 
 gen_template_get_prop_algo = Template("""
 static PyObject* pyopencv_${name}_get_${member}(pyopencv_${name}_t* p, void *closure)
 {
-    return pyopencv_from(dynamic_cast<$cname*>(p->v.get())${access}${member});
+    PyObject* r;
+    PYOPENCV_BEGIN_CRITICAL_SECTION((PyObject*)p)
+    r = ${cvt_from}(pyopencv_${name}_self((PyObject*)p)${access}${member});
+    PYOPENCV_END_CRITICAL_SECTION()
+    return r;
 }
 """)
 
@@ -203,7 +456,11 @@ static int pyopencv_${name}_set_${member}(pyopencv_${name}_t* p, PyObject *value
         PyErr_SetString(PyExc_TypeError, "Cannot delete the ${member} attribute");
         return -1;
     }
-    return pyopencv_to(value, p->v${access}${member}) ? 0 : -1;
+    int r;
+    PYOPENCV_BEGIN_CRITICAL_SECTION((PyObject*)p)
+    r = ${cvt_to}(value, p->v${access}${member}) ? 0 : -1;
+    PYOPENCV_END_CRITICAL_SECTION()
+    return r;
 }
 """)
 
@@ -215,7 +472,11 @@ static int pyopencv_${name}_set_${member}(pyopencv_${name}_t* p, PyObject *value
         PyErr_SetString(PyExc_TypeError, "Cannot delete the ${member} attribute");
         return -1;
     }
-    return pyopencv_to(value, dynamic_cast<$cname*>(p->v.get())${access}${member}) ? 0 : -1;
+    int r;
+    PYOPENCV_BEGIN_CRITICAL_SECTION((PyObject*)p)
+    r = ${cvt_to}(value, pyopencv_${name}_self((PyObject*)p)${access}${member}) ? 0 : -1;
+    PYOPENCV_END_CRITICAL_SECTION()
+    return r;
 }
 """)
 
@@ -252,6 +513,7 @@ class ClassInfo(object):
         self.ismap = False
         self.issimple = False
         self.isalgorithm = False
+        self.algo_depth = 0
         self.methods = {}
         self.props = []
         self.consts = {}
@@ -306,17 +568,21 @@ class ClassInfo(object):
             access_op = "."
 
         for pname, p in sorted_props:
+            # the Mat members are exposed as the arrays sharing their memory
+            prop_from = "pyopencv_from" if p.tp != "Mat" else \
+                "pyopencv_from_readonly_view" if p.readonly else "pyopencv_from_view"
+            prop_to = "pyopencv_assign" if p.tp == "Mat" else "pyopencv_to"
             if self.isalgorithm:
-                getset_code.write(gen_template_get_prop_algo.substitute(name=self.name, cname=self.cname, member=pname, membertype=p.tp, access=access_op))
+                getset_code.write(gen_template_get_prop_algo.substitute(name=self.name, cvt_from=prop_from, cname=self.cname, member=pname, membertype=p.tp, access=access_op))
             else:
-                getset_code.write(gen_template_get_prop.substitute(name=self.name, member=pname, membertype=p.tp, access=access_op))
+                getset_code.write(gen_template_get_prop.substitute(name=self.name, cvt_from=prop_from, member=pname, membertype=p.tp, access=access_op))
             if p.readonly:
                 getset_inits.write(gen_template_prop_init.substitute(name=self.name, member=pname))
             else:
                 if self.isalgorithm:
-                    getset_code.write(gen_template_set_prop_algo.substitute(name=self.name, cname=self.cname, member=pname, membertype=p.tp, access=access_op))
+                    getset_code.write(gen_template_set_prop_algo.substitute(name=self.name, cvt_to=prop_to, cname=self.cname, member=pname, membertype=p.tp, access=access_op))
                 else:
-                    getset_code.write(gen_template_set_prop.substitute(name=self.name, member=pname, membertype=p.tp, access=access_op))
+                    getset_code.write(gen_template_set_prop.substitute(name=self.name, cvt_to=prop_to, member=pname, membertype=p.tp, access=access_op))
                 getset_inits.write(gen_template_rw_prop_init.substitute(name=self.name, member=pname))
 
         methods_code = StringIO()
@@ -330,13 +596,15 @@ class ClassInfo(object):
             methods_inits.write(m.get_tab_entry())
 
         baseptr = "NULL"
+        base_ready = ""
         if self.bases and self.bases[0] in all_classes:
             baseptr = "&pyopencv_" + all_classes[self.bases[0]].name + "_Type"
+            base_ready = "\n    if( !pyopencv_%s_ready() )\n        return false;" % (all_classes[self.bases[0]].name,)
 
         code = gen_template_type_impl.substitute(name=self.name, wname=self.wname, cname=self.cname,
             getset_code=getset_code.getvalue(), getset_inits=getset_inits.getvalue(),
             methods_code=methods_code.getvalue(), methods_inits=methods_inits.getvalue(),
-            baseptr=baseptr, extra_specials="")
+            baseptr=baseptr, base_ready=base_ready, extra_specials="")
 
         return code
 
@@ -404,6 +672,10 @@ class FuncVariant(object):
             else:
                 self.wname = self.classname
 
+        self.gil_policy = ""
+        for m in decl[2]:
+            if m.startswith("/GIL="):
+                self.gil_policy = m[len("/GIL="):]
         self.rettype = handle_ptr(decl[1])
         if self.rettype == "void":
             self.rettype = ""
@@ -511,6 +783,8 @@ class FuncInfo(object):
         self.cname = cname
         self.isconstructor = isconstructor
         self.variants = []
+        self.deferred_calls = []
+        self.replay_calls = []
 
     def add_variant(self, decl):
         self.variants.append(FuncVariant(self.classname, self.name, decl, self.isconstructor))
@@ -531,7 +805,7 @@ class FuncInfo(object):
             self_arg = "self"
         else:
             self_arg = ""
-        return "static PyObject* %s(PyObject* %s, PyObject* args, PyObject* kw)" % (full_fname, self_arg)
+        return "static PyObject* %s(PyObject* %s, PYOPENCV_ARGS_DECL)" % (full_fname, self_arg)
 
     def get_tab_entry(self):
         docstring_list = []
@@ -553,10 +827,31 @@ class FuncInfo(object):
             p2 = s.rfind(")")
             docstring_list = [s[:p1+1] + "[" + s[p1+1:p2] + "]" + s[p2:]]
 
-        return Template('    {"$py_funcname", (PyCFunction)$wrap_funcname, METH_VARARGS | METH_KEYWORDS, "$py_docstring"},\n'
+        return Template('    {"$py_funcname", (PyCFunction)$wrap_funcname, PYOPENCV_METH_FLAGS, "$py_docstring"},\n'
                         ).substitute(py_funcname = self.variants[0].wname, wrap_funcname=self.get_wrapper_name(),
                                      py_docstring = "  or  ".join(docstring_list))
 
+    def gen_errwrap(self, v, fullname, ismethod):
+        # chooses whether the GIL is released around the call:
+        #   - the explicit policy of the function, if any: the header annotation, or else
+        #     gil_policy_table for the functions that can not be annotated;
+        #   - otherwise, for the functions with Mat arguments, by the size of the arguments;
+        #   - the trivial queries without arguments keep the GIL;
+        #   - everything else releases it, since the cost is unknown
+        policy = v.gil_policy or gil_policy_table.get(fullname, "")
+        mats = [a.name for a in v.args if a.tp in ("Mat", "vector_Mat") and a.tp not in ignored_arg_types]
+        if policy == "keep":
+            return "ERRWRAP2_IF(false, %s)"
+        if policy == "release":
+            return "ERRWRAP2(%s)"
+        if mats:
+            threshold = policy or "pyopencv_gil_threshold"
+            return "ERRWRAP2_IF(pyopencv_release_gil(%s, %s), %%s)" % (threshold, ", ".join(mats))
+        if not v.py_arglist and (v.rettype in gil_keep_rettypes or
+                                 (ismethod and re.match(r"(get|is|empty)", self.name))):
+            return "ERRWRAP2_IF(false, %s)"
+        return "ERRWRAP2(%s)"
+
     def gen_code(self, all_classes):
         proto = self.get_wrapper_prototype()
         code = "%s\n{\n" % (proto,)
@@ -571,21 +866,43 @@ class FuncInfo(object):
             if not self.isconstructor:
                 amp = "&" if selfinfo.issimple else ""
                 if selfinfo.isalgorithm:
-                    code += gen_template_check_self_algo.substitute(name=selfinfo.name, cname=selfinfo.cname, amp=amp)
+                    code += gen_template_check_self_algo.substitute(name=selfinfo.name, cname=selfinfo.cname)
                 else:
                     get = "" if selfinfo.issimple else ".get()"
                     code += gen_template_check_self.substitute(name=selfinfo.name, cname=selfinfo.cname, amp=amp, get=get)
                 fullname = selfinfo.wname + "." + fullname
+        # the phases of the call are recorded with PYOPENCV_ENABLE_TRACE, see pytrace.hpp,
+        # the calls are counted with PYOPENCV_ENABLE_TELEMETRY, see pytelemetry.hpp,
+        # the calls are written to the capture log with PYOPENCV_ENABLE_CAPTURE, see pycapture.hpp
+        code += "    PYOPENCV_TRACE_FUNC(\"%s\");\n" % (fullname,)
+        code += "    PYOPENCV_TELEMETRY_FUNC(\"%s\");\n" % (fullname,)
+        if [v for v in self.variants if self.is_capturable(v)]:
+            code += "    PYOPENCV_CAPTURE_FUNC(\"%s\");\n" % (self.name,)
 
         all_code_variants = []
+        self.deferred_calls = []
+        self.replay_calls = []
+        overloaded = len(self.variants) > 1
         declno = -1
         for v in self.variants:
+            declno += 1
             code_decl = ""
             code_ret = ""
             code_cvt_list = []
+            scalar_mats = []
+
+            # the slots of the Python arguments, filled by the argument parser
+            slots = dict([(aname, i) for i, (aname, argno) in enumerate(v.py_arglist)])
+
+            # numbers and tuples passed as input Mat's are stored on the stack, unless the Mat may be
+            # retained after the call: by an object (methods, constructors, static methods)
+            # or by a returned object
+            stack_scalars = not self.classname and "::" not in re.sub(r"^cv::", "", self.cname) and \
+                not (v.rettype.startswith("Ptr") or v.rettype in all_classes)
 
             code_args = "("
             all_cargs = []
+            capture_args = []
             parse_arglist = []
 
             # declare all the C function arguments,
@@ -619,13 +936,17 @@ class FuncInfo(object):
                 amapping = simple_argtype_mapping.get(tp, (tp, "O", defval0))
                 parse_name = a.name
                 if a.py_inputarg:
-                    if amapping[1] == "O":
-                        code_decl += "    PyObject* pyobj_%s = NULL;\n" % (a.name,)
-                        parse_name = "pyobj_" + a.name
-                        if a.tp == 'char':
-                            code_cvt_list.append("convert_to_char(pyobj_%s, &%s, %s)"% (a.name, a.name, a.crepr()))
-                        else:
-                            code_cvt_list.append("pyopencv_to(pyobj_%s, %s, %s)" % (a.name, a.name, a.crepr()))
+                    parse_name = "pyargs[%d]" % (slots[a.name],)
+                    if amapping[1] != "O":
+                        code_cvt_list.append("pyopencv_to_arg(%s, %s, %s)" % (parse_name, a.name, a.crepr()))
+                    elif a.tp == 'char':
+                        code_cvt_list.append("convert_to_char(%s, &%s, %s)"% (parse_name, a.name, a.crepr()))
+                    elif a.tp == "Mat" and stack_scalars and not a.outputarg:
+                        code_decl += "    double pyscalar_%s[4];\n" % (a.name,)
+                        scalar_mats.append(a.name)
+                        code_cvt_list.append("pyopencv_to(%s, %s, %s, pyscalar_%s)" % (parse_name, a.name, a.crepr(), a.name))
+                    else:
+                        code_cvt_list.append("pyopencv_to(%s, %s, %s)" % (parse_name, a.name, a.crepr()))
 
                 all_cargs.append([amapping, parse_name])
 
@@ -645,6 +966,8 @@ class FuncInfo(object):
                 if not code_args.endswith("("):
                     code_args += ", "
                 code_args += amp + a.name
+                if a.inputarg:
+                    capture_args.append(a.name)
 
             code_args += ")"
 
@@ -653,6 +976,9 @@ class FuncInfo(object):
                 if selfinfo.issimple:
                     templ_prelude = gen_template_simple_call_constructor_prelude
                     templ = gen_template_simple_call_constructor
+                elif selfinfo.isalgorithm:
+                    templ_prelude = gen_template_call_constructor_prelude_algo
+                    templ = gen_template_call_constructor
                 else:
                     templ_prelude = gen_template_call_constructor_prelude
                     templ = gen_template_call_constructor
@@ -672,7 +998,7 @@ class FuncInfo(object):
                 code_fcall += code_args
 
             if code_cvt_list:
-                code_cvt_list = [""] + code_cvt_list
+                code_cvt_list = ["", "PYOPENCV_TRACE_MARK(PYOPENCV_TRACE_CONVERT_IN)"] + code_cvt_list
 
             # add info about return value, if any, to all_cargs. if there non-void return value,
             # it is encoded in v.py_outlist as ("retval", -1) pair.
@@ -684,24 +1010,25 @@ class FuncInfo(object):
                 amapping = simple_argtype_mapping.get(tp, (tp, "O", "0"))
                 all_cargs.append(amapping)
 
-            if v.args and v.py_arglist:
-                # form the format spec for PyArg_ParseTupleAndKeywords
-                fmtspec = "".join([all_cargs[argno][0][1] for aname, argno in v.py_arglist])
-                if v.py_noptargs > 0:
-                    fmtspec = fmtspec[:-v.py_noptargs] + "|" + fmtspec[-v.py_noptargs:]
-                fmtspec += ":" + fullname
-
-                # form the argument parse code that:
-                #   - declares the list of keyword parameters
-                #   - calls PyArg_ParseTupleAndKeywords
-                #   - converts complex arguments from PyObject's to native OpenCV types
-                code_parse = gen_template_parse_args.substitute(
+            # form the argument parse code that:
+            #   - declares the static argument parser of the variant
+            #   - binds the positional and keyword arguments to the slots
+            #   - converts the arguments from PyObject's to native OpenCV types
+            nargs = len(v.py_arglist)
+            if nargs:
+                code_keywords = gen_template_keywords.substitute(fullname=fullname,
                     kw_list = ", ".join(['"' + aname + '"' for aname, argno in v.py_arglist]),
-                    fmtspec = fmtspec,
-                    parse_arglist = ", ".join(["&" + all_cargs[argno][1] for aname, argno in v.py_arglist]),
-                    code_cvt = " &&\n        ".join(code_cvt_list))
+                    nmin = nargs - v.py_noptargs, nmax = nargs)
+            else:
+                code_keywords = gen_template_keywords_noargs.substitute(fullname=fullname)
+            if not overloaded:
+                code_parse = code_keywords + "\n    " + gen_template_parse_args.substitute(
+                    report = "true", code_cvt = " &&\n        ".join(code_cvt_list))
+            elif code_cvt_list:
+                # the arguments are already bound by the dispatch check
+                code_parse = "if( " + " &&\n        ".join(code_cvt_list[1:]) + " )"
             else:
-                code_parse = "if(PyObject_Size(args) == 0 && (kw == NULL || PyObject_Size(kw) == 0))"
+                code_parse = ""
 
             if len(v.py_outlist) == 0:
                 code_ret = "Py_RETURN_NONE"
@@ -721,18 +1048,173 @@ class FuncInfo(object):
                 code_ret = "return Py_BuildValue(\"(%s)\", %s)" % \
                     (fmtspec, ", ".join(["pyopencv_from(" + aname + ")" for aname, argno in v.py_outlist]))
 
-            all_code_variants.append(gen_template_func_body.substitute(code_decl=code_decl,
-                code_parse=code_parse, code_prelude=code_prelude, code_fcall=code_fcall, code_ret=code_ret))
-
-        if len(all_code_variants)==1:
+            # the variant is selected by the number of arguments, the keyword names and
+            # the cheap type checks, before anything is parsed
+            dispatch = ["parser.parse(PYOPENCV_ARGS_PASS, pyargs, %s)" % ("false" if overloaded else "report",)]
+            for i, (aname, argno) in enumerate(v.py_arglist):
+                check = dispatch_argtype_checks.get(v.args[argno].tp)
+                if check:
+                    dispatch.append("pyopencv_check<%s>(pyargs[%d])" % (check, i))
+
+            if self.is_deferrable():
+                # the Mat arguments, with PYOPENCV_ARG_IN and PYOPENCV_ARG_OUT flags
+                mats = [a for a in v.args if a.tp == "Mat"]
+                code_mats = "".join(["        if( _i_ == %d ) { _name_ = \"%s\"; _flags_ = %s; return &%s; }\n" %
+                    (i, a.name, " | ".join(["PYOPENCV_ARG_IN"]*a.inputarg + ["PYOPENCV_ARG_OUT"]*a.outputarg), a.name)
+                    for i, a in enumerate(mats)])
+                code_clone = "".join(["        if( %s.data == (uchar*)pyscalar_%s )\n"
+                                      "            c->%s = Mat(%s.rows, %s.cols, %s.type(), c->pyscalar_%s);\n" %
+                                      ((aname,)*2 + (aname,)*4 + (aname,)) for aname in scalar_mats])
+                # a single variant is bound without the cheap checks, which set no error:
+                # the conversions report the argument that does not fit
+                self.deferred_calls.append(gen_template_deferred_call.substitute(
+                    name=self.name, idx=len(self.deferred_calls), code_decl=code_decl,
+                    code_keywords=code_keywords, code_bind=" &&\n        ".join(dispatch if overloaded else dispatch[:1]),
+                    code_cvt=" &&\n        ".join(code_cvt_list[1:]) or "true",
+                    code_fcall=code_fcall, code_ret=code_ret, code_mats=code_mats, code_clone=code_clone,
+                    code_mat_args="int _i_, const char*& _name_, int& _flags_" if mats else "int, const char*&, int&"))
+
+            code_capture = code_capture_end = ""
+            if self.is_capturable(v):
+                code_capture = "        PYOPENCV_CAPTURE_ARGS(%s);\n" % (", ".join([str(declno)] + capture_args),)
+                code_capture_end = "        PYOPENCV_CAPTURE_END();\n"
+                self.replay_calls.append((declno, gen_template_replay_call.substitute(
+                    name=self.name, idx=declno, code_fcall=self.cname + code_args,
+                    code_decl="".join(["    %s %s;\n" % (capture_ctype(a.tp), a.name)
+                                       for a in v.args if a.tp not in ignored_arg_types]),
+                    code_read=" &&\n            ".join(["_reader_.get(%s)" % (aname,) for aname in capture_args]) or "_reader_.atEnd()")))
+
+            code_body = gen_template_func_body.substitute(code_decl=code_decl,
+                code_parse=code_parse, code_prelude=code_prelude, code_ret=code_ret,
+                code_capture=code_capture, code_capture_end=code_capture_end,
+                code_fcall=self.gen_errwrap(v, fullname, ismethod) % (code_fcall,))
+
+            if overloaded:
+                code_body = gen_template_overload_body.substitute(code_keywords=code_keywords,
+                    code_dispatch=" &&\n        ".join(dispatch), code_body=code_body)
+
+            all_code_variants.append(code_body)
+
+        if not overloaded:
             # if the function/method has only 1 signature, then just put it
             code += all_code_variants[0]
         else:
-            # try to execute each signature
-            code += "    PyErr_Clear();\n\n".join(["    {\n" + v + "    }\n" for v in all_code_variants])
+            # try each signature that may match; build the error message only if none does
+            code += "\n".join(all_code_variants)
+            code += self.gen_overload_fail(fullname)
         code += "\n    return NULL;\n}\n\n"
         return code
 
+    def gen_overload_fail(self, fullname):
+        docstring_list = []
+        for v in self.variants:
+            if v.py_docstring not in docstring_list:
+                docstring_list.append(v.py_docstring)
+        return gen_template_overload_fail.substitute(fullname=fullname, py_docstring="  or  ".join(docstring_list))
+
+    def is_deferrable(self):
+        # global functions, except for the GUI ones and
+        # the ones taking C strings, which would point to the Python objects not kept by the batch
+        if self.classname or self.isconstructor or self.name in deferred_exclude_list:
+            return False
+        for v in self.variants:
+            for a in v.args:
+                if a.tp == "c_string":
+                    return False
+        return True
+
+    def is_capturable(self, v):
+        # the variants of the deferrable functions, if the log can store all their arguments
+        if not self.is_deferrable():
+            return False
+        for a in v.args:
+            if a.tp not in ignored_arg_types and not is_capture_type(a.tp):
+                return False
+        return True
+
+    def gen_replay_code(self):
+        # must be called after gen_code(), which forms the replayed variants
+        return "".join([code for idx, code in self.replay_calls])
+
+    def get_replay_tab_entries(self):
+        return "".join(['    {"%s", %d, pyopencv_replay_new<pyopencv_%s_replay%d>},\n' % (self.name, idx, self.name, idx)
+                        for idx, code in self.replay_calls])
+
+    def get_deferred_name(self, kind="deferred"):
+        return "pyopencv_%s_%s" % (kind, self.name)
+
+    def gen_deferred_code(self):
+        # must be called after gen_code(), which forms the deferred variants
+        return "".join(self.deferred_calls) + \
+            self.gen_deferred_wrapper("deferred", "pyopencv_Batch_add") + \
+            self.gen_deferred_wrapper("async", "pyopencv_async_submit")
+
+    def gen_deferred_wrapper(self, kind, submit):
+        code = "static PyObject* %s(PyObject* self, PYOPENCV_ARGS_DECL)\n{\n" % (self.get_deferred_name(kind),)
+        for idx in range(len(self.deferred_calls)):
+            code += gen_template_deferred_variant.substitute(name=self.name, idx=idx, submit=submit,
+                report=("false" if len(self.variants) > 1 else "true"))
+        # sets the TypeError only if the bind did not
+        code += self.gen_overload_fail(self.variants[0].wname)
+        code += "\n    return NULL;\n}\n\n"
+        return code
+
+    def get_deferred_tab_entry(self):
+        return Template('    {"$py_funcname", (PyCFunction)$wrap_funcname, PYOPENCV_METH_FLAGS, "$py_funcname(...) -> None. Records a deferred call of cv2.$py_funcname"},\n'
+                        ).substitute(py_funcname = self.variants[0].wname, wrap_funcname=self.get_deferred_name())
+
+    def get_async_tab_entry(self):
+        return Template('    {"${py_funcname}_async", (PyCFunction)$wrap_funcname, PYOPENCV_METH_FLAGS, "${py_funcname}_async(...) -> Future. Runs cv2.$py_funcname on the worker pool, the future receives its result"},\n'
+                        ).substitute(py_funcname = self.variants[0].wname, wrap_funcname=self.get_deferred_name("async"))
+
+
+class HeaderDeclCache(object):
+    """
+    The declarations parsed from each header, stored next to the generated files.
+    An entry is reused while the header content and the parser code stay the same,
+    so after editing one header only that header is parsed again.
+    """
+    def __init__(self, path):
+        self.path = path
+        self.entries = {}
+        self.used = set()
+        self.modified = False
+        self.parser_hash = self.file_hash(os.path.splitext(hdr_parser.__file__)[0] + ".py")
+        try:
+            with open(path, "rt") as f:
+                data = json.load(f)
+            if data.get("parser") == self.parser_hash:
+                self.entries = data.get("headers", {})
+        except (IOError, OSError, ValueError):
+            pass
+
+    @staticmethod
+    def file_hash(name):
+        with open(name, "rb") as f:
+            return hashlib.sha1(f.read()).hexdigest()
+
+    def parse(self, parser, hname):
+        self.used.add(hname)
+        h = self.file_hash(hname)
+        entry = self.entries.get(hname)
+        if entry and entry["hash"] == h:
+            return entry["decls"]
+        decls = parser.parse(hname)
+        # keep the representation the same as when the entry is loaded back
+        decls = json.loads(json.dumps(decls))
+        self.entries[hname] = { "hash": h, "decls": decls }
+        self.modified = True
+        return decls
+
+    def save(self):
+        # the headers that are not wrapped anymore are dropped
+        if set(self.entries) != self.used:
+            self.entries = dict((k, v) for k, v in self.entries.items() if k in self.used)
+            self.modified = True
+        if self.modified:
+            with open(self.path, "wt") as f:
+                json.dump({ "parser": self.parser_hash, "headers": self.entries }, f)
+
 
 class PythonWrapperGenerator(object):
     def __init__(self):
@@ -746,8 +1228,13 @@ class PythonWrapperGenerator(object):
         self.code_types = StringIO()
         self.code_funcs = StringIO()
         self.code_func_tab = StringIO()
+        self.code_deferred = StringIO()
+        self.code_deferred_tab = StringIO()
+        self.code_async_tab = StringIO()
+        self.code_replay = StringIO()
+        self.code_replay_tab = StringIO()
         self.code_type_reg = StringIO()
-        self.code_const_reg = StringIO()
+        self.code_const_tab = StringIO()
         self.class_idx = 0
 
     def add_class(self, stype, name, decl):
@@ -763,6 +1250,16 @@ class PythonWrapperGenerator(object):
         if classinfo.bases and not classinfo.isalgorithm:
             classinfo.isalgorithm = self.classes[classinfo.bases[0]].isalgorithm
 
+    def get_algo_depth(self, classinfo):
+        # the number of the wrapped algorithm classes above this one
+        depth = 0
+        while classinfo.bases and classinfo.bases[0] in self.classes:
+            classinfo = self.classes[classinfo.bases[0]]
+            if not classinfo.isalgorithm:
+                break
+            depth += 1
+        return depth
+
     def add_const(self, name, decl):
         constinfo = ConstInfo(name, decl[1])
 
@@ -817,22 +1314,33 @@ class PythonWrapperGenerator(object):
         if len(func.variants) == 1:
             func_map[name] = func
 
-    def gen_const_reg(self, constinfo):
-        self.code_const_reg.write("PUBLISH2(%s,%s);\n" % (constinfo.name, constinfo.cname))
+    def gen_const_tab(self, constinfo):
+        # the table is searched with bsearch by cv2.__getattr__, so it is kept sorted by name
+        self.code_const_tab.write("    {\"%s\", (long)(%s)},\n" % (constinfo.name, constinfo.cname))
 
     def save(self, path, name, buf):
-        f = open(path + "/" + name, "wt")
-        f.write(buf.getvalue())
+        # an unchanged file is not rewritten, so the wrapper is not recompiled needlessly
+        name = path + "/" + name
+        content = buf.getvalue()
+        try:
+            with open(name, "rt") as f:
+                if f.read() == content:
+                    return
+        except (IOError, OSError):
+            pass
+        f = open(name, "wt")
+        f.write(content)
         f.close()
 
-    def gen(self, srcfiles, output_path):
+    def gen(self, srcfiles, output_path, use_cache=True):
         self.clear()
         parser = hdr_parser.CppHeaderParser()
+        cache = HeaderDeclCache(output_path + "/pyopencv_generated_decls.json") if use_cache else None
 
         # step 1: scan the headers and build more descriptive maps of classes, consts, functions
         for hdr in srcfiles:
             self.code_include.write( '#include "{}"\n'.format(hdr[hdr.rindex('opencv2/'):]) )
-            decls = parser.parse(hdr)
+            decls = cache.parse(parser, hdr) if cache else parser.parse(hdr)
             for decl in decls:
                 name = decl[0]
                 if name.startswith("struct") or name.startswith("class"):
@@ -851,16 +1359,25 @@ class PythonWrapperGenerator(object):
         # step 2: generate code for the classes and their methods
         classlist = list(self.classes.items())
         classlist.sort()
+        max_algo_depth = 0
+        for name, classinfo in classlist:
+            if classinfo.isalgorithm:
+                classinfo.algo_depth = self.get_algo_depth(classinfo)
+                max_algo_depth = max(max_algo_depth, classinfo.algo_depth)
+        self.code_types.write("enum { PYOPENCV_ALGO_DEPTH = %d };\n" % (max_algo_depth + 1,))
+
         for name, classinfo in classlist:
             if classinfo.ismap:
                 self.code_types.write(gen_template_map_type_cvt.substitute(name=name, cname=classinfo.cname))
             else:
                 if classinfo.issimple:
                     templ = gen_template_simple_type_decl
+                elif classinfo.isalgorithm:
+                    templ = gen_template_algo_type_decl
                 else:
                     templ = gen_template_type_decl
                 self.code_types.write(templ.substitute(name=name, wname=classinfo.wname, cname=classinfo.cname,
-                                      cname1=("cv::Algorithm" if classinfo.isalgorithm else classinfo.cname)))
+                                      depth=classinfo.algo_depth))
 
         # register classes in the same order as they have been declared.
         # this way, base classes will be registered in Python before their derivatives.
@@ -880,20 +1397,33 @@ class PythonWrapperGenerator(object):
             code = func.gen_code(self.classes)
             self.code_funcs.write(code)
             self.code_func_tab.write(func.get_tab_entry())
+            if func.is_deferrable():
+                self.code_deferred.write(func.gen_deferred_code())
+                self.code_deferred_tab.write(func.get_deferred_tab_entry())
+                self.code_async_tab.write(func.get_async_tab_entry())
+            self.code_replay.write(func.gen_replay_code())
+            self.code_replay_tab.write(func.get_replay_tab_entries())
 
         # step 4: generate the code for constants
         constlist = list(self.consts.items())
         constlist.sort()
         for name, constinfo in constlist:
-            self.gen_const_reg(constinfo)
+            self.gen_const_tab(constinfo)
 
         # That's it. Now save all the files
         self.save(output_path, "pyopencv_generated_include.h", self.code_include)
         self.save(output_path, "pyopencv_generated_funcs.h", self.code_funcs)
         self.save(output_path, "pyopencv_generated_func_tab.h", self.code_func_tab)
-        self.save(output_path, "pyopencv_generated_const_reg.h", self.code_const_reg)
+        self.save(output_path, "pyopencv_generated_deferred.h", self.code_deferred)
+        self.save(output_path, "pyopencv_generated_deferred_tab.h", self.code_deferred_tab)
+        self.save(output_path, "pyopencv_generated_async_tab.h", self.code_async_tab)
+        self.save(output_path, "pyopencv_generated_replay.h", self.code_replay)
+        self.save(output_path, "pyopencv_generated_replay_tab.h", self.code_replay_tab)
+        self.save(output_path, "pyopencv_generated_const_tab.h", self.code_const_tab)
         self.save(output_path, "pyopencv_generated_types.h", self.code_types)
         self.save(output_path, "pyopencv_generated_type_reg.h", self.code_type_reg)
+        if cache:
+            cache.save()
 
 if __name__ == "__main__":
     srcfiles = hdr_parser.opencv_hdr_list
@@ -397,6 +397,22 @@ class CppHeaderParser(object):
             func_modlist.append("="+arg)
             decl_str = decl_str[:npos] + decl_str[npos3+1:]
 
+        # GIL policy of the Python wrapper:
+        #   CV_GIL_KEEP - never release the GIL around the call,
+        #   CV_GIL_RELEASE - always release it,
+        #   CV_GIL_RELEASE_ABOVE(n) - release it if the Mat arguments take at least n bytes.
+        # Without it, the configurable default threshold is used. The macros are defined empty
+        # in pygilpolicy.hpp.
+        npos = decl_str.find("CV_GIL_RELEASE_ABOVE")
+        if npos >= 0:
+            arg, npos3 = self.get_macro_arg(decl_str, npos)
+            func_modlist.append("/GIL="+arg.strip())
+            decl_str = decl_str[:npos] + decl_str[npos3+1:]
+        for macro, policy in [("CV_GIL_KEEP", "keep"), ("CV_GIL_RELEASE", "release")]:
+            if macro in decl_str:
+                func_modlist.append("/GIL="+policy)
+                decl_str = decl_str.replace(macro, "")
+
         # filter off some common prefixes, which are meaningless for Python wrappers.
         # note that we do not strip "static" prefix, which does matter;
         # it means class methods, not instance methods
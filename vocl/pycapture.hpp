@@ -0,0 +1,455 @@
+// Capture of the wrapped calls, for the native replay.
+//
+// With PYOPENCV_ENABLE_CAPTURE, cv2.startCapture(filename) makes the generated wrappers append
+// each call to a local binary log: the function and its overload, the converted input arguments
+// and the time spent converting the arguments, in the function and converting the results.
+// The arrays are stored with their data, or, with arrays < 1, only in that fraction of the calls;
+// in the others just their shape and type are kept, and the replay fills them with random data.
+// bench/cv2_replay.cpp runs the log again against OpenCV without Python, timing each call, so
+// the kernel time of a recorded workload can be compared between builds and with the binding
+// overhead of the capture. The functions recorded are the ones that may be deferred, with the
+// argument types the log can store (see capture_arg_types in gen2.py).
+//
+// The log is a pyopencv_CaptureHeader and the records, each one a pyopencv_CaptureRecord and
+// its payload: the name of the function (PYOPENCV_CAPTURE_FUNC_NAME, written before the first
+// call of the function) or the input arguments in the order of the declaration
+// (PYOPENCV_CAPTURE_CALL). The numbers are stored as they are in memory, so a log is replayed
+// on the same kind of machine. This part does not depend on Python: the replay includes it too.
+#ifndef __PYCAPTURE_HPP__
+#define __PYCAPTURE_HPP__
+
+#include <vector>
+#include <string>
+#include <type_traits>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+#define PYOPENCV_CAPTURE_MAGIC "CV2CAPT"
+
+enum
+{
+    PYOPENCV_CAPTURE_VERSION = 1,
+    PYOPENCV_CAPTURE_BYTE_ORDER = 0x01020304,
+    PYOPENCV_CAPTURE_FUNC_NAME = 1,
+    PYOPENCV_CAPTURE_CALL = 2
+};
+
+struct pyopencv_CaptureHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+};
+
+struct pyopencv_CaptureRecord
+{
+    uint32_t kind;
+    uint32_t func;          // the id given by the PYOPENCV_CAPTURE_FUNC_NAME record
+    uint32_t variant;       // the overload, in the order of the generated wrapper
+    uint32_t thread;        // 1, 2, ... in the order the threads made their first recorded call
+    uint64_t size;          // of the payload
+    uint64_t start;         // ns from the start of the capture to the call
+    uint64_t convertIn, kernel, convertOut;     // ns
+};
+
+// the input arguments of a call being recorded
+class pyopencv_CaptureBuffer
+{
+public:
+    pyopencv_CaptureBuffer() : arrays(true) {}
+
+    void write(const void* p, size_t n)
+    {
+        const uint8_t* b = (const uint8_t*)p;
+        data.insert(data.end(), b, b + n);
+    }
+
+    template<typename _Tp> typename std::enable_if<std::is_arithmetic<_Tp>::value>::type put(_Tp v) { write(&v, sizeof(v)); }
+    void put(const cv::String& s) { put((uint64_t)s.size()); write(s.data(), s.size()); }
+    template<typename _Tp> void put(const cv::Point_<_Tp>& p) { put(p.x); put(p.y); }
+    template<typename _Tp> void put(const cv::Point3_<_Tp>& p) { put(p.x); put(p.y); put(p.z); }
+    template<typename _Tp> void put(const cv::Size_<_Tp>& s) { put(s.width); put(s.height); }
+    template<typename _Tp> void put(const cv::Rect_<_Tp>& r) { put(r.x); put(r.y); put(r.width); put(r.height); }
+    template<typename _Tp, int cn> void put(const cv::Vec<_Tp, cn>& v) { for( int i = 0; i < cn; i++ ) put(v.val[i]); }
+    void put(const cv::Range& r) { put(r.start); put(r.end); }
+    void put(const cv::RotatedRect& r) { put(r.center); put(r.size); put(r.angle); }
+    void put(const cv::TermCriteria& t) { put(t.type); put(t.maxCount); put(t.epsilon); }
+
+    template<typename _Tp> void put(const std::vector<_Tp>& v)
+    {
+        put((uint64_t)v.size());
+        for( size_t i = 0; i < v.size(); i++ )
+            put(v[i]);
+    }
+
+    // dims, type, the sizes, whether the data follow, the data
+    void put(const cv::Mat& m)
+    {
+        put((int32_t)m.dims);
+        put((int32_t)m.type());
+        for( int i = 0; i < m.dims; i++ )
+            put((int32_t)m.size[i]);
+        bool withData = arrays && m.data;
+        put((uint8_t)withData);
+        if( withData )
+        {
+            cv::Mat c = m.isContinuous() ? m : m.clone();
+            write(c.data, c.total()*c.elemSize());
+        }
+    }
+
+    std::vector<uint8_t> data;
+    bool arrays;    // store the data of the arrays, not just their shape
+};
+
+// the arguments of a recorded call, read back by the replay
+class pyopencv_CaptureReader
+{
+public:
+    pyopencv_CaptureReader(const uint8_t* _p, size_t n) : p(_p), end(_p + n) {}
+
+    bool read(void* dst, size_t n)
+    {
+        if( (size_t)(end - p) < n )
+            return false;
+        memcpy(dst, p, n);
+        p += n;
+        return true;
+    }
+
+    template<typename _Tp> typename std::enable_if<std::is_arithmetic<_Tp>::value, bool>::type get(_Tp& v) { return read(&v, sizeof(v)); }
+
+    bool get(cv::String& s)
+    {
+        uint64_t n;
+        if( !get(n) || n > (uint64_t)(end - p) )
+            return false;
+        s = cv::String((const char*)p, (size_t)n);
+        p += n;
+        return true;
+    }
+
+    template<typename _Tp> bool get(cv::Point_<_Tp>& v) { return get(v.x) && get(v.y); }
+    template<typename _Tp> bool get(cv::Point3_<_Tp>& v) { return get(v.x) && get(v.y) && get(v.z); }
+    template<typename _Tp> bool get(cv::Size_<_Tp>& v) { return get(v.width) && get(v.height); }
+    template<typename _Tp> bool get(cv::Rect_<_Tp>& v) { return get(v.x) && get(v.y) && get(v.width) && get(v.height); }
+    template<typename _Tp, int cn> bool get(cv::Vec<_Tp, cn>& v)
+    {
+        for( int i = 0; i < cn; i++ )
+            if( !get(v.val[i]) )
+                return false;
+        return true;
+    }
+    bool get(cv::Range& r) { return get(r.start) && get(r.end); }
+    bool get(cv::RotatedRect& r) { return get(r.center) && get(r.size) && get(r.angle); }
+    bool get(cv::TermCriteria& t) { return get(t.type) && get(t.maxCount) && get(t.epsilon); }
+
+    template<typename _Tp> bool get(std::vector<_Tp>& v)
+    {
+        uint64_t n;
+        if( !get(n) || n > (uint64_t)(end - p) )
+            return false;
+        v.resize((size_t)n);
+        for( size_t i = 0; i < v.size(); i++ )
+            if( !get(v[i]) )
+                return false;
+        return true;
+    }
+
+    // the arrays stored without the data get random values
+    bool get(cv::Mat& m)
+    {
+        int32_t dims, type, sizes[CV_MAX_DIM];
+        uint8_t withData;
+        if( !get(dims) || !get(type) || dims < 0 || dims > CV_MAX_DIM )
+            return false;
+        for( int i = 0; i < dims; i++ )
+            if( !get(sizes[i]) || sizes[i] < 0 )
+                return false;
+        if( !get(withData) )
+            return false;
+        if( dims == 0 )
+        {
+            m.release();
+            return !withData;
+        }
+        m.create(dims, sizes, type);
+        if( withData )
+            return read(m.data, m.total()*m.elemSize());
+        cv::randu(m, cv::Scalar::all(0), cv::Scalar::all(255));
+        return true;
+    }
+
+    bool atEnd() const { return p == end; }
+
+private:
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+// a recorded call of a function overload, generated by gen2.py (pyopencv_generated_replay.h):
+// the arguments are declared as by the wrapper, read() takes the input ones from the log
+// and run() calls the function
+struct pyopencv_ReplayCall
+{
+    virtual ~pyopencv_ReplayCall() {}
+    virtual bool read(pyopencv_CaptureReader& reader) = 0;
+    virtual void run() = 0;
+};
+
+template<typename _Tp> static pyopencv_ReplayCall* pyopencv_replay_new() { return new _Tp; }
+
+// the table of the overloads, sorted by the name (pyopencv_generated_replay_tab.h)
+struct pyopencv_ReplayFunc
+{
+    const char* name;
+    int variant;
+    pyopencv_ReplayCall* (*create)();
+};
+
+#ifdef PYOPENCV_ENABLE_CAPTURE
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <stdio.h>
+
+static std::atomic<bool> pyopencv_capture_on(false);
+static std::atomic<uint32_t> pyopencv_capture_session(0);
+static std::atomic<uint64_t> pyopencv_capture_ncalls(0);
+static std::atomic<double> pyopencv_capture_arrays(1.);
+static std::atomic<uint32_t> pyopencv_capture_nthreads(0);
+
+// the log, guarded by pyopencv_capture_mutex
+static std::mutex pyopencv_capture_mutex;
+static FILE* pyopencv_capture_file = 0;
+static uint32_t pyopencv_capture_nfuncs = 0;
+static uint64_t pyopencv_capture_nrecorded = 0;
+static bool pyopencv_capture_failed = false;
+static int64_t pyopencv_capture_start = 0;
+
+static inline int64_t pyopencv_capture_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// a recorded function, a static of its wrapper; the id is given in each capture by the first call
+struct pyopencv_CaptureFunc
+{
+    pyopencv_CaptureFunc(const char* _name) : name(_name), session(0), id(0) {}
+
+    const char* name;
+    uint32_t session, id;   // guarded by pyopencv_capture_mutex
+};
+
+static bool pyopencv_capture_write(const void* p, size_t n)
+{
+    if( n > 0 && fwrite(p, 1, n, pyopencv_capture_file) != n )
+        pyopencv_capture_failed = true;
+    return !pyopencv_capture_failed;
+}
+
+// a call made while the capture is stopped or restarted is dropped
+static void pyopencv_capture_append(pyopencv_CaptureFunc* func, uint32_t session,
+                                    pyopencv_CaptureRecord& r, int64_t t0, const std::vector<uint8_t>& payload)
+{
+    std::lock_guard<std::mutex> lock(pyopencv_capture_mutex);
+    if( !pyopencv_capture_file || pyopencv_capture_failed || session != pyopencv_capture_session.load() )
+        return;
+    if( func->session != session )
+    {
+        func->session = session;
+        func->id = pyopencv_capture_nfuncs++;
+        pyopencv_CaptureRecord d;
+        memset(&d, 0, sizeof(d));
+        d.kind = PYOPENCV_CAPTURE_FUNC_NAME;
+        d.func = func->id;
+        d.size = strlen(func->name);
+        if( !pyopencv_capture_write(&d, sizeof(d)) || !pyopencv_capture_write(func->name, d.size) )
+            return;
+    }
+    r.func = func->id;
+    r.start = (uint64_t)std::max(t0 - pyopencv_capture_start, (int64_t)0);
+    if( pyopencv_capture_write(&r, sizeof(r)) && pyopencv_capture_write(payload.data(), payload.size()) )
+        pyopencv_capture_nrecorded++;
+}
+
+// One wrapped call being recorded: from the wrapper entry to args() the arguments are parsed
+// and converted, args() stores them, the function runs until end(), the results are converted
+// until the destructor, which appends the call to the log. The calls made by the callbacks
+// of a recorded call are not recorded, as the replay makes them anyway.
+class pyopencv_CaptureCall
+{
+public:
+    pyopencv_CaptureCall(pyopencv_CaptureFunc* _func) : func(0), session(0), variant(-1), done(false)
+    {
+        if( !pyopencv_capture_on.load(std::memory_order_relaxed) || busy )
+            return;
+        busy = true;
+        func = _func;
+        session = pyopencv_capture_session.load(std::memory_order_acquire);
+        t[0] = pyopencv_capture_now();
+    }
+
+    ~pyopencv_CaptureCall()
+    {
+        if( !func )
+            return;
+        busy = false;
+        if( !done )
+            return;
+        int64_t t4 = pyopencv_capture_now();
+        if( !thread )
+            thread = ++pyopencv_capture_nthreads;
+        pyopencv_CaptureRecord r;
+        memset(&r, 0, sizeof(r));
+        r.kind = PYOPENCV_CAPTURE_CALL;
+        r.variant = (uint32_t)variant;
+        r.thread = thread;
+        r.size = buffer.data.size();
+        r.convertIn = (uint64_t)(t[1] - t[0]);
+        r.kernel = (uint64_t)(t[3] - t[2]);
+        r.convertOut = (uint64_t)(t4 - t[3]);
+        pyopencv_capture_append(func, session, r, t[0], buffer.data);
+    }
+
+    // the time spent storing the arguments is not counted
+    template<typename... _Args> void args(int _variant, const _Args&... a)
+    {
+        if( !func )
+            return;
+        t[1] = pyopencv_capture_now();
+        buffer.data.clear();
+        buffer.arrays = sampleArrays();
+        try
+        {
+            int expand[] = { 0, (buffer.put(a), 0)... };
+            (void)expand;
+            variant = _variant;
+        }
+        catch(...)
+        {
+            variant = -1;
+        }
+        t[2] = pyopencv_capture_now();
+    }
+
+    void end()
+    {
+        if( func && variant >= 0 )
+        {
+            t[3] = pyopencv_capture_now();
+            done = true;
+        }
+    }
+
+protected:
+    // the data of the arrays are stored in every (1/arrays)-th call, starting from the first one
+    static bool sampleArrays()
+    {
+        double rate = pyopencv_capture_arrays.load(std::memory_order_relaxed);
+        if( rate >= 1 )
+            return true;
+        uint64_t n = pyopencv_capture_ncalls.fetch_add(1, std::memory_order_relaxed);
+        return std::ceil((n + 1)*rate) > std::ceil(n*rate);
+    }
+
+    pyopencv_CaptureFunc* func;
+    uint32_t session;
+    int variant;
+    bool done;
+    int64_t t[4];
+
+    static thread_local bool busy;
+    static thread_local uint32_t thread;
+    static thread_local pyopencv_CaptureBuffer buffer;
+};
+
+thread_local bool pyopencv_CaptureCall::busy = false;
+thread_local uint32_t pyopencv_CaptureCall::thread = 0;
+thread_local pyopencv_CaptureBuffer pyopencv_CaptureCall::buffer;
+
+// closes the log; false if it could not be written completely
+static bool pyopencv_capture_close(uint64_t* nrecorded)
+{
+    pyopencv_capture_on.store(false);
+    std::lock_guard<std::mutex> lock(pyopencv_capture_mutex);
+    if( nrecorded )
+        *nrecorded = pyopencv_capture_nrecorded;
+    if( !pyopencv_capture_file )
+        return true;
+    bool ok = fclose(pyopencv_capture_file) == 0 && !pyopencv_capture_failed;
+    pyopencv_capture_file = 0;
+    return ok;
+}
+
+static PyObject* pycvStartCapture(PyObject*, PyObject* args)
+{
+    const char* filename = 0;
+    double arrays = 1;
+    if( !PyArg_ParseTuple(args, "s|d:startCapture", &filename, &arrays) )
+        return NULL;
+    if( !(arrays >= 0 && arrays <= 1) )
+    {
+        PyErr_SetString(PyExc_ValueError, "arrays must be in [0, 1]");
+        return NULL;
+    }
+    FILE* f = fopen(filename, "wb");
+    if( !f )
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char*)filename);
+    pyopencv_CaptureHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PYOPENCV_CAPTURE_MAGIC, sizeof(PYOPENCV_CAPTURE_MAGIC));
+    h.version = PYOPENCV_CAPTURE_VERSION;
+    h.byteOrder = PYOPENCV_CAPTURE_BYTE_ORDER;
+    if( fwrite(&h, sizeof(h), 1, f) != 1 )
+    {
+        fclose(f);
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char*)filename);
+    }
+
+    // the previous capture, if any, is closed with its errors ignored
+    pyopencv_capture_close(0);
+    {
+        std::lock_guard<std::mutex> lock(pyopencv_capture_mutex);
+        pyopencv_capture_file = f;
+        pyopencv_capture_nfuncs = 0;
+        pyopencv_capture_nrecorded = 0;
+        pyopencv_capture_failed = false;
+        pyopencv_capture_start = pyopencv_capture_now();
+        pyopencv_capture_arrays.store(arrays);
+        pyopencv_capture_ncalls.store(0);
+        pyopencv_capture_session.store(pyopencv_capture_session.load() + 1, std::memory_order_release);
+    }
+    pyopencv_capture_on.store(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject* pycvStopCapture(PyObject*, PyObject*)
+{
+    uint64_t nrecorded = 0;
+    if( !pyopencv_capture_close(&nrecorded) )
+    {
+        PyErr_SetString(PyExc_IOError, "the capture log could not be written completely");
+        return NULL;
+    }
+    return PyLong_FromUnsignedLongLong(nrecorded);
+}
+
+#define PYOPENCV_CAPTURE_FUNC(name) \
+    static pyopencv_CaptureFunc pyopencv_capture_func(name); \
+    pyopencv_CaptureCall pyopencv_capture(&pyopencv_capture_func)
+#define PYOPENCV_CAPTURE_ARGS(...) pyopencv_capture.args(__VA_ARGS__)
+#define PYOPENCV_CAPTURE_END() pyopencv_capture.end()
+
+#else
+
+#define PYOPENCV_CAPTURE_FUNC(name)
+#define PYOPENCV_CAPTURE_ARGS(...) (void)0
+#define PYOPENCV_CAPTURE_END() (void)0
+
+#endif
+
+#endif // __PYCAPTURE_HPP__
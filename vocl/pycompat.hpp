@@ -67,4 +67,28 @@
 #endif
 #endif
 
+// Calling convention of the generated wrappers. Python 3.7+ passes the arguments as a C array
+// plus a tuple of the keyword names (METH_FASTCALL), without building an argument tuple
+// and a keyword dict per call; the older versions use the classic tuple/dict convention.
+#if PY_VERSION_HEX >= 0x03070000
+#define PYOPENCV_FASTCALL 1
+#define PYOPENCV_ARGS_DECL PyObject* const* args, Py_ssize_t nargs, PyObject* kw
+#define PYOPENCV_ARGS_PASS args, nargs, kw
+#define PYOPENCV_METH_FLAGS (METH_FASTCALL | METH_KEYWORDS)
+#else
+#define PYOPENCV_ARGS_DECL PyObject* args, PyObject* kw
+#define PYOPENCV_ARGS_PASS args, kw
+#define PYOPENCV_METH_FLAGS (METH_VARARGS | METH_KEYWORDS)
+#endif
+
+// Per-object locking of the free-threaded build (PEP 703). With the GIL the wrappers are
+// already serialized, so the critical sections are just scopes.
+#ifdef Py_GIL_DISABLED
+#define PYOPENCV_BEGIN_CRITICAL_SECTION(o) Py_BEGIN_CRITICAL_SECTION(o)
+#define PYOPENCV_END_CRITICAL_SECTION() Py_END_CRITICAL_SECTION()
+#else
+#define PYOPENCV_BEGIN_CRITICAL_SECTION(o) {
+#define PYOPENCV_END_CRITICAL_SECTION() }
+#endif
+
 #endif // END HEADER GUARD
@@ -0,0 +1,428 @@
+// cv2.FrameRing(): video decoding into a ring of preallocated frames, ahead of the consumer.
+//
+// VideoCapture.read() allocates a new numpy array for every frame. A FrameRing owns a
+// VideoCapture and a fixed set of numpy-backed frames, which a native thread fills by decoding
+// the stream while Python processes the previous frames:
+//
+//   ring = cv2.FrameRing("video.mp4", 4)        # or "frames/%04d.png", or a camera index
+//   while True:
+//       i, frame = ring.acquire()
+//       if frame is None:
+//           break
+//       process(frame)
+//       ring.release(i)                         # the frame is decoded into again
+//
+// The frames are exchanged by their indices through two single-producer single-consumer
+// lock-free queues: the decoded ones go to the consumer, the released ones back to the decoder.
+// The queues block (on a condition variable) only when they are empty. The frames are allocated
+// by the decoder when the first frame is decoded into each of them, and then reused, so in the
+// steady state nothing is allocated; a frame is reallocated only if the stream changes the size.
+// The array returned by acquire() is the frame itself: it must not be used after release(), when
+// the decoder may overwrite it (copy it to keep it).
+#ifndef __PYFRAMERING_HPP__
+#define __PYFRAMERING_HPP__
+
+#ifdef HAVE_OPENCV_VIDEOIO
+
+#include <set>
+#include <chrono>
+
+// the indices of the frames; at most capacity of them are ever queued
+class pyopencv_SPSCQueue
+{
+public:
+    explicit pyopencv_SPSCQueue(int capacity) : head(0), tail(0), buf(capacity + 1) {}
+
+    // by the producer only
+    bool push(int v)
+    {
+        size_t t = tail.load(std::memory_order_relaxed), next = t + 1 == buf.size() ? 0 : t + 1;
+        if( next == head.load(std::memory_order_acquire) )
+            return false;
+        buf[t] = v;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // by the consumer only
+    bool pop(int& v)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if( h == tail.load(std::memory_order_acquire) )
+            return false;
+        v = buf[h];
+        head.store(h + 1 == buf.size() ? 0 : h + 1, std::memory_order_release);
+        return true;
+    }
+
+protected:
+    // 64 bytes apart, so on separate cache lines, as the two sides write them
+    std::atomic<size_t> head;
+    char pad0[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char pad1[64 - sizeof(std::atomic<size_t>)];
+    std::vector<int> buf;
+};
+
+// Wakes up the side waiting for a queue to become non-empty. notify() is cheap unless the other
+// side is waiting: it only takes the mutex then. The fences make sure that either the waiter sees
+// the new item, or the notifier sees the waiter.
+class pyopencv_QueueWaiter
+{
+public:
+    pyopencv_QueueWaiter() : waiting(false) {}
+
+    // waits until ready() or the timeout (< 0 - none); returns ready()
+    template<typename Pred> bool wait(Pred ready, double timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ok;
+        if( timeout < 0 )
+        {
+            cond.wait(lock, ready);
+            ok = true;
+        }
+        else
+            ok = cond.wait_for(lock, std::chrono::duration<double>(timeout), ready);
+        waiting.store(false, std::memory_order_relaxed);
+        return ok;
+    }
+
+    void notify(bool force = false)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if( force || waiting.load(std::memory_order_relaxed) )
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_all();
+        }
+    }
+
+protected:
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::atomic<bool> waiting;
+};
+
+class pyopencv_FrameRing
+{
+public:
+    explicit pyopencv_FrameRing(int nframes)
+        : frames(nframes), acquired(new std::atomic<bool>[nframes]), decoded(nframes), free(nframes),
+          stopping(false), finished(false), ndecoded(0), decoderWaits(0), consumerWaits(0)
+    {
+        for( int i = 0; i < nframes; i++ )
+        {
+            frames[i].allocator = &g_numpyAllocator;
+            acquired[i].store(false);
+            free.push(i);
+        }
+    }
+
+    ~pyopencv_FrameRing() { close(); }
+
+    void start() { decoder = std::thread(&pyopencv_FrameRing::decode, this); }
+
+    // the index of the next decoded frame, -1 at the end of the stream or after the timeout;
+    // by one consumer at a time, without the GIL
+    int acquire(double timeout)
+    {
+        int i = -1;
+        if( !decoded.pop(i) )
+        {
+            consumerWaits++;
+            decodedWaiter.wait([&]{ return decoded.pop(i) || finished.load(std::memory_order_acquire); }, timeout);
+            // the last frames are queued before the end is flagged
+            if( i < 0 && !decoded.pop(i) )
+                return -1;
+        }
+        acquired[i].store(true, std::memory_order_relaxed);
+        return i;
+    }
+
+    // by one thread at a time
+    bool release(int i)
+    {
+        if( i < 0 || i >= (int)frames.size() || !acquired[i].exchange(false) )
+            return false;
+        free.push(i);
+        freeWaiter.notify();
+        return true;
+    }
+
+    // stops the decoder; without the GIL, as the decoder may need it to allocate a frame
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(closeMutex);
+        stopping.store(true);
+        freeWaiter.notify(true);
+        if( decoder.joinable() )
+            decoder.join();
+    }
+
+    bool done() const { return finished.load(std::memory_order_acquire); }
+
+    VideoCapture capture;
+    std::vector<Mat> frames;
+    std::unique_ptr<std::atomic<bool>[]> acquired;  // handed out to Python
+    String error;                                   // of the decoder, set before finished
+
+    // the counters, for tuning the number of frames
+    size_t decodedFrames() const { return ndecoded.load(std::memory_order_relaxed); }
+    size_t decoderStalls() const { return decoderWaits.load(std::memory_order_relaxed); }
+    size_t consumerStalls() const { return consumerWaits.load(std::memory_order_relaxed); }
+
+protected:
+    void decode()
+    {
+        int i = -1;
+        while( !stopping.load(std::memory_order_relaxed) )
+        {
+            if( !free.pop(i) )
+            {
+                decoderWaits++;
+                freeWaiter.wait([&]{ return free.pop(i) || stopping.load(); }, -1);
+                if( i < 0 )
+                    break;
+            }
+            bool ok = false;
+            try
+            {
+                // the frame keeps its storage while the stream keeps the size
+                ok = capture.read(frames[i]);
+            }
+            catch(const std::exception& e)
+            {
+                error = e.what();
+            }
+            if( !ok )
+                break;
+            ndecoded++;
+            decoded.push(i);
+            decodedWaiter.notify();
+            i = -1;
+        }
+        finished.store(true, std::memory_order_release);
+        decodedWaiter.notify(true);
+    }
+
+    pyopencv_SPSCQueue decoded, free;
+    pyopencv_QueueWaiter decodedWaiter, freeWaiter;
+    std::thread decoder;
+    std::mutex closeMutex;
+    std::atomic<bool> stopping, finished;
+    std::atomic<size_t> ndecoded, decoderWaits, consumerWaits;
+};
+
+// The rings still open at exit are closed by the atexit hook, while the interpreter can still
+// give the GIL to the decoders. The hook holds the mutex while it joins the decoders, so the
+// mutex is always taken without the GIL: a decoder waiting for the GIL can not block the hook.
+static std::mutex pyopencv_frame_rings_mutex;
+static std::set<pyopencv_FrameRing*> pyopencv_frame_rings;
+
+static PyObject* pyopencv_frame_rings_close(PyObject*, PyObject*)
+{
+    PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("FrameRing atexit"));
+    std::lock_guard<std::mutex> lock(pyopencv_frame_rings_mutex);
+    for( std::set<pyopencv_FrameRing*>::iterator it = pyopencv_frame_rings.begin(); it != pyopencv_frame_rings.end(); ++it )
+        (*it)->close();
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pyopencv_frame_rings_close_def =
+    {"_frameRingsClose", pyopencv_frame_rings_close, METH_NOARGS, "Stops the decoders of the open frame rings"};
+
+struct pyopencv_FrameRing_t
+{
+    PyObject_HEAD
+    pyopencv_FrameRing* r;
+    std::mutex* consumer;   // acquire() waits without the GIL, so the callers are serialized here
+};
+
+static PyObject* pyopencv_FrameRing_acquire(PyObject* self, PyObject* args, PyObject* kw)
+{
+    const char* keywords[] = { "timeout", NULL };
+    double timeout = -1;
+    if( !PyArg_ParseTupleAndKeywords(args, kw, "|d:acquire", (char**)keywords, &timeout) )
+        return NULL;
+    pyopencv_FrameRing_t* o = (pyopencv_FrameRing_t*)self;
+    int i;
+    {
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("FrameRing.acquire"));
+        std::lock_guard<std::mutex> lock(*o->consumer);
+        i = o->r->acquire(timeout);
+    }
+    if( i < 0 )
+    {
+        if( o->r->done() && !o->r->error.empty() )
+        {
+            PyErr_SetString(opencv_error, o->r->error.c_str());
+            return NULL;
+        }
+        return Py_BuildValue("(iO)", -1, Py_None);
+    }
+    PyObject* frame = pyopencv_from(o->r->frames[i]);
+    if( !frame )
+        return NULL;
+    return Py_BuildValue("(iN)", i, frame);
+}
+
+static PyObject* pyopencv_FrameRing_release(PyObject* self, PyObject* args)
+{
+    int i;
+    if( !PyArg_ParseTuple(args, "i:release", &i) )
+        return NULL;
+    bool ok;
+    PYOPENCV_BEGIN_CRITICAL_SECTION(self)
+    ok = ((pyopencv_FrameRing_t*)self)->r->release(i);
+    PYOPENCV_END_CRITICAL_SECTION()
+    if( !ok )
+    {
+        PyErr_Format(PyExc_ValueError, "the frame %d is not acquired", i);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyopencv_FrameRing_close(PyObject* self, PyObject*)
+{
+    PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("FrameRing.close"));
+    ((pyopencv_FrameRing_t*)self)->r->close();
+    Py_RETURN_NONE;
+}
+
+static PyObject* pyopencv_FrameRing_enter(PyObject* self, PyObject*)
+{
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject* pyopencv_FrameRing_exit(PyObject* self, PyObject*)
+{
+    return pyopencv_FrameRing_close(self, NULL);
+}
+
+static PyObject* pyopencv_FrameRing_done(PyObject* self, PyObject*)
+{
+    return PyBool_FromLong(((pyopencv_FrameRing_t*)self)->r->done());
+}
+
+static PyObject* pyopencv_FrameRing_stats(PyObject* self, PyObject*)
+{
+    const pyopencv_FrameRing& r = *((pyopencv_FrameRing_t*)self)->r;
+    return Py_BuildValue("{s:n,s:n,s:n,s:n}", "frames", (Py_ssize_t)r.frames.size(),
+                         "decoded", (Py_ssize_t)r.decodedFrames(), "decoder_waits", (Py_ssize_t)r.decoderStalls(),
+                         "consumer_waits", (Py_ssize_t)r.consumerStalls());
+}
+
+static void pyopencv_FrameRing_dealloc(PyObject* self)
+{
+    pyopencv_FrameRing_t* o = (pyopencv_FrameRing_t*)self;
+    {
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("FrameRing.close"));
+        {
+            std::lock_guard<std::mutex> lock(pyopencv_frame_rings_mutex);
+            pyopencv_frame_rings.erase(o->r);
+        }
+        o->r->close();
+    }
+    // the frames are numpy arrays, released with the GIL held
+    delete o->r;
+    delete o->consumer;
+    PyObject_Del(self);
+}
+
+static PyMethodDef pyopencv_FrameRing_methods[] =
+{
+    {"acquire", (PyCFunction)pyopencv_FrameRing_acquire, METH_VARARGS | METH_KEYWORDS, "acquire([, timeout]) -> index, frame. Waits for the next decoded frame, at most timeout seconds if given; returns -1, None after the end of the stream or on the timeout (see done())"},
+    {"release", (PyCFunction)pyopencv_FrameRing_release, METH_VARARGS, "release(index) -> None. Gives the frame back to the decoder; the array must not be used afterwards"},
+    {"close", (PyCFunction)pyopencv_FrameRing_close, METH_NOARGS, "close() -> None. Stops the decoder"},
+    {"done", (PyCFunction)pyopencv_FrameRing_done, METH_NOARGS, "done() -> retval. True when the stream has ended or the ring is closed"},
+    {"stats", (PyCFunction)pyopencv_FrameRing_stats, METH_NOARGS, "stats() -> dict. The number of frames, the frames decoded and how many times the decoder waited for a free frame and the consumer for a decoded one"},
+    {"__enter__", (PyCFunction)pyopencv_FrameRing_enter, METH_NOARGS, "Returns the ring"},
+    {"__exit__", (PyCFunction)pyopencv_FrameRing_exit, METH_VARARGS, "Stops the decoder"},
+    {NULL, NULL}
+};
+
+static PyTypeObject pyopencv_FrameRing_Type =
+{
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    MODULESTR".FrameRing",
+    sizeof(pyopencv_FrameRing_t),
+};
+
+static void pyopencv_FrameRing_specials(void)
+{
+    pyopencv_FrameRing_Type.tp_dealloc = pyopencv_FrameRing_dealloc;
+    pyopencv_FrameRing_Type.tp_methods = pyopencv_FrameRing_methods;
+    pyopencv_FrameRing_Type.tp_flags = Py_TPFLAGS_DEFAULT;
+    pyopencv_FrameRing_Type.tp_doc = (char*)"Video capture decoding ahead into a ring of preallocated frames, see cv2.FrameRing()";
+}
+
+static PyObject* pycvFrameRing(PyObject*, PyObject* args, PyObject* kw)
+{
+    const char* keywords[] = { "source", "frames", NULL };
+    PyObject* source = 0;
+    int nframes = 4;
+    if( !PyArg_ParseTupleAndKeywords(args, kw, "O|i:FrameRing", (char**)keywords, &source, &nframes) )
+        return NULL;
+    if( nframes < 2 )
+    {
+        PyErr_SetString(PyExc_ValueError, "a frame ring needs at least 2 frames");
+        return NULL;
+    }
+    int device = -1;
+    String filename;
+    if( PyInt_Check(source) )
+        device = (int)PyInt_AsLong(source);
+    else if( !pyopencv_to(source, filename, ArgInfo("source", 0)) )
+        return NULL;
+
+    static PyTypeReadyFlag ready;
+    if( !ready )
+    {
+        PyInitLock lock;
+        if( !(pyopencv_FrameRing_Type.tp_flags & Py_TPFLAGS_READY) )
+        {
+            PyObject* atexit = PyImport_ImportModule("atexit");
+            PyObject* hook = PyCFunction_New(&pyopencv_frame_rings_close_def, NULL);
+            PyObject* r = atexit && hook ? PyObject_CallMethod(atexit, (char*)"register", (char*)"(O)", hook) : 0;
+            Py_XDECREF(atexit);
+            Py_XDECREF(hook);
+            if( !r )
+                return NULL;
+            Py_DECREF(r);
+            pyopencv_FrameRing_specials();
+            if( PyType_Ready(&pyopencv_FrameRing_Type) < 0 )
+                return NULL;
+        }
+        ready.set(true);
+    }
+
+    std::unique_ptr<pyopencv_FrameRing> ring(new pyopencv_FrameRing(nframes));
+    bool opened = false;
+    ERRWRAP2(opened = device >= 0 ? ring->capture.open(device) : ring->capture.open(filename));
+    if( !opened )
+    {
+        PyErr_SetString(PyExc_IOError, "the video source can not be opened");
+        return NULL;
+    }
+    pyopencv_FrameRing_t* self = PyObject_NEW(pyopencv_FrameRing_t, &pyopencv_FrameRing_Type);
+    if( !self )
+        return NULL;
+    self->consumer = new std::mutex;
+    self->r = ring.release();
+    {
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("FrameRing registration"));
+        std::lock_guard<std::mutex> lock(pyopencv_frame_rings_mutex);
+        pyopencv_frame_rings.insert(self->r);
+    }
+    self->r->start();
+    return (PyObject*)self;
+}
+
+#endif // HAVE_OPENCV_VIDEOIO
+
+#endif // __PYFRAMERING_HPP__
@@ -0,0 +1,25 @@
+// GIL policy annotations of the wrapped declarations, read by hdr_parser.py:
+//
+//   CV_WRAP CV_GIL_KEEP int getThreadNum();             - never release the GIL around the call
+//   CV_EXPORTS_W CV_GIL_RELEASE void imshow(...);        - always release it
+//   CV_EXPORTS_W CV_GIL_RELEASE_ABOVE(65536) void f(...); - release it if the Mat arguments take
+//                                                          at least that many bytes
+//
+// They expand to nothing for the C++ compiler. A wrapped header using them includes this one,
+// or the same definitions are added to opencv2/core/cvdef.h next to CV_EXPORTS_W and CV_WRAP.
+// The functions of the headers that can not be annotated are listed in gil_policy_table
+// (gen2.py) instead.
+#ifndef __PYGILPOLICY_HPP__
+#define __PYGILPOLICY_HPP__
+
+#ifndef CV_GIL_KEEP
+#define CV_GIL_KEEP
+#endif
+#ifndef CV_GIL_RELEASE
+#define CV_GIL_RELEASE
+#endif
+#ifndef CV_GIL_RELEASE_ABOVE
+#define CV_GIL_RELEASE_ABOVE(bytes)
+#endif
+
+#endif
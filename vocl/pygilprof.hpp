@@ -0,0 +1,180 @@
+// GIL contention profile of the module.
+//
+// With PYOPENCV_ENABLE_GIL_PROFILE every place where the module gives the GIL away or takes
+// it back (PyAllowThreads, PyAllowThreadsIf, PyEnsureGIL) is a call site identified by its
+// kind and the enclosing C++ function, e.g. ERRWRAP2 in pyopencv_cv_blur, or
+// NumpyAllocator::allocate. While the profiling is on (cv2.startGILProfile()) each site keeps
+// log2 histograms of the time spent waiting for the GIL and, for the sites that acquire it
+// from a foreign thread, of the time the GIL was held then; cv2.getGILProfile() returns them.
+// Without PYOPENCV_ENABLE_GIL_PROFILE the probes are empty and the sites are null pointers.
+#ifndef __PYGILPROF_HPP__
+#define __PYGILPROF_HPP__
+
+struct pyopencv_GILSite;
+
+#ifdef PYOPENCV_ENABLE_GIL_PROFILE
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <chrono>
+
+// bucket i counts the times in [2^i, 2^(i+1)) ns, the last one everything from 2^31 ns (2 s) up
+enum { PYOPENCV_GIL_BUCKETS = 32 };
+
+struct pyopencv_GILHist
+{
+    std::atomic<uint64_t> count, total, buckets[PYOPENCV_GIL_BUCKETS];
+
+    void add(int64_t ns)
+    {
+        int i = 0;
+        for( uint64_t v = ns > 0 ? (uint64_t)ns : 0; v > 1 && i < PYOPENCV_GIL_BUCKETS - 1; v >>= 1 )
+            i++;
+        count.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add((uint64_t)std::max(ns, (int64_t)0), std::memory_order_relaxed);
+        buckets[i].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        count.store(0);
+        total.store(0);
+        for( int i = 0; i < PYOPENCV_GIL_BUCKETS; i++ )
+            buckets[i].store(0);
+    }
+};
+
+static std::atomic<bool> pyopencv_gilprof_on(false);
+static std::mutex pyopencv_gilprof_mutex;
+static std::vector<pyopencv_GILSite*> pyopencv_gilprof_sites;
+
+// the sites are function-local statics (see PYOPENCV_GIL_SITE), registered when first reached
+struct pyopencv_GILSite
+{
+    pyopencv_GILSite(const char* _kind, const char* _func, int _line) : kind(_kind), func(_func), line(_line)
+    {
+        wait.reset();
+        hold.reset();
+        std::lock_guard<std::mutex> lock(pyopencv_gilprof_mutex);
+        pyopencv_gilprof_sites.push_back(this);
+    }
+
+    const char* kind;
+    const char* func;
+    int line;
+    pyopencv_GILHist wait, hold;
+};
+
+static inline int64_t pyopencv_gilprof_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// measures one acquisition of the GIL at a site: acquiring() .. acquired() is the wait,
+// acquired() .. releasing() the hold
+class pyopencv_GILProbe
+{
+public:
+    pyopencv_GILProbe(pyopencv_GILSite* _site) : site(_site && pyopencv_gilprof_on.load(std::memory_order_relaxed) ? _site : 0), t(0) {}
+    void acquiring() { if( site ) t = pyopencv_gilprof_now(); }
+    void acquired()
+    {
+        if( !site )
+            return;
+        int64_t t1 = pyopencv_gilprof_now();
+        site->wait.add(t1 - t);
+        t = t1;
+    }
+    void releasing() { if( site ) site->hold.add(pyopencv_gilprof_now() - t); }
+
+private:
+    pyopencv_GILSite* site;
+    int64_t t;
+};
+
+// the lambda makes a separate static per expansion; __func__ is passed in, as inside the lambda it is "operator()"
+#define PYOPENCV_GIL_SITE(kind) \
+    ([](const char* func) -> pyopencv_GILSite* { static pyopencv_GILSite site(kind, func, __LINE__); return &site; }(__func__))
+
+static PyObject* pyopencv_gilprof_hist(const pyopencv_GILHist& h)
+{
+    PyObject* buckets = PyList_New(PYOPENCV_GIL_BUCKETS);
+    for( int i = 0; buckets && i < PYOPENCV_GIL_BUCKETS; i++ )
+    {
+        PyObject* v = PyLong_FromUnsignedLongLong(h.buckets[i].load());
+        if( !v )
+        {
+            Py_CLEAR(buckets);
+            break;
+        }
+        PyList_SET_ITEM(buckets, i, v);
+    }
+    if( !buckets )
+        return NULL;
+    return Py_BuildValue("{s:K,s:K,s:N}", "count", (unsigned long long)h.count.load(),
+                         "total_ns", (unsigned long long)h.total.load(), "buckets", buckets);
+}
+
+static PyObject* pycvStartGILProfile(PyObject*, PyObject*)
+{
+    {
+        std::lock_guard<std::mutex> lock(pyopencv_gilprof_mutex);
+        for( size_t i = 0; i < pyopencv_gilprof_sites.size(); i++ )
+        {
+            pyopencv_gilprof_sites[i]->wait.reset();
+            pyopencv_gilprof_sites[i]->hold.reset();
+        }
+    }
+    pyopencv_gilprof_on.store(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject* pycvStopGILProfile(PyObject*, PyObject*)
+{
+    pyopencv_gilprof_on.store(false);
+    Py_RETURN_NONE;
+}
+
+static PyObject* pycvGetGILProfile(PyObject*, PyObject*)
+{
+    std::vector<pyopencv_GILSite*> sites;
+    {
+        std::lock_guard<std::mutex> lock(pyopencv_gilprof_mutex);
+        sites = pyopencv_gilprof_sites;
+    }
+    PyObject* result = PyList_New(0);
+    for( size_t i = 0; result && i < sites.size(); i++ )
+    {
+        const pyopencv_GILSite* s = sites[i];
+        if( s->wait.count.load() == 0 && s->hold.count.load() == 0 )
+            continue;
+        PyObject* wait = pyopencv_gilprof_hist(s->wait);
+        PyObject* hold = wait ? pyopencv_gilprof_hist(s->hold) : 0;
+        PyObject* item = hold ? Py_BuildValue("{s:s,s:s,s:i,s:N,s:N}", "site", s->kind, "function", s->func,
+                                              "line", s->line, "wait", wait, "hold", hold) : 0;
+        if( !hold )
+            Py_XDECREF(wait);
+        if( !item || PyList_Append(result, item) < 0 )
+            Py_CLEAR(result);
+        Py_XDECREF(item);
+    }
+    return result;
+}
+
+#else
+
+class pyopencv_GILProbe
+{
+public:
+    pyopencv_GILProbe(pyopencv_GILSite*) {}
+    void acquiring() {}
+    void acquired() {}
+    void releasing() {}
+};
+
+#define PYOPENCV_GIL_SITE(kind) ((pyopencv_GILSite*)0)
+
+#endif
+
+#endif // __PYGILPROF_HPP__
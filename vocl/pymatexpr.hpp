@@ -0,0 +1,397 @@
+// cv2.MatExpr(): lazy matrix expressions over cv::MatExpr.
+//
+// An arithmetic expression of numpy arrays computes every operator in a pass of its own, into
+// a temporary of the full size. Wrapping an array into cv2.MatExpr() makes the operators build
+// a cv::MatExpr instead, which OpenCV folds into a single call as far as it can:
+//
+//   blend = cv2.MatExpr(a) * alpha + cv2.MatExpr(b) * (1 - alpha)      # addWeighted()
+//   diff = cv2.MatExpr(a) * 2 - b                                        # scaleAdd()
+//   norm = (cv2.MatExpr(f) - mean) * (1. / std)                          # convertTo()
+//   mask = cv2.MatExpr(a) > 128                                          # compare()
+//
+// Unlike numpy, the result keeps the depth of the arrays, as in OpenCV, and the integer results
+// saturate: with uint8 a, cv2.MatExpr(a) - 200 is 0 where a < 200. Expressions giving negative
+// or fractional values are written over float arrays (f = a.astype(np.float32) above).
+//
+// The expression is evaluated when it is materialized (eval(), np.asarray()) or passed to
+// a wrapped function as a Mat argument, directly into the array of the result. The operators:
+// + and - (with arrays, expressions, numbers, numpy scalars and scalar tuples), * and / (elementwise, as in
+// numpy, or by a number), @ (matrix product, Python 3.5+), unary -, abs(), the comparisons and
+// &, |, ^, ~ (masks); the methods t(), inv() and mul(). The comparisons and the bitwise
+// operators evaluate their expression operands first, as cv::MatExpr does. numpy arrays on the
+// left defer to the expression (__array_ufunc__ = None), so a + cv2.MatExpr(b) works as well.
+#ifndef __PYMATEXPR_HPP__
+#define __PYMATEXPR_HPP__
+
+struct pyopencv_MatExpr_t
+{
+    PyObject_HEAD
+    MatExpr e;
+};
+
+static PyTypeObject pyopencv_MatExpr_Type =
+{
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    MODULESTR".MatExpr",
+    sizeof(pyopencv_MatExpr_t),
+};
+
+static bool pyopencv_matexpr_check(PyObject* o)
+{
+    return o && PyObject_TypeCheck(o, &pyopencv_MatExpr_Type);
+}
+
+// an expression passed as a Mat argument of a wrapper
+static bool pyopencv_matexpr_eval(PyObject* o, Mat& m, const ArgInfo info)
+{
+    if( info.outputarg )
+    {
+        failmsg("%s is an expression, it can not be an output", info.name);
+        return false;
+    }
+    const MatExpr& e = ((pyopencv_MatExpr_t*)o)->e;
+    ERRWRAP2(m = e);
+    return true;
+}
+
+static PyObject* pyopencv_matexpr_new(const MatExpr& e)
+{
+    pyopencv_MatExpr_t* self = PyObject_NEW(pyopencv_MatExpr_t, &pyopencv_MatExpr_Type);
+    if( !self )
+        return NULL;
+    new (&self->e) MatExpr(e);
+    return (PyObject*)self;
+}
+
+// An operand: a number, a scalar tuple or an array/expression
+struct pyopencv_ExprArg
+{
+    enum { NUMBER, SCALAR, EXPR };
+    int kind;
+    Scalar s;
+    MatExpr e;
+};
+
+// false with no error set if the object can not be an operand (NotImplemented)
+static bool pyopencv_expr_arg(PyObject* o, pyopencv_ExprArg& a)
+{
+    if( pyopencv_matexpr_check(o) )
+    {
+        a.kind = pyopencv_ExprArg::EXPR;
+        a.e = ((pyopencv_MatExpr_t*)o)->e;
+        return true;
+    }
+    if( PyInt_Check(o) || PyFloat_Check(o) || PyArray_IsScalar(o, Integer) || PyArray_IsScalar(o, Floating) )
+    {
+        a.kind = pyopencv_ExprArg::NUMBER;
+        a.s = Scalar::all(PyFloat_AsDouble(o));
+        return !PyErr_Occurred();
+    }
+    if( PyTuple_Check(o) )
+    {
+        a.kind = pyopencv_ExprArg::SCALAR;
+        return PyTuple_GET_SIZE(o) <= 4 && pyopencv_to(o, a.s, "scalar");
+    }
+    if( PyArray_Check(o) )
+    {
+        Mat m;
+        if( !pyopencv_to(o, m, ArgInfo("operand", 0)) )
+            return false;
+        a.kind = pyopencv_ExprArg::EXPR;
+        a.e = MatExpr(m);
+        return true;
+    }
+    return false;
+}
+
+// the operands of a binary operator, or NotImplemented
+#define PYOPENCV_EXPR_ARGS(o1, o2) \
+    pyopencv_ExprArg a, b; \
+    if( !pyopencv_expr_arg(o1, a) || !pyopencv_expr_arg(o2, b) ) \
+    { \
+        if( PyErr_Occurred() ) \
+            return NULL; \
+        Py_RETURN_NOTIMPLEMENTED; \
+    } \
+    MatExpr r
+
+#define PYOPENCV_EXPR_RESULT() \
+    return pyopencv_matexpr_new(r)
+
+static PyObject* pyopencv_MatExpr_add(PyObject* o1, PyObject* o2)
+{
+    PYOPENCV_EXPR_ARGS(o1, o2);
+    if( a.kind != pyopencv_ExprArg::EXPR && b.kind != pyopencv_ExprArg::EXPR )
+        Py_RETURN_NOTIMPLEMENTED;
+    ERRWRAP2(r = a.kind != pyopencv_ExprArg::EXPR ? a.s + b.e : b.kind != pyopencv_ExprArg::EXPR ? a.e + b.s : a.e + b.e);
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_sub(PyObject* o1, PyObject* o2)
+{
+    PYOPENCV_EXPR_ARGS(o1, o2);
+    if( a.kind != pyopencv_ExprArg::EXPR && b.kind != pyopencv_ExprArg::EXPR )
+        Py_RETURN_NOTIMPLEMENTED;
+    ERRWRAP2(r = a.kind != pyopencv_ExprArg::EXPR ? a.s - b.e : b.kind != pyopencv_ExprArg::EXPR ? a.e - b.s : a.e - b.e);
+    PYOPENCV_EXPR_RESULT();
+}
+
+// elementwise, as numpy does; the matrix product is @
+static PyObject* pyopencv_MatExpr_mul(PyObject* o1, PyObject* o2)
+{
+    PYOPENCV_EXPR_ARGS(o1, o2);
+    if( a.kind == pyopencv_ExprArg::SCALAR || b.kind == pyopencv_ExprArg::SCALAR ||
+        (a.kind != pyopencv_ExprArg::EXPR && b.kind != pyopencv_ExprArg::EXPR) )
+        Py_RETURN_NOTIMPLEMENTED;
+    ERRWRAP2(r = a.kind == pyopencv_ExprArg::NUMBER ? a.s[0]*b.e : b.kind == pyopencv_ExprArg::NUMBER ? a.e*b.s[0] : a.e.mul(b.e));
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_div(PyObject* o1, PyObject* o2)
+{
+    PYOPENCV_EXPR_ARGS(o1, o2);
+    if( a.kind == pyopencv_ExprArg::SCALAR || b.kind == pyopencv_ExprArg::SCALAR ||
+        (a.kind != pyopencv_ExprArg::EXPR && b.kind != pyopencv_ExprArg::EXPR) )
+        Py_RETURN_NOTIMPLEMENTED;
+    ERRWRAP2(r = a.kind == pyopencv_ExprArg::NUMBER ? a.s[0]/b.e : b.kind == pyopencv_ExprArg::NUMBER ? a.e/b.s[0] : a.e/b.e);
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_matmul(PyObject* o1, PyObject* o2)
+{
+    PYOPENCV_EXPR_ARGS(o1, o2);
+    if( a.kind != pyopencv_ExprArg::EXPR || b.kind != pyopencv_ExprArg::EXPR )
+        Py_RETURN_NOTIMPLEMENTED;
+    ERRWRAP2(r = a.e*b.e);
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_neg(PyObject* o)
+{
+    MatExpr r;
+    ERRWRAP2(r = -((pyopencv_MatExpr_t*)o)->e);
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_abs(PyObject* o)
+{
+    MatExpr r;
+    ERRWRAP2(r = abs(((pyopencv_MatExpr_t*)o)->e));
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_invert(PyObject* o)
+{
+    MatExpr r;
+    ERRWRAP2(r = ~Mat(((pyopencv_MatExpr_t*)o)->e));
+    PYOPENCV_EXPR_RESULT();
+}
+
+// the masks: the operands are evaluated, as cv::MatExpr has no lazy form of them with an expression
+#define PYOPENCV_EXPR_BITWISE(name, op) \
+static PyObject* pyopencv_MatExpr_##name(PyObject* o1, PyObject* o2) \
+{ \
+    PYOPENCV_EXPR_ARGS(o1, o2); \
+    if( a.kind != pyopencv_ExprArg::EXPR && b.kind != pyopencv_ExprArg::EXPR ) \
+        Py_RETURN_NOTIMPLEMENTED; \
+    ERRWRAP2(r = a.kind != pyopencv_ExprArg::EXPR ? a.s op Mat(b.e) : b.kind != pyopencv_ExprArg::EXPR ? Mat(a.e) op b.s : Mat(a.e) op Mat(b.e)); \
+    PYOPENCV_EXPR_RESULT(); \
+}
+
+PYOPENCV_EXPR_BITWISE(and, &)
+PYOPENCV_EXPR_BITWISE(or, |)
+PYOPENCV_EXPR_BITWISE(xor, ^)
+
+static PyObject* pyopencv_MatExpr_richcompare(PyObject* o1, PyObject* o2, int op)
+{
+    // o1 is the expression, Python swaps the operands otherwise; OpenCV compares with numbers,
+    // not with the scalar tuples
+    PYOPENCV_EXPR_ARGS(o1, o2);
+    if( b.kind == pyopencv_ExprArg::SCALAR )
+        Py_RETURN_NOTIMPLEMENTED;
+    try
+    {
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("MatExpr compare"));
+        Mat m1 = a.e;
+        if( b.kind == pyopencv_ExprArg::NUMBER )
+        {
+            double v = b.s[0];
+            r = op == Py_LT ? m1 < v : op == Py_LE ? m1 <= v : op == Py_EQ ? m1 == v :
+                op == Py_NE ? m1 != v : op == Py_GT ? m1 > v : m1 >= v;
+        }
+        else
+        {
+            Mat m2 = b.e;
+            r = op == Py_LT ? m1 < m2 : op == Py_LE ? m1 <= m2 : op == Py_EQ ? m1 == m2 :
+                op == Py_NE ? m1 != m2 : op == Py_GT ? m1 > m2 : m1 >= m2;
+        }
+    }
+    catch(const cv::Exception& e)
+    {
+        PyErr_SetString(opencv_error, e.what());
+        return NULL;
+    }
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_eval(PyObject* self, PyObject*)
+{
+    Mat m;
+    m.allocator = &g_numpyAllocator;
+    ERRWRAP2(m = ((pyopencv_MatExpr_t*)self)->e);
+    return pyopencv_from(m);
+}
+
+static PyObject* pyopencv_MatExpr_array(PyObject* self, PyObject*, PyObject*)
+{
+    return pyopencv_MatExpr_eval(self, NULL);
+}
+
+static PyObject* pyopencv_MatExpr_t_method(PyObject* self, PyObject*)
+{
+    MatExpr r;
+    ERRWRAP2(r = ((pyopencv_MatExpr_t*)self)->e.t());
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_inv(PyObject* self, PyObject* args, PyObject* kw)
+{
+    const char* keywords[] = { "method", NULL };
+    int method = DECOMP_LU;
+    if( !PyArg_ParseTupleAndKeywords(args, kw, "|i:inv", (char**)keywords, &method) )
+        return NULL;
+    MatExpr r;
+    ERRWRAP2(r = ((pyopencv_MatExpr_t*)self)->e.inv(method));
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_mul_method(PyObject* self, PyObject* args, PyObject* kw)
+{
+    const char* keywords[] = { "other", "scale", NULL };
+    PyObject* other;
+    double scale = 1;
+    if( !PyArg_ParseTupleAndKeywords(args, kw, "O|d:mul", (char**)keywords, &other, &scale) )
+        return NULL;
+    pyopencv_ExprArg b;
+    if( !pyopencv_expr_arg(other, b) || b.kind != pyopencv_ExprArg::EXPR )
+    {
+        if( !PyErr_Occurred() )
+            PyErr_SetString(PyExc_TypeError, "mul() takes an array or an expression");
+        return NULL;
+    }
+    MatExpr r;
+    ERRWRAP2(r = ((pyopencv_MatExpr_t*)self)->e.mul(b.e, scale));
+    PYOPENCV_EXPR_RESULT();
+}
+
+static PyObject* pyopencv_MatExpr_get_shape(PyObject* self, void*)
+{
+    const MatExpr& e = ((pyopencv_MatExpr_t*)self)->e;
+    Size sz;
+    int cn;
+    ERRWRAP2(sz = e.size(); cn = CV_MAT_CN(e.type()));
+    return cn > 1 ? Py_BuildValue("(iii)", sz.height, sz.width, cn) : Py_BuildValue("(ii)", sz.height, sz.width);
+}
+
+static PyObject* pyopencv_MatExpr_repr(PyObject* self)
+{
+    const MatExpr& e = ((pyopencv_MatExpr_t*)self)->e;
+    Size sz;
+    int type;
+    ERRWRAP2(sz = e.size(); type = e.type());
+    return PyString_FromString(format("<%s.MatExpr %dx%d, type %d>", MODULESTR, sz.width, sz.height, type).c_str());
+}
+
+static void pyopencv_MatExpr_dealloc(PyObject* self)
+{
+    ((pyopencv_MatExpr_t*)self)->e.~MatExpr();
+    PyObject_Del(self);
+}
+
+static PyMethodDef pyopencv_MatExpr_methods[] =
+{
+    {"eval", (PyCFunction)pyopencv_MatExpr_eval, METH_NOARGS, "eval() -> array. Evaluates the expression"},
+    {"t", (PyCFunction)pyopencv_MatExpr_t_method, METH_NOARGS, "t() -> MatExpr. The transposed matrix"},
+    {"inv", (PyCFunction)pyopencv_MatExpr_inv, METH_VARARGS | METH_KEYWORDS, "inv([method]) -> MatExpr. The inverse matrix, by cv2.DECOMP_LU by default"},
+    {"mul", (PyCFunction)pyopencv_MatExpr_mul_method, METH_VARARGS | METH_KEYWORDS, "mul(other[, scale]) -> MatExpr. The elementwise product, scaled"},
+    {"__array__", (PyCFunction)pyopencv_MatExpr_array, METH_VARARGS | METH_KEYWORDS, "Evaluates the expression"},
+    {NULL, NULL}
+};
+
+static PyGetSetDef pyopencv_MatExpr_getseters[] =
+{
+    {(char*)"shape", pyopencv_MatExpr_get_shape, NULL, (char*)"The shape of the result, as of a numpy array", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyNumberMethods pyopencv_MatExpr_as_number;
+
+static bool pyopencv_MatExpr_ready()
+{
+    static PyTypeReadyFlag ready;
+    if( ready )
+        return true;
+    PyInitLock lock;
+    if( pyopencv_MatExpr_Type.tp_flags & Py_TPFLAGS_READY )
+        return ready.set(true);
+    PyNumberMethods& nb = pyopencv_MatExpr_as_number;
+    nb.nb_add = pyopencv_MatExpr_add;
+    nb.nb_subtract = pyopencv_MatExpr_sub;
+    nb.nb_multiply = pyopencv_MatExpr_mul;
+    nb.nb_true_divide = pyopencv_MatExpr_div;
+#if PY_MAJOR_VERSION < 3
+    nb.nb_divide = pyopencv_MatExpr_div;
+#endif
+#if PY_VERSION_HEX >= 0x03050000
+    nb.nb_matrix_multiply = pyopencv_MatExpr_matmul;
+#endif
+    nb.nb_negative = pyopencv_MatExpr_neg;
+    nb.nb_absolute = pyopencv_MatExpr_abs;
+    nb.nb_invert = pyopencv_MatExpr_invert;
+    nb.nb_and = pyopencv_MatExpr_and;
+    nb.nb_or = pyopencv_MatExpr_or;
+    nb.nb_xor = pyopencv_MatExpr_xor;
+    pyopencv_MatExpr_Type.tp_as_number = &nb;
+    pyopencv_MatExpr_Type.tp_richcompare = pyopencv_MatExpr_richcompare;
+    pyopencv_MatExpr_Type.tp_dealloc = pyopencv_MatExpr_dealloc;
+    pyopencv_MatExpr_Type.tp_repr = pyopencv_MatExpr_repr;
+    pyopencv_MatExpr_Type.tp_methods = pyopencv_MatExpr_methods;
+    pyopencv_MatExpr_Type.tp_getset = pyopencv_MatExpr_getseters;
+    pyopencv_MatExpr_Type.tp_flags = Py_TPFLAGS_DEFAULT;
+#if PY_MAJOR_VERSION < 3
+    // the operators with the numbers on either side reach the slots without coercion
+    pyopencv_MatExpr_Type.tp_flags |= Py_TPFLAGS_CHECKTYPES;
+#endif
+    pyopencv_MatExpr_Type.tp_doc = (char*)"Lazy matrix expression, see cv2.MatExpr()";
+    if( PyType_Ready(&pyopencv_MatExpr_Type) < 0 )
+        return false;
+    // the numpy operators with an expression on the right give way to the expression
+    PyObject* priority = PyFloat_FromDouble(100.);
+    bool ok = priority && PyDict_SetItemString(pyopencv_MatExpr_Type.tp_dict, "__array_ufunc__", Py_None) == 0 &&
+              PyDict_SetItemString(pyopencv_MatExpr_Type.tp_dict, "__array_priority__", priority) == 0;
+    Py_XDECREF(priority);
+    return ready.set(ok);
+}
+
+static PyObject* pycvMatExpr(PyObject*, PyObject* args)
+{
+    PyObject* o;
+    if( !PyArg_ParseTuple(args, "O:MatExpr", &o) || !pyopencv_MatExpr_ready() )
+        return NULL;
+    if( pyopencv_matexpr_check(o) )
+    {
+        Py_INCREF(o);
+        return o;
+    }
+    Mat m;
+    if( !PyArray_Check(o) )
+    {
+        PyErr_SetString(PyExc_TypeError, "MatExpr() takes a numpy array");
+        return NULL;
+    }
+    if( !pyopencv_to(o, m, ArgInfo("array", 0)) )
+        return NULL;
+    return pyopencv_matexpr_new(MatExpr(m));
+}
+
+#endif // __PYMATEXPR_HPP__
@@ -73,6 +73,51 @@ static PyObject* failmsgp(const char *fmt, ...)
   return 0;
 }
 
+// Mat depth <-> numpy type number mapping. Both functions fold to constants for constant arguments;
+// the run-time lookups below go through the tables built from them.
+static constexpr int pyopencv_depth_to_typenum(int depth)
+{
+    return depth == CV_8U ? NPY_UBYTE : depth == CV_8S ? NPY_BYTE :
+           depth == CV_16U ? NPY_USHORT : depth == CV_16S ? NPY_SHORT :
+           depth == CV_32S ? NPY_INT : depth == CV_32F ? NPY_FLOAT :
+           depth == CV_64F ? NPY_DOUBLE : -1;
+}
+
+static constexpr int pyopencv_typenum_to_depth(int typenum)
+{
+    return typenum == NPY_UBYTE ? CV_8U : typenum == NPY_BYTE ? CV_8S :
+           typenum == NPY_USHORT ? CV_16U : typenum == NPY_SHORT ? CV_16S :
+           typenum == NPY_INT ? CV_32S : typenum == NPY_INT32 ? CV_32S :
+           typenum == NPY_FLOAT ? CV_32F : typenum == NPY_DOUBLE ? CV_64F : -1;
+}
+
+static const int pyopencv_depth_typenum_tab[] =
+{
+    pyopencv_depth_to_typenum(0), pyopencv_depth_to_typenum(1), pyopencv_depth_to_typenum(2),
+    pyopencv_depth_to_typenum(3), pyopencv_depth_to_typenum(4), pyopencv_depth_to_typenum(5),
+    pyopencv_depth_to_typenum(6), pyopencv_depth_to_typenum(7)
+};
+
+// indexed by the numpy type numbers up to NPY_DOUBLE, which cover all the types Mat can hold
+static const signed char pyopencv_typenum_depth_tab[] =
+{
+    pyopencv_typenum_to_depth(0), pyopencv_typenum_to_depth(1), pyopencv_typenum_to_depth(2),
+    pyopencv_typenum_to_depth(3), pyopencv_typenum_to_depth(4), pyopencv_typenum_to_depth(5),
+    pyopencv_typenum_to_depth(6), pyopencv_typenum_to_depth(7), pyopencv_typenum_to_depth(8),
+    pyopencv_typenum_to_depth(9), pyopencv_typenum_to_depth(10), pyopencv_typenum_to_depth(11),
+    pyopencv_typenum_to_depth(12)
+};
+
+static inline int pyopencv_typenum(int depth)
+{
+    return pyopencv_depth_typenum_tab[depth & CV_MAT_DEPTH_MASK];
+}
+
+static inline int pyopencv_depth(int typenum)
+{
+    return (unsigned)typenum <= (unsigned)NPY_DOUBLE ? pyopencv_typenum_depth_tab[typenum] : -1;
+}
+
 class NumpyAllocator : public MatAllocator
 {
 public:
@@ -105,10 +150,9 @@ public:
         int depth = CV_MAT_DEPTH(type);
         int cn = CV_MAT_CN(type);
         const int f = (int)(sizeof(size_t)/8);
-        int typenum = depth == CV_8U ? NPY_UBYTE : depth == CV_8S ? NPY_BYTE :
-        depth == CV_16U ? NPY_USHORT : depth == CV_16S ? NPY_SHORT :
-        depth == CV_32S ? NPY_INT : depth == CV_32F ? NPY_FLOAT :
-        depth == CV_64F ? NPY_DOUBLE : f*NPY_ULONGLONG + (f^1)*NPY_UINT;
+        int typenum = pyopencv_typenum(depth);
+        if( typenum < 0 )
+            typenum = f*NPY_ULONGLONG + (f^1)*NPY_UINT;
         int i, dims = dims0;
         cv::AutoBuffer<npy_intp> _sizes(dims + 1);
         for( i = 0; i < dims; i++ )
@@ -153,6 +197,47 @@ void doImport( ){
     import_array( );
 }
 
+// Numbers and numerical tuples passed where a Mat is expected become a CV_64F column
+// (4 rows for a single number, so that it acts as a Scalar). If the caller provides storage
+// for 4 doubles, the Mat is put on top of it instead of the heap; the storage must then
+// outlive all the uses of the Mat.
+static bool pyopencv_to_scalar_mat(PyObject* o, Mat& m, const ArgInfo info, double* scalarbuf)
+{
+    PyObject** items = &o;
+    int i, sz = 1, rows = 4;
+    if( PyTuple_Check(o) )
+    {
+        rows = sz = (int)PyTuple_GET_SIZE(o);
+        items = &PyTuple_GET_ITEM(o, 0);
+    }
+
+    if( scalarbuf && rows <= 4 )
+        m = Mat(rows, 1, CV_64F, scalarbuf);
+    else
+        m = Mat(rows, 1, CV_64F);
+
+    double* data = (double*)m.data;
+    for( i = sz; i < rows; i++ )
+        data[i] = 0.;
+    for( i = 0; i < sz; i++ )
+    {
+        PyObject* oi = items[i];
+        if( PyFloat_CheckExact(oi) )
+            data[i] = PyFloat_AS_DOUBLE(oi);
+        else if( PyInt_Check(oi) )
+            data[i] = (double)PyInt_AsLong(oi);
+        else if( PyFloat_Check(oi) )
+            data[i] = PyFloat_AsDouble(oi);
+        else
+        {
+            failmsg("%s is not a numerical tuple", info.name);
+            m.release();
+            return false;
+        }
+    }
+    return true;
+}
+
 // special case, when the convertor needs full ArgInfo structure
 bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
 {
@@ -167,38 +252,8 @@ bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
 
 	doImport();
 
-    if( PyInt_Check(o) )
-    {
-        double v[] = {PyInt_AsLong((PyObject*)o), 0., 0., 0.};
-        m = Mat(4, 1, CV_64F, v).clone();
-        return true;
-    }
-    if( PyFloat_Check(o) )
-    {
-        double v[] = {PyFloat_AsDouble((PyObject*)o), 0., 0., 0.};
-        m = Mat(4, 1, CV_64F, v).clone();
-        return true;
-    }
-    if( PyTuple_Check(o) )
-    {
-        int i, sz = (int)PyTuple_Size((PyObject*)o);
-        m = Mat(sz, 1, CV_64F);
-        for( i = 0; i < sz; i++ )
-        {
-            PyObject* oi = PyTuple_GET_ITEM(o, i);
-            if( PyInt_Check(oi) )
-                m.at<double>(i) = (double)PyInt_AsLong(oi);
-            else if( PyFloat_Check(oi) )
-                m.at<double>(i) = (double)PyFloat_AsDouble(oi);
-            else
-            {
-                failmsg("%s is not a numerical tuple", info.name);
-                m.release();
-                return false;
-            }
-        }
-        return true;
-    }
+    if( PyInt_Check(o) || PyFloat_Check(o) || PyTuple_Check(o) )
+        return pyopencv_to_scalar_mat(o, m, info, 0);
 
     if( !PyArray_Check(o) )
     {
@@ -210,18 +265,11 @@ bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
 
     bool needcopy = false, needcast = false;
     int typenum = PyArray_TYPE(oarr), new_typenum = typenum;
-    int type = typenum == NPY_UBYTE ? CV_8U :
-               typenum == NPY_BYTE ? CV_8S :
-               typenum == NPY_USHORT ? CV_16U :
-               typenum == NPY_SHORT ? CV_16S :
-               typenum == NPY_INT ? CV_32S :
-               typenum == NPY_INT32 ? CV_32S :
-               typenum == NPY_FLOAT ? CV_32F :
-               typenum == NPY_DOUBLE ? CV_64F : -1;
+    int type = pyopencv_depth(typenum);
 
     if( type < 0 )
     {
-        if( typenum == NPY_INT64 || typenum == NPY_UINT64 || type == NPY_LONG )
+        if( typenum == NPY_INT64 || typenum == NPY_UINT64 || typenum == NPY_LONG )
         {
             needcopy = needcast = true;
             new_typenum = NPY_INT;
@@ -324,6 +372,11 @@ bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
     return true;
 }
 
+static bool pyopencv_to(PyObject* o, Mat& m, const ArgInfo info)
+{
+    return pyopencv_to(o, m, info, 0);
+}
+
 template<>
 PyObject* pyopencv_from(const Mat& m)
 {
@@ -341,6 +394,121 @@ PyObject* pyopencv_from(const Mat& m)
     return o;
 }
 
+// Fixed-size tuple converters for the small value types (Size, Rect, Point, ...).
+// The element types are known at compile time, so the tuples are packed and unpacked
+// element by element instead of interpreting a format string on every call.
+// Unpacking accepts tuples and lists of the exact length.
+template<typename... _Ts> static bool pyopencv_unpack(PyObject* obj, const char* name, _Ts&... vs);
+template<typename... _Ts> static PyObject* pyopencv_pack(const _Ts&... vs);
+
+static inline bool pyopencv_to_elem(PyObject* o, double& v)
+{
+    if( PyFloat_CheckExact(o) )
+    {
+        v = PyFloat_AS_DOUBLE(o);
+        return true;
+    }
+    v = PyFloat_AsDouble(o);
+    return v != -1 || !PyErr_Occurred();
+}
+
+static inline bool pyopencv_to_elem(PyObject* o, float& v)
+{
+    double d;
+    if( !pyopencv_to_elem(o, d) )
+        return false;
+    v = (float)d;
+    return true;
+}
+
+static inline bool pyopencv_to_elem(PyObject* o, int& v)
+{
+    if( PyFloat_Check(o) )
+        return false;
+    long l = PyInt_AsLong(o);
+    if( l == -1 && PyErr_Occurred() )
+        return false;
+    if( l < INT_MIN || l > INT_MAX )
+    {
+        PyErr_SetString(PyExc_OverflowError, "signed integer is out of range");
+        return false;
+    }
+    v = (int)l;
+    return true;
+}
+
+template<typename _Tp> static inline bool pyopencv_to_elem(PyObject* o, Point_<_Tp>& p)
+{
+    return pyopencv_unpack(o, "<element>", p.x, p.y);
+}
+
+template<typename _Tp> static inline bool pyopencv_to_elem(PyObject* o, Size_<_Tp>& sz)
+{
+    return pyopencv_unpack(o, "<element>", sz.width, sz.height);
+}
+
+static inline PyObject* pyopencv_from_elem(int v) { return PyInt_FromLong(v); }
+static inline PyObject* pyopencv_from_elem(float v) { return PyFloat_FromDouble(v); }
+static inline PyObject* pyopencv_from_elem(double v) { return PyFloat_FromDouble(v); }
+
+template<typename _Tp> static inline PyObject* pyopencv_from_elem(const Point_<_Tp>& p)
+{
+    return pyopencv_pack(p.x, p.y);
+}
+
+template<typename _Tp> static inline PyObject* pyopencv_from_elem(const Size_<_Tp>& sz)
+{
+    return pyopencv_pack(sz.width, sz.height);
+}
+
+static inline bool pyopencv_unpack_items(PyObject**)
+{
+    return true;
+}
+
+template<typename _T0, typename... _Ts> static inline
+bool pyopencv_unpack_items(PyObject** items, _T0& v0, _Ts&... vs)
+{
+    return pyopencv_to_elem(items[0], v0) && pyopencv_unpack_items(items + 1, vs...);
+}
+
+template<typename... _Ts> static bool pyopencv_unpack(PyObject* obj, const char* name, _Ts&... vs)
+{
+    const Py_ssize_t n = (Py_ssize_t)sizeof...(_Ts);
+    PyObject** items = 0;
+    if( PyTuple_Check(obj) && PyTuple_GET_SIZE(obj) == n )
+        items = &PyTuple_GET_ITEM(obj, 0);
+    else if( PyList_Check(obj) && PyList_GET_SIZE(obj) == n )
+        items = &PyList_GET_ITEM(obj, 0);
+
+    if( items && pyopencv_unpack_items(items, vs...) )
+        return true;
+    if( !PyErr_Occurred() )
+        failmsg("%s must be a tuple of %d numbers", name, (int)n);
+    return false;
+}
+
+template<typename... _Ts> static PyObject* pyopencv_pack(const _Ts&... vs)
+{
+    const int n = (int)sizeof...(_Ts);
+    PyObject* items[] = { pyopencv_from_elem(vs)... };
+    PyObject* t = PyTuple_New(n);
+    int i;
+    bool ok = t != 0;
+    for( i = 0; i < n; i++ )
+        ok = ok && items[i] != 0;
+    if( !ok )
+    {
+        Py_XDECREF(t);
+        for( i = 0; i < n; i++ )
+            Py_XDECREF(items[i]);
+        return 0;
+    }
+    for( i = 0; i < n; i++ )
+        PyTuple_SET_ITEM(t, i, items[i]);
+    return t;
+}
+
 template<>
 bool pyopencv_to(PyObject *o, Scalar& s, const char *name)
 {
@@ -350,16 +518,22 @@ bool pyopencv_to(PyObject *o, Scalar& s, const char *name)
         PyObject *fi = PySequence_Fast(o, name);
         if (fi == NULL)
             return false;
-        if (4 < PySequence_Fast_GET_SIZE(fi))
+        Py_ssize_t i, n = PySequence_Fast_GET_SIZE(fi);
+        PyObject** items = PySequence_Fast_ITEMS(fi);
+        if (4 < n)
         {
+            Py_DECREF(fi);
             failmsg("Scalar value for argument '%s' is longer than 4", name);
             return false;
         }
-        for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(fi); i++) {
-            PyObject *item = PySequence_Fast_GET_ITEM(fi, i);
-            if (PyFloat_Check(item) || PyInt_Check(item)) {
+        for (i = 0; i < n; i++) {
+            PyObject *item = items[i];
+            if (PyFloat_CheckExact(item)) {
+                s[(int)i] = PyFloat_AS_DOUBLE(item);
+            } else if (PyFloat_Check(item) || PyInt_Check(item)) {
                 s[(int)i] = PyFloat_AsDouble(item);
             } else {
+                Py_DECREF(fi);
                 failmsg("Scalar value for argument '%s' is not numeric", name);
                 return false;
             }
@@ -379,7 +553,7 @@ bool pyopencv_to(PyObject *o, Scalar& s, const char *name)
 template<>
 PyObject* pyopencv_from(const Scalar& src)
 {
-    return Py_BuildValue("(dddd)", src[0], src[1], src[2], src[3]);
+    return pyopencv_pack(src[0], src[1], src[2], src[3]);
 }
 
 template<>
@@ -525,13 +699,13 @@ bool pyopencv_to(PyObject* obj, Size& sz, const char* name)
     (void)name;
     if(!obj || obj == Py_None)
         return true;
-    return PyArg_ParseTuple(obj, "ii", &sz.width, &sz.height) > 0;
+    return pyopencv_unpack(obj, name, sz.width, sz.height);
 }
 
 template<>
 PyObject* pyopencv_from(const Size& sz)
 {
-    return Py_BuildValue("(ii)", sz.width, sz.height);
+    return pyopencv_pack(sz.width, sz.height);
 }
 
 template<>
@@ -540,13 +714,13 @@ bool pyopencv_to(PyObject* obj, Rect& r, const char* name)
     (void)name;
     if(!obj || obj == Py_None)
         return true;
-    return PyArg_ParseTuple(obj, "iiii", &r.x, &r.y, &r.width, &r.height) > 0;
+    return pyopencv_unpack(obj, name, r.x, r.y, r.width, r.height);
 }
 
 template<>
 PyObject* pyopencv_from(const Rect& r)
 {
-    return Py_BuildValue("(iiii)", r.x, r.y, r.width, r.height);
+    return pyopencv_pack(r.x, r.y, r.width, r.height);
 }
 
 template<>
@@ -560,13 +734,13 @@ bool pyopencv_to(PyObject* obj, Range& r, const char* name)
         r = Range::all();
         return true;
     }
-    return PyArg_ParseTuple(obj, "ii", &r.start, &r.end) > 0;
+    return pyopencv_unpack(obj, name, r.start, r.end);
 }
 
 template<>
 PyObject* pyopencv_from(const Range& r)
 {
-    return Py_BuildValue("(ii)", r.start, r.end);
+    return pyopencv_pack(r.start, r.end);
 }
 
 template<>
@@ -582,7 +756,7 @@ bool pyopencv_to(PyObject* obj, Point& p, const char* name)
         p.y = saturate_cast<int>(c.imag);
         return true;
     }
-    return PyArg_ParseTuple(obj, "ii", &p.x, &p.y) > 0;
+    return pyopencv_unpack(obj, name, p.x, p.y);
 }
 
 template<>
@@ -598,7 +772,7 @@ bool pyopencv_to(PyObject* obj, Point2f& p, const char* name)
         p.y = saturate_cast<float>(c.imag);
         return true;
     }
-    return PyArg_ParseTuple(obj, "ff", &p.x, &p.y) > 0;
+    return pyopencv_unpack(obj, name, p.x, p.y);
 }
 
 template<>
@@ -614,20 +788,20 @@ bool pyopencv_to(PyObject* obj, Point2d& p, const char* name)
         p.y = saturate_cast<double>(c.imag);
         return true;
     }
-    return PyArg_ParseTuple(obj, "dd", &p.x, &p.y) > 0;
+    return pyopencv_unpack(obj, name, p.x, p.y);
 }
 
 
 template<>
 PyObject* pyopencv_from(const Point& p)
 {
-    return Py_BuildValue("(ii)", p.x, p.y);
+    return pyopencv_pack(p.x, p.y);
 }
 
 template<>
 PyObject* pyopencv_from(const Point2f& p)
 {
-    return Py_BuildValue("(dd)", p.x, p.y);
+    return pyopencv_pack(p.x, p.y);
 }
 
 template<>
@@ -636,25 +810,150 @@ bool pyopencv_to(PyObject* obj, Vec3d& v, const char* name)
     (void)name;
     if(!obj)
         return true;
-    return PyArg_ParseTuple(obj, "ddd", &v[0], &v[1], &v[2]) > 0;
+    return pyopencv_unpack(obj, name, v[0], v[1], v[2]);
 }
 
 template<>
 PyObject* pyopencv_from(const Vec3d& v)
 {
-    return Py_BuildValue("(ddd)", v[0], v[1], v[2]);
+    return pyopencv_pack(v[0], v[1], v[2]);
 }
 
 template<>
 PyObject* pyopencv_from(const Vec2d& v)
 {
-    return Py_BuildValue("(dd)", v[0], v[1]);
+    return pyopencv_pack(v[0], v[1]);
 }
 
 template<>
 PyObject* pyopencv_from(const Point2d& p)
 {
-    return Py_BuildValue("(dd)", p.x, p.y);
+    return pyopencv_pack(p.x, p.y);
+}
+
+// Reads a single element of a numeric sequence. The exact int and float types are checked first,
+// so the common case costs a pointer comparison and a direct read; subclasses (e.g. numpy.float64
+// and bool) go through the generic protocol.
+template<typename _Cp> static inline bool pyopencv_to_number(PyObject* o, _Cp& dst)
+{
+    if( PyFloat_CheckExact(o) )
+    {
+        dst = saturate_cast<_Cp>(PyFloat_AS_DOUBLE(o));
+        return true;
+    }
+    if( PyInt_Check(o) || PyLong_Check(o) )
+    {
+        long v = PyLong_AsLong(o);
+        if( v == -1 && PyErr_Occurred() )
+            return false;
+        dst = saturate_cast<_Cp>((int64)v);
+        return true;
+    }
+    if( PyFloat_Check(o) )
+    {
+        dst = saturate_cast<_Cp>(PyFloat_AsDouble(o));
+        return true;
+    }
+    return false;
+}
+
+// Converts a list/tuple of plain numbers. The element type is detected once; for homogeneous
+// lists of exact ints or floats the items are then read without any per-item type checks.
+// Returns -1 if the list is not homogeneous, so that the caller can use the generic path.
+template<typename _Cp> static int pyopencv_to_numbers(PyObject** items, int n, _Cp* data)
+{
+    int i = 0;
+    PyTypeObject* itemtype = n > 0 ? Py_TYPE(items[0]) : 0;
+    while( i < n && Py_TYPE(items[i]) == itemtype )
+        i++;
+
+    if( i == n && itemtype == &PyFloat_Type )
+    {
+        for( i = 0; i < n; i++ )
+            data[i] = saturate_cast<_Cp>(PyFloat_AS_DOUBLE(items[i]));
+        return 1;
+    }
+    if( i == n && itemtype == &PyLong_Type )
+    {
+        for( i = 0; i < n; i++ )
+        {
+            long v = PyLong_AsLong(items[i]);
+            if( v == -1 && PyErr_Occurred() )
+                return 0;
+            data[i] = saturate_cast<_Cp>((int64)v);
+        }
+        return 1;
+    }
+    return -1;
+}
+
+template<typename _Cp, typename _Sp> static void pyopencv_cvt_buffer(const void* src, _Cp* dst, Py_ssize_t n)
+{
+    const _Sp* s = (const _Sp*)src;
+    for( Py_ssize_t i = 0; i < n; i++ )
+        dst[i] = saturate_cast<_Cp>(s[i]);
+}
+
+// Converts the contents of an object exporting the buffer protocol (array.array, memoryview, bytes, ...)
+// in a single typed pass. Returns -1 if the buffer format is not a numeric one of the native byte
+// order, so that the caller can fall back to the sequence protocol.
+template<typename _Tp> static int pyopencv_to_vec_buffer(PyObject* obj, std::vector<_Tp>& value)
+{
+    typedef typename DataType<_Tp>::channel_type _Cp;
+    int channels = DataType<_Tp>::channels;
+    Py_buffer view;
+
+    if( PyObject_GetBuffer(obj, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0 )
+    {
+        PyErr_Clear();
+        return -1;
+    }
+
+    const char* fmt = view.format ? view.format : "B";
+    if( *fmt == '@' || *fmt == '=' ||
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        *fmt == '<' )
+#else
+        *fmt == '>' || *fmt == '!' )
+#endif
+        fmt++;
+
+    Py_ssize_t count = view.itemsize > 0 ? view.len / view.itemsize : 0;
+    if( fmt[0] == '\0' || fmt[1] != '\0' || count % channels != 0 )
+    {
+        PyBuffer_Release(&view);
+        return -1;
+    }
+
+    value.resize(count / channels);
+    _Cp* data = value.empty() ? 0 : (_Cp*)&value[0];
+    int ok = 1;
+    switch( fmt[0] )
+    {
+    case 'b': pyopencv_cvt_buffer<_Cp, schar>(view.buf, data, count); break;
+    case 'B': pyopencv_cvt_buffer<_Cp, uchar>(view.buf, data, count); break;
+    case 'h': pyopencv_cvt_buffer<_Cp, short>(view.buf, data, count); break;
+    case 'H': pyopencv_cvt_buffer<_Cp, ushort>(view.buf, data, count); break;
+    case 'i': pyopencv_cvt_buffer<_Cp, int>(view.buf, data, count); break;
+    case 'I': pyopencv_cvt_buffer<_Cp, unsigned>(view.buf, data, count); break;
+    // the size of long is native with '@' and 4 bytes with '=' and '<', as given by itemsize
+    case 'l':
+        if( view.itemsize == 8 ) pyopencv_cvt_buffer<_Cp, int64>(view.buf, data, count);
+        else pyopencv_cvt_buffer<_Cp, int>(view.buf, data, count);
+        break;
+    case 'L':
+        if( view.itemsize == 8 ) pyopencv_cvt_buffer<_Cp, uint64>(view.buf, data, count);
+        else pyopencv_cvt_buffer<_Cp, unsigned>(view.buf, data, count);
+        break;
+    case 'q': pyopencv_cvt_buffer<_Cp, int64>(view.buf, data, count); break;
+    case 'Q': pyopencv_cvt_buffer<_Cp, uint64>(view.buf, data, count); break;
+    case 'f': pyopencv_cvt_buffer<_Cp, float>(view.buf, data, count); break;
+    case 'd': pyopencv_cvt_buffer<_Cp, double>(view.buf, data, count); break;
+    default:
+        ok = -1;
+    }
+    PyBuffer_Release(&view);
+    return ok;
 }
 
 template<typename _Tp> struct pyopencvVecConverter
@@ -664,11 +963,37 @@ template<typename _Tp> struct pyopencvVecConverter
         typedef typename DataType<_Tp>::channel_type _Cp;
         if(!obj || obj == Py_None)
             return true;
+
+        int type = DataType<_Tp>::type;
+        int depth = CV_MAT_DEPTH(type), channels = CV_MAT_CN(type);
+
         if (PyArray_Check(obj))
         {
             Mat m;
-            pyopencv_to(obj, m, info);
-            m.copyTo(value);
+            if( !pyopencv_to(obj, m, info) )
+                return false;
+            // checkVector() and reshape() need the elements without gaps
+            if( !m.isContinuous() )
+                m = m.clone();
+            int n = m.checkVector(channels);
+            if( n < 0 )
+            {
+                failmsg("%s can not be converted to a vector of %d-channel elements", info.name, channels);
+                return false;
+            }
+            value.resize(n);
+            if( n > 0 )
+            {
+                Mat dst(n, 1, type, &value[0]);
+                m.reshape(channels, n).convertTo(dst, type);
+            }
+            return true;
+        }
+        if (!PyList_Check(obj) && !PyTuple_Check(obj) && PyObject_CheckBuffer(obj))
+        {
+            int r = pyopencv_to_vec_buffer(obj, value);
+            if( r >= 0 )
+                return r > 0;
         }
         if (!PySequence_Check(obj))
             return false;
@@ -678,10 +1003,18 @@ template<typename _Tp> struct pyopencvVecConverter
         int i, j, n = (int)PySequence_Fast_GET_SIZE(seq);
         value.resize(n);
 
-        int type = DataType<_Tp>::type;
-        int depth = CV_MAT_DEPTH(type), channels = CV_MAT_CN(type);
         PyObject** items = PySequence_Fast_ITEMS(seq);
 
+        if( channels == 1 && n > 0 )
+        {
+            int r = pyopencv_to_numbers(items, n, (_Cp*)&value[0]);
+            if( r >= 0 )
+            {
+                Py_DECREF(seq);
+                return r > 0;
+            }
+        }
+
         for( i = 0; i < n; i++ )
         {
             PyObject* item = items[i];
@@ -691,12 +1024,19 @@ template<typename _Tp> struct pyopencvVecConverter
 
             if( channels == 2 && PyComplex_CheckExact(item) )
             {
-                Py_complex c = PyComplex_AsCComplex(obj);
+                Py_complex c = PyComplex_AsCComplex(item);
                 data[0] = saturate_cast<_Cp>(c.real);
                 data[1] = saturate_cast<_Cp>(c.imag);
                 continue;
             }
-            if( channels > 1 )
+            // the nested tuples and lists are accessed in-place
+            if( channels == 1 && !PyArray_Check(item) )
+                ;
+            else if( PyTuple_CheckExact(item) && PyTuple_GET_SIZE(item) == channels )
+                items_i = &PyTuple_GET_ITEM(item, 0);
+            else if( PyList_CheckExact(item) && PyList_GET_SIZE(item) == channels )
+                items_i = &PyList_GET_ITEM(item, 0);
+            else
             {
                 if( PyArray_Check(item))
                 {
@@ -724,29 +1064,7 @@ template<typename _Tp> struct pyopencvVecConverter
 
             for( j = 0; j < channels; j++ )
             {
-                PyObject* item_ij = items_i[j];
-                if( PyInt_Check(item_ij))
-                {
-                    int v = (int)PyInt_AsLong(item_ij);
-                    if( v == -1 && PyErr_Occurred() )
-                        break;
-                    data[j] = saturate_cast<_Cp>(v);
-                }
-                else if( PyLong_Check(item_ij))
-                {
-                    int v = (int)PyLong_AsLong(item_ij);
-                    if( v == -1 && PyErr_Occurred() )
-                        break;
-                    data[j] = saturate_cast<_Cp>(v);
-                }
-                else if( PyFloat_Check(item_ij))
-                {
-                    double v = PyFloat_AsDouble(item_ij);
-                    if( PyErr_Occurred() )
-                        break;
-                    data[j] = saturate_cast<_Cp>(v);
-                }
-                else
+                if( !pyopencv_to_number(items_i[j], data[j]) )
                     break;
             }
             Py_XDECREF(seq_i);
@@ -835,15 +1153,154 @@ template<typename _Tp> struct pyopencvVecConverter<std::vector<_Tp> >
     }
 };
 
+// Views a stacked (N,H,W) or (N,H,W,C) numpy array as N Mat headers, one per slice of the
+// leading axis. All the headers share the array buffer and a single reference to the array,
+// so no per-item numpy views are created and nothing is copied unless the layout of an input
+// array is not compatible with cv::Mat. Returns false without setting an error when the array
+// can not be viewed this way; the caller then falls back to the per-item conversion.
+static bool pyopencv_batch_item_layout_ok(const npy_intp* _sizes, const npy_intp* _strides, int ndims, size_t elemsize)
+{
+    if( (size_t)_strides[ndims-1] != elemsize )
+        return false;
+    if( ndims == 4 && _strides[2] != (npy_intp)elemsize*_sizes[3] )
+        return false;
+    // transposed and flipped items
+    return _strides[1] >= _strides[2]*_sizes[2];
+}
+
+static bool pyopencv_to_mat_batch(PyObject* o, std::vector<Mat>& value, const ArgInfo info)
+{
+    PyArrayObject* oarr = (PyArrayObject*) o;
+    int ndims = PyArray_NDIM(oarr);
+    if( ndims != 3 && ndims != 4 )
+        return false;
+
+    const npy_intp* _sizes = PyArray_DIMS(oarr);
+    // the items of a 4-d array are (H,W,C) images, handled as multi-channel, the same as in pyopencv_to(Mat)
+    if( ndims == 4 && _sizes[3] > CV_CN_MAX )
+        return false;
+
+    bool needcopy = false, needcast = false;
+    int typenum = PyArray_TYPE(oarr), new_typenum = typenum;
+    int type = pyopencv_depth(typenum);
+
+    if( type < 0 )
+    {
+        if( typenum != NPY_INT64 && typenum != NPY_UINT64 && typenum != NPY_LONG )
+            return false;
+        needcopy = needcast = true;
+        new_typenum = NPY_INT;
+        type = CV_32S;
+    }
+
+    int i, n = (int)_sizes[0], cn = ndims == 4 ? (int)_sizes[3] : 1;
+    size_t elemsize = CV_ELEM_SIZE1(type);
+    const npy_intp* _strides = PyArray_STRIDES(oarr);
+
+    if( n == 0 )
+    {
+        value.clear();
+        return true;
+    }
+
+    // the batch stride may be anything; only the layout inside each item has to match cv::Mat
+    if( !pyopencv_batch_item_layout_ok(_sizes, _strides, ndims, elemsize) )
+        needcopy = true;
+
+    if( needcopy )
+    {
+        if( info.outputarg )
+            return false;
+
+        if( needcast )
+            o = PyArray_Cast(oarr, new_typenum);
+        else
+            o = (PyObject*)PyArray_GETCONTIGUOUS(oarr);
+        if( !o )
+        {
+            PyErr_Clear();
+            return false;
+        }
+        oarr = (PyArrayObject*) o;
+        _strides = PyArray_STRIDES(oarr);
+        if( !pyopencv_batch_item_layout_ok(_sizes, _strides, ndims, elemsize) )
+        {
+            Py_DECREF(o);
+            return false;
+        }
+    }
+    else
+        Py_INCREF(o);
+
+    type = CV_MAKETYPE(type, cn);
+    int size[] = { (int)_sizes[0], (int)_sizes[1], (int)_sizes[2] };
+    size_t step[] = { (size_t)_strides[0], (size_t)_strides[1], (size_t)_strides[2] };
+    // one UMatData owns the reference to the whole array; every item header adds to its refcount
+    UMatData* u = g_numpyAllocator.allocate(o, 3, size, type, step);
+    uchar* data = (uchar*)PyArray_DATA(oarr);
+
+    value.resize(n);
+    for( i = 0; i < n; i++ )
+    {
+        Mat& m = value[i];
+        m = Mat(size[1], size[2], type, data + (npy_intp)i*_strides[0], (size_t)_strides[1]);
+        m.u = u;
+        m.addref();
+        m.allocator = &g_numpyAllocator;
+    }
+    return true;
+}
+
+// The counterpart of pyopencv_to_mat_batch: when all the output Mat's are still the slices of
+// one stacked numpy array (i.e. the caller passed a stacked array for the output and the function
+// filled it in-place), the stacked array itself is returned instead of a list of arrays.
+static PyObject* pyopencv_from_mat_batch(const std::vector<Mat>& value)
+{
+    int i, n = (int)value.size();
+    if( n == 0 || !value[0].u || value[0].allocator != &g_numpyAllocator )
+        return 0;
+
+    UMatData* u = value[0].u;
+    PyObject* o = (PyObject*)u->userdata;
+    if( !o || !PyArray_Check(o) )
+        return 0;
+
+    PyArrayObject* oarr = (PyArrayObject*) o;
+    int ndims = PyArray_NDIM(oarr);
+    if( (ndims != 3 && ndims != 4) || PyArray_DIMS(oarr)[0] != n )
+        return 0;
+
+    const npy_intp* _sizes = PyArray_DIMS(oarr);
+    const npy_intp* _strides = PyArray_STRIDES(oarr);
+    const uchar* data = (const uchar*)PyArray_DATA(oarr);
+    int cn = ndims == 4 ? (int)_sizes[3] : 1;
+
+    for( i = 0; i < n; i++ )
+    {
+        const Mat& m = value[i];
+        if( m.u != u || m.dims != 2 || m.rows != _sizes[1] || m.cols != _sizes[2] ||
+            m.channels() != cn || m.data != data + (npy_intp)i*_strides[0] ||
+            m.step[0] != (size_t)_strides[1] )
+            return 0;
+    }
+    Py_INCREF(o);
+    return o;
+}
+
 template<> struct pyopencvVecConverter<Mat>
 {
     static bool to(PyObject* obj, std::vector<Mat>& value, const ArgInfo info)
     {
+        if( obj && PyArray_Check(obj) && pyopencv_to_mat_batch(obj, value, info) )
+            return true;
         return pyopencv_to_generic_vec(obj, value, info);
     }
 
     static PyObject* from(const std::vector<Mat>& value)
     {
+        PyObject* batch = pyopencv_from_mat_batch(value);
+        if( batch )
+            return batch;
         return pyopencv_from_generic_vec(value);
     }
 };
@@ -895,13 +1352,13 @@ bool pyopencv_to(PyObject *obj, TermCriteria& dst, const char *name)
     (void)name;
     if(!obj)
         return true;
-    return PyArg_ParseTuple(obj, "iid", &dst.type, &dst.maxCount, &dst.epsilon) > 0;
+    return pyopencv_unpack(obj, name, dst.type, dst.maxCount, dst.epsilon);
 }
 
 template<>
 PyObject* pyopencv_from(const TermCriteria& src)
 {
-    return Py_BuildValue("(iid)", src.type, src.maxCount, src.epsilon);
+    return pyopencv_pack(src.type, src.maxCount, src.epsilon);
 }
 
 template<>
@@ -910,13 +1367,13 @@ bool pyopencv_to(PyObject *obj, RotatedRect& dst, const char *name)
     (void)name;
     if(!obj)
         return true;
-    return PyArg_ParseTuple(obj, "(ff)(ff)f", &dst.center.x, &dst.center.y, &dst.size.width, &dst.size.height, &dst.angle) > 0;
+    return pyopencv_unpack(obj, name, dst.center, dst.size, dst.angle);
 }
 
 template<>
 PyObject* pyopencv_from(const RotatedRect& src)
 {
-    return Py_BuildValue("((ff)(ff)f)", src.center.x, src.center.y, src.size.width, src.size.height, src.angle);
+    return pyopencv_pack(src.center, src.size, src.angle);
 }
 
 template<>
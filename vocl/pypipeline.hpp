@@ -0,0 +1,911 @@
+// cv2.Pipeline(): a graph of OpenCV functions executed natively in one call.
+//
+// The graph is a sequence of stages. Each one is a function that may be deferred (see cv2.batch()),
+// with its Mat arguments bound to named buffers and the other arguments fixed:
+//
+//   p = cv2.Pipeline([("cvtColor", {"src": "frame", "dst": "gray"}, {"code": cv2.COLOR_BGR2GRAY}),
+//                     ("GaussianBlur", {"src": "gray", "dst": "smooth"}, {"ksize": (5, 5), "sigmaX": 1.5}),
+//                     ("Canny", {"image": "smooth", "edges": "edges"}, {"threshold1": 50, "threshold2": 150}),
+//                     ("dilate", {"src": "edges", "dst": "out"}, {"kernel": None})])
+//   out = p.run(frame)
+//
+// The constructor binds the arguments of the stages by the same code as Batch does and checks the
+// graph once: a buffer is written by one stage only, the buffers read before they are written are
+// the inputs (the arguments of run(), in the order of the first use) and the buffers nobody reads
+// afterwards are the outputs (the result of run()), unless they are listed. run() executes the whole
+// graph in one GIL-released region; the intermediate buffers are kept in the arena of the pipeline
+// between the runs, only the outputs are allocated anew, as numpy arrays.
+//
+// The first run with the given shapes and types of the inputs executes the stages one by one on the
+// whole frames, which tells the shapes and the types of all the buffers. The next runs fuse each
+// sequence of consecutive row-local stages (the per-element functions and the filters with a known
+// neighbourhood, see pyopencv_pipeline_halo()) into a group executed by row bands: the bands are
+// processed in parallel on the module thread pool, and within a band the stages of the group run
+// one after another on band-sized intermediates, which stay in the cache. Each stage computes its
+// band extended by the rows its consumers need around it (the halo) and reads its inputs through
+// ROIs, so the filters see the real neighbours and extrapolate the border only at the edges of the
+// frame, exactly as on the whole frame. The other stages (e.g. Canny, whose hysteresis is not local,
+// or resize) run on the whole frames between the groups.
+#ifndef __PYPIPELINE_HPP__
+#define __PYPIPELINE_HPP__
+
+// the working set of a band of a group, at most
+enum { PYOPENCV_PIPELINE_BAND_BYTES = 1 << 18 };
+
+struct pyopencv_PipelineArg
+{
+    int index;      // of the Mat argument in the call, see pyopencv_DeferredCall::mat()
+    int buffer;
+    int flags;      // PYOPENCV_ARG_IN, PYOPENCV_ARG_OUT
+};
+
+struct pyopencv_PipelineStage
+{
+    String func;
+    Ptr<pyopencv_DeferredCall> call;
+    std::vector<pyopencv_PipelineArg> args;
+    int halo;       // the rows around an output row it depends on, -1 if the stage can not run by bands
+    int group;      // the group of the stage in the plan, -1 - on the whole frames
+    int output;     // the buffer written, if the stage is in a group
+};
+
+struct pyopencv_PipelineBuffer
+{
+    String name;
+    int producer;   // the stage, -1 for an input
+    int lastUse;    // the last stage reading it
+    int output;     // the index in the results of run(), -1
+    Mat frame;      // the whole-frame intermediate, kept between the runs
+    // in the plan
+    int type;
+    std::vector<int> sizes;
+    bool local;     // lives in the bands of its group only
+};
+
+struct pyopencv_PipelineGroup
+{
+    int first, last;    // the stages
+    int rows, cols;
+    int halo;           // of the whole group, the bands are extended by at most that many rows
+    int bandRows;
+};
+
+// the part of the arena used by a worker running the bands of a group:
+// the copies of the calls of the stages and the band buffers
+struct pyopencv_PipelineSlot
+{
+    std::vector<Ptr<pyopencv_DeferredCall> > calls;
+    std::vector<Mat> bands;     // per buffer, allocated for the widest band
+};
+
+class pyopencv_Pipeline
+{
+public:
+    pyopencv_Pipeline() : bandRows(0), planned(false), failed(false) {}
+    ~pyopencv_Pipeline() { dropPlan(); }
+
+    // executes the graph on the inputs, writing to the outputs; the GIL is not held
+    bool execute(const std::vector<Mat>& inputs, std::vector<Mat>& outputs, pyopencv_ThreadPool* pool, int threads);
+
+    // runs the stages one by one on the whole frames, with the given copies of the calls (see
+    // cloneCalls()) and its own intermediates, so several threads may run it at once
+    bool executeWith(std::vector<Ptr<pyopencv_DeferredCall> >& calls, const std::vector<Mat>& inputs,
+                     std::vector<Mat>& outputs, String& error) const;
+    // waits for the running execute(), which binds the arrays to the calls
+    void cloneCalls(std::vector<Ptr<pyopencv_DeferredCall> >& calls);
+
+    void runBand(pyopencv_PipelineSlot& slot, int g, int band, std::vector<Mat>& view);
+    pyopencv_PipelineSlot* takeSlot(int g);
+    void putSlot(int g, pyopencv_PipelineSlot* slot);
+
+    std::vector<pyopencv_PipelineStage> stages;
+    std::vector<pyopencv_PipelineBuffer> buffers;
+    std::vector<int> inputs, outputs;   // the buffers
+    int bandRows;                       // 0 - by PYOPENCV_PIPELINE_BAND_BYTES
+
+    std::mutex runMutex;
+    String error;
+
+protected:
+    void runStage(int s, std::vector<Mat>& view);
+    void plan(const std::vector<Mat>& view);
+    void dropPlan();
+    bool fail(int s, const String& msg);
+
+    // the plan is made for the inputs of the signature
+    std::vector<int> signature;
+    bool planned;
+    std::vector<pyopencv_PipelineGroup> groups;
+    std::vector<std::vector<pyopencv_PipelineSlot*> > slots;   // the free ones, per group
+    std::mutex slotMutex;
+    std::atomic<bool> failed;
+};
+
+bool pyopencv_Pipeline::fail(int s, const String& msg)
+{
+    std::lock_guard<std::mutex> lock(slotMutex);
+    if( !failed.exchange(true) )
+        error = format("stage #%d (%s) of the pipeline failed: %s", s, stages[s].func.c_str(), msg.c_str());
+    return false;
+}
+
+void pyopencv_Pipeline::runStage(int s, std::vector<Mat>& view)
+{
+    pyopencv_PipelineStage& st = stages[s];
+    const char* name;
+    int flags;
+    size_t i;
+    for( i = 0; i < st.args.size(); i++ )
+        *st.call->mat(st.args[i].index, name, flags) = view[st.args[i].buffer];
+    st.call->execute();
+    // the storage allocated by the function is kept; the arguments do not hold the buffers
+    // between the runs
+    for( i = 0; i < st.args.size(); i++ )
+    {
+        Mat* m = st.call->mat(st.args[i].index, name, flags);
+        if( st.args[i].flags & PYOPENCV_ARG_OUT )
+        {
+            view[st.args[i].buffer] = *m;
+            if( buffers[st.args[i].buffer].output < 0 )
+                buffers[st.args[i].buffer].frame = *m;
+        }
+        m->release();
+    }
+    if( !st.call->error.empty() )
+        fail(s, st.call->error);
+}
+
+// Groups the consecutive stages that can run by bands, for the shapes of the buffers after
+// a whole-frame run: a stage writing one buffer of the same 2D size as its array inputs, without
+// other frame-sized arrays (they would not be cut into bands).
+void pyopencv_Pipeline::plan(const std::vector<Mat>& view)
+{
+    size_t b;
+    int s;
+    for( b = 0; b < buffers.size(); b++ )
+    {
+        const Mat& m = view[b];
+        buffers[b].type = m.type();
+        buffers[b].sizes.assign(m.size.p, m.size.p + m.dims);
+        buffers[b].local = false;
+    }
+
+    int n = (int)stages.size();
+    for( s = 0; s < n; s++ )
+    {
+        pyopencv_PipelineStage& st = stages[s];
+        st.group = -1;
+        st.output = -1;
+        if( st.halo < 0 )
+            continue;
+        bool ok = true;
+        for( size_t i = 0; i < st.args.size(); i++ )
+            if( st.args[i].flags & PYOPENCV_ARG_OUT )
+            {
+                ok = ok && st.output < 0;
+                st.output = st.args[i].buffer;
+            }
+        if( !ok || st.output < 0 || view[st.output].dims != 2 )
+        {
+            st.output = -1;
+            continue;
+        }
+        Size size = view[st.output].size();
+        for( size_t i = 0; i < st.args.size(); i++ )
+        {
+            const Mat& m = view[st.args[i].buffer];
+            ok = ok && m.dims == 2 && m.size() == size;
+            // the color conversions of the single- and two-channel sources (Bayer, YUV) are not per-pixel
+            if( st.func == "cvtColor" && st.args[i].flags == PYOPENCV_ARG_IN )
+                ok = ok && m.channels() >= 3;
+        }
+        const char* name;
+        int flags;
+        Mat* m;
+        for( int i = 0; ok && (m = st.call->mat(i, name, flags)) != 0; i++ )
+            ok = m->empty() || m->dims != 2 || m->size() != size;
+        if( !ok )
+            st.output = -1;
+    }
+
+    for( s = 0; s < n; )
+    {
+        if( stages[s].output < 0 )
+        {
+            s++;
+            continue;
+        }
+        pyopencv_PipelineGroup g;
+        g.first = s;
+        g.rows = view[stages[s].output].rows;
+        g.cols = view[stages[s].output].cols;
+        g.halo = 0;
+        while( s < n && stages[s].output >= 0 && view[stages[s].output].size() == Size(g.cols, g.rows) )
+            g.halo += stages[s++].halo;
+        g.last = s - 1;
+        if( g.last == g.first )
+            continue;
+
+        // the buffers used after the group or returned are written to the whole frames as well
+        size_t rowBytes = 0;
+        for( int k = g.first; k <= g.last; k++ )
+        {
+            pyopencv_PipelineBuffer& ob = buffers[stages[k].output];
+            ob.local = ob.output < 0 && ob.lastUse <= g.last;
+            if( ob.local )
+                ob.frame.release();
+            rowBytes += view[stages[k].output].cols*view[stages[k].output].elemSize();
+            stages[k].group = (int)groups.size();
+        }
+        g.bandRows = bandRows > 0 ? bandRows : (int)(PYOPENCV_PIPELINE_BAND_BYTES/std::max(rowBytes, (size_t)1));
+        g.bandRows = std::min(std::max(g.bandRows, std::max(4*g.halo, 8)), g.rows);
+        groups.push_back(g);
+    }
+    slots.assign(groups.size(), std::vector<pyopencv_PipelineSlot*>());
+    planned = true;
+}
+
+void pyopencv_Pipeline::dropPlan()
+{
+    for( size_t g = 0; g < slots.size(); g++ )
+        for( size_t i = 0; i < slots[g].size(); i++ )
+            delete slots[g][i];
+    slots.clear();
+    groups.clear();
+    for( size_t s = 0; s < stages.size(); s++ )
+        stages[s].group = -1;
+    planned = false;
+}
+
+pyopencv_PipelineSlot* pyopencv_Pipeline::takeSlot(int g)
+{
+    {
+        std::lock_guard<std::mutex> lock(slotMutex);
+        if( !slots[g].empty() )
+        {
+            pyopencv_PipelineSlot* slot = slots[g].back();
+            slots[g].pop_back();
+            return slot;
+        }
+    }
+    // the bound arrays of the calls are released after each stage, so the copies do not share them
+    pyopencv_PipelineSlot* slot = new pyopencv_PipelineSlot;
+    for( int s = groups[g].first; s <= groups[g].last; s++ )
+        slot->calls.push_back(stages[s].call->clone());
+    slot->bands.resize(buffers.size());
+    return slot;
+}
+
+void pyopencv_Pipeline::putSlot(int g, pyopencv_PipelineSlot* slot)
+{
+    std::lock_guard<std::mutex> lock(slotMutex);
+    slots[g].push_back(slot);
+}
+
+// Runs the stages of the group on the rows [y0, y1). First the rows each stage has to compute are
+// found, from the last stage to the first; then the stages run, each one writing its rows into the
+// band buffer of its output and reading the rows of its inputs through ROIs of their band buffers
+// or whole frames. The rows [y0, y1) of the buffers needed outside of the group are copied to
+// their frames.
+void pyopencv_Pipeline::runBand(pyopencv_PipelineSlot& slot, int g, int band, std::vector<Mat>& view)
+{
+    const pyopencv_PipelineGroup& gr = groups[g];
+    int y0 = band*gr.bandRows, y1 = std::min(y0 + gr.bandRows, gr.rows);
+    int s, n = gr.last - gr.first + 1;
+    std::vector<Range> need(n, Range(0, 0));    // the rows of the stage outputs
+    std::vector<int> stageOf(buffers.size(), -1);
+
+    for( s = n - 1; s >= 0; s-- )
+    {
+        const pyopencv_PipelineStage& st = stages[gr.first + s];
+        stageOf[st.output] = s;
+        if( !buffers[st.output].local )
+            need[s] = Range(std::min(need[s].empty() ? y0 : need[s].start, y0), std::max(need[s].end, y1));
+        if( need[s].empty() )
+            continue;
+        for( size_t i = 0; i < st.args.size(); i++ )
+        {
+            const pyopencv_PipelineBuffer& ib = buffers[st.args[i].buffer];
+            int p = ib.producer - gr.first;
+            if( !(st.args[i].flags & PYOPENCV_ARG_IN) || p < 0 || p >= s )
+                continue;
+            Range r(std::max(need[s].start - st.halo, 0), std::min(need[s].end + st.halo, gr.rows));
+            need[p] = need[p].empty() ? r : Range(std::min(need[p].start, r.start), std::max(need[p].end, r.end));
+        }
+    }
+
+    std::vector<Mat> bands(n);
+    for( s = 0; s < n && !failed.load(std::memory_order_relaxed); s++ )
+    {
+        if( need[s].empty() )
+            continue;
+        const pyopencv_PipelineStage& st = stages[gr.first + s];
+        pyopencv_DeferredCall& call = *slot.calls[s];
+        const Range& r = need[s];
+        const char* name;
+        int flags;
+        size_t i;
+        for( i = 0; i < st.args.size(); i++ )
+        {
+            int b = st.args[i].buffer;
+            Mat* m = call.mat(st.args[i].index, name, flags);
+            if( b == st.output )
+            {
+                // a header of exactly the band rows over the arena storage, so that the consumers
+                // do not see the rows beyond them as the neighbours
+                Mat& storage = slot.bands[b];
+                storage.create(gr.bandRows + 2*gr.halo, gr.cols, buffers[b].type);
+                *m = bands[s] = Mat(r.size(), gr.cols, buffers[b].type, storage.data, storage.step);
+            }
+            else if( stageOf[b] >= 0 && stageOf[b] < s )
+                *m = bands[stageOf[b]].rowRange(r.start - need[stageOf[b]].start, r.end - need[stageOf[b]].start);
+            else
+                *m = view[b].rowRange(r);
+        }
+        call.execute();
+        for( i = 0; i < st.args.size(); i++ )
+            call.mat(st.args[i].index, name, flags)->release();
+        if( !call.error.empty() )
+        {
+            fail(gr.first + s, call.error);
+            call.error.clear();
+            return;
+        }
+        if( !buffers[st.output].local )
+            bands[s].rowRange(y0 - r.start, y1 - r.start).copyTo(view[st.output].rowRange(y0, y1));
+    }
+}
+
+class pyopencv_PipelineBody : public ParallelLoopBody
+{
+public:
+    pyopencv_PipelineBody(pyopencv_Pipeline& _p, int _g, std::vector<Mat>& _view) : p(_p), g(_g), view(_view) {}
+
+    void operator()(const Range& range) const
+    {
+        pyopencv_PipelineSlot* slot = p.takeSlot(g);
+        for( int i = range.start; i < range.end; i++ )
+            p.runBand(*slot, g, i, view);
+        p.putSlot(g, slot);
+    }
+
+protected:
+    pyopencv_Pipeline& p;
+    int g;
+    std::vector<Mat>& view;
+};
+
+bool pyopencv_Pipeline::execute(const std::vector<Mat>& in, std::vector<Mat>& out, pyopencv_ThreadPool* pool, int threads)
+{
+    size_t b;
+    std::vector<int> sig;
+    for( b = 0; b < in.size(); b++ )
+    {
+        sig.push_back(in[b].type());
+        sig.push_back(in[b].dims);
+        sig.insert(sig.end(), in[b].size.p, in[b].size.p + in[b].dims);
+    }
+    if( sig != signature )
+    {
+        dropPlan();
+        signature = sig;
+    }
+    failed.store(false);
+    error.clear();
+
+    // the whole frames of the buffers in this run
+    std::vector<Mat> view(buffers.size());
+    for( b = 0; b < buffers.size(); b++ )
+        view[b] = buffers[b].frame;
+    for( b = 0; b < inputs.size(); b++ )
+        view[inputs[b]] = in[b];
+    for( b = 0; b < outputs.size(); b++ )
+    {
+        Mat& m = view[outputs[b]];
+        m = Mat();
+        m.allocator = &g_numpyAllocator;
+    }
+    // the group outputs are written by bands, so the frames are allocated beforehand
+    for( size_t g = 0; g < groups.size(); g++ )
+        for( int s = groups[g].first; s <= groups[g].last; s++ )
+        {
+            const pyopencv_PipelineBuffer& ob = buffers[stages[s].output];
+            if( !ob.local )
+                view[stages[s].output].create((int)ob.sizes.size(), &ob.sizes[0], ob.type);
+        }
+
+    for( int s = 0; s < (int)stages.size() && !failed.load(); )
+    {
+        int g = stages[s].group;
+        if( g < 0 )
+        {
+            runStage(s++, view);
+            continue;
+        }
+        int nbands = (groups[g].rows + groups[g].bandRows - 1)/groups[g].bandRows;
+        pool->parallel_for(Range(0, nbands), pyopencv_PipelineBody(*this, g, view), threads);
+        s = groups[g].last + 1;
+    }
+    if( failed.load() )
+        return false;
+
+    if( !planned )
+        plan(view);
+    for( b = 0; b < outputs.size(); b++ )
+        out[b] = view[outputs[b]];
+    return true;
+}
+
+void pyopencv_Pipeline::cloneCalls(std::vector<Ptr<pyopencv_DeferredCall> >& calls)
+{
+    std::lock_guard<std::mutex> lock(runMutex);
+    calls.clear();
+    for( size_t s = 0; s < stages.size(); s++ )
+        calls.push_back(stages[s].call->clone());
+}
+
+bool pyopencv_Pipeline::executeWith(std::vector<Ptr<pyopencv_DeferredCall> >& calls, const std::vector<Mat>& in,
+                                    std::vector<Mat>& out, String& err) const
+{
+    std::vector<Mat> view(buffers.size());
+    size_t b;
+    for( b = 0; b < inputs.size(); b++ )
+        view[inputs[b]] = in[b];
+    for( size_t s = 0; s < stages.size(); s++ )
+    {
+        const pyopencv_PipelineStage& st = stages[s];
+        pyopencv_DeferredCall& call = *calls[s];
+        const char* name;
+        int flags;
+        size_t i;
+        for( i = 0; i < st.args.size(); i++ )
+            *call.mat(st.args[i].index, name, flags) = view[st.args[i].buffer];
+        call.execute();
+        for( i = 0; i < st.args.size(); i++ )
+        {
+            Mat* m = call.mat(st.args[i].index, name, flags);
+            if( st.args[i].flags & PYOPENCV_ARG_OUT )
+                view[st.args[i].buffer] = *m;
+            m->release();
+        }
+        if( !call.error.empty() )
+        {
+            err = format("stage #%d (%s) of the pipeline failed: %s", (int)s, st.func.c_str(), call.error.c_str());
+            call.error.clear();
+            return false;
+        }
+    }
+    for( b = 0; b < outputs.size(); b++ )
+        out[b] = view[outputs[b]];
+    return true;
+}
+
+// a number among the parameters of a stage: params[key], or params[key][i] for a sequence
+static bool pyopencv_pipeline_param(PyObject* params, const char* key, int i, double& value)
+{
+    PyObject* o = params ? PyDict_GetItemString(params, key) : 0;
+    if( !o || o == Py_None )
+        return false;
+    PyObject* item = 0;
+    if( PyTuple_Check(o) || PyList_Check(o) )
+    {
+        o = item = PySequence_GetItem(o, i);
+        if( !o )
+        {
+            PyErr_Clear();
+            return false;
+        }
+    }
+    value = PyFloat_AsDouble(o);
+    Py_XDECREF(item);
+    if( PyErr_Occurred() )
+    {
+        PyErr_Clear();
+        return false;
+    }
+    return true;
+}
+
+// The rows around an output row that the stage reads, or -1 if it is not row-local or the
+// neighbourhood is not known. The values are upper bounds, whatever the anchors are.
+// A band is passed as a ROI of its input, so only the functions that read the rows of the
+// parent matrix around the ROI (the filter engine, copyMakeBorder() without BORDER_ISOLATED)
+// are listed; the ones that isolate their input or read back their own output are not.
+static int pyopencv_pipeline_halo(const String& func, PyObject* params)
+{
+    static const char* pointwise[] = { "cvtColor", "convertScaleAbs", "add", "subtract",
+        "multiply", "divide", "absdiff", "addWeighted", "scaleAdd", "bitwise_and", "bitwise_or",
+        "bitwise_xor", "bitwise_not", "min", "max", "inRange", "compare", "LUT", "magnitude", "phase",
+        "sqrt", "pow", "exp", "log", 0 };
+    double v;
+    if( pyopencv_pipeline_param(params, "borderType", 0, v) && ((int)v & BORDER_ISOLATED) )
+        return -1;
+    for( int i = 0; pointwise[i]; i++ )
+        if( func == pointwise[i] )
+            return 0;
+    // the automatic thresholds are computed over the whole image, each band would get its own
+    if( func == "threshold" )
+        return pyopencv_pipeline_param(params, "type", 0, v) && ((int)v & (THRESH_OTSU | THRESH_TRIANGLE)) ? -1 : 0;
+
+    if( func == "GaussianBlur" )
+    {
+        if( pyopencv_pipeline_param(params, "ksize", 1, v) && v > 0 )
+            return (int)v/2;
+        if( (pyopencv_pipeline_param(params, "sigmaY", 0, v) && v > 0) || pyopencv_pipeline_param(params, "sigmaX", 0, v) )
+            return cvCeil(v*4) + 1;
+        return -1;
+    }
+    // medianBlur() is not here: it replicates the border of its input instead of reading the rows
+    // of the parent matrix around a band, as the other filters do
+    if( func == "blur" || func == "boxFilter" || func == "sqrBoxFilter" )
+        return pyopencv_pipeline_param(params, "ksize", 1, v) ? (int)v : -1;
+    if( func == "Sobel" || func == "Scharr" || func == "Laplacian" )
+        return std::max(pyopencv_pipeline_param(params, "ksize", 0, v) ? (int)v/2 : func == "Sobel" ? 1 : 0, 1);
+    // adaptiveThreshold() is not here: it blurs with BORDER_REPLICATE|BORDER_ISOLATED
+    if( func == "bilateralFilter" )
+    {
+        if( pyopencv_pipeline_param(params, "d", 0, v) && v > 0 )
+            return (int)v/2;
+        return pyopencv_pipeline_param(params, "sigmaSpace", 0, v) ? cvRound(v*1.5) + 1 : -1;
+    }
+    if( func == "filter2D" || func == "dilate" || func == "erode" || func == "morphologyEx" )
+    {
+        // the opening, the closing and the hats run their second pass in place over the output
+        if( func == "morphologyEx" && !(pyopencv_pipeline_param(params, "op", 0, v) &&
+            ((int)v == MORPH_ERODE || (int)v == MORPH_DILATE || (int)v == MORPH_GRADIENT)) )
+            return -1;
+        // dilate() and erode() use 3x3 without the kernel
+        PyObject* kernel = params ? PyDict_GetItemString(params, "kernel") : 0;
+        int krows, kcols;
+        if( kernel && PyArray_Check(kernel) && PyArray_NDIM((PyArrayObject*)kernel) >= 1 )
+        {
+            krows = (int)PyArray_DIM((PyArrayObject*)kernel, 0);
+            kcols = PyArray_NDIM((PyArrayObject*)kernel) >= 2 ? (int)PyArray_DIM((PyArrayObject*)kernel, 1) : 1;
+        }
+        else if( (!kernel || kernel == Py_None) && func != "filter2D" )
+            krows = kcols = 3;
+        else
+            return -1;
+        // the large kernels are applied by blocks through the DFT, which pads each block itself
+        if( func == "filter2D" )
+            return krows*kcols < 50 ? krows : -1;
+        // the iterations are folded into one pass for the rectangular (default) kernel only,
+        // otherwise each one is applied in place over the output
+        int iterations = pyopencv_pipeline_param(params, "iterations", 0, v) ? std::max((int)v, 1) : 1;
+        if( iterations > 1 && kernel && kernel != Py_None )
+            return -1;
+        return krows*iterations;
+    }
+    return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// the Python object
+
+struct pyopencv_Pipeline_t
+{
+    PyObject_HEAD
+    pyopencv_Pipeline* p;
+};
+
+static PyObject* pyopencv_Pipeline_run(PyObject* self, PyObject* args)
+{
+    pyopencv_Pipeline& p = *((pyopencv_Pipeline_t*)self)->p;
+    Py_ssize_t i, n = PyTuple_Size(args);
+    if( n != (Py_ssize_t)p.inputs.size() )
+    {
+        String names;
+        for( size_t k = 0; k < p.inputs.size(); k++ )
+            names += (k ? ", " : "") + p.buffers[p.inputs[k]].name;
+        PyErr_Format(PyExc_TypeError, "run() takes %d arrays (%s), %d given", (int)p.inputs.size(), names.c_str(), (int)n);
+        return NULL;
+    }
+    std::vector<Mat> in(n), out(p.outputs.size());
+    for( i = 0; i < n; i++ )
+    {
+        const char* name = p.buffers[p.inputs[i]].name.c_str();
+        if( !pyopencv_to(PyTuple_GET_ITEM(args, i), in[i], ArgInfo(name, 0)) )
+            return NULL;
+        if( in[i].empty() )
+        {
+            PyErr_Format(PyExc_TypeError, "the input '%s' is empty", name);
+            return NULL;
+        }
+    }
+    pyopencv_ThreadPool* pool = pyopencv_ThreadPool::get();
+    if( !pool )
+        return NULL;
+    int threads = pyopencv_region_threads(pool);
+
+    bool ok;
+    String error;
+    {
+        // the lock is taken without the GIL, as the running pipeline may need the GIL for allocations
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("Pipeline.run"));
+        std::lock_guard<std::mutex> lock(p.runMutex);
+        ok = p.execute(in, out, pool, threads);
+        error = p.error;
+    }
+    if( !ok )
+    {
+        PyErr_SetString(opencv_error, error.c_str());
+        return NULL;
+    }
+    if( out.size() == 1 )
+        return pyopencv_from(out[0]);
+    PyObject* result = PyTuple_New((Py_ssize_t)out.size());
+    for( size_t k = 0; result && k < out.size(); k++ )
+    {
+        PyObject* item = pyopencv_from(out[k]);
+        if( !item )
+            Py_CLEAR(result);
+        else
+            PyTuple_SET_ITEM(result, (Py_ssize_t)k, item);
+    }
+    return result;
+}
+
+static PyObject* pyopencv_Pipeline_names(const pyopencv_Pipeline& p, const std::vector<int>& bufs)
+{
+    PyObject* result = PyList_New((Py_ssize_t)bufs.size());
+    for( size_t k = 0; result && k < bufs.size(); k++ )
+    {
+        PyObject* item = PyString_FromString(p.buffers[bufs[k]].name.c_str());
+        if( !item )
+            Py_CLEAR(result);
+        else
+            PyList_SET_ITEM(result, (Py_ssize_t)k, item);
+    }
+    return result;
+}
+
+static PyObject* pyopencv_Pipeline_inputs(PyObject* self, PyObject*)
+{
+    const pyopencv_Pipeline& p = *((pyopencv_Pipeline_t*)self)->p;
+    return pyopencv_Pipeline_names(p, p.inputs);
+}
+
+static PyObject* pyopencv_Pipeline_outputs(PyObject* self, PyObject*)
+{
+    const pyopencv_Pipeline& p = *((pyopencv_Pipeline_t*)self)->p;
+    return pyopencv_Pipeline_names(p, p.outputs);
+}
+
+static void pyopencv_Pipeline_dealloc(PyObject* self)
+{
+    delete ((pyopencv_Pipeline_t*)self)->p;
+    PyObject_Del(self);
+}
+
+static PyMethodDef pyopencv_Pipeline_methods[] =
+{
+    {"run", (PyCFunction)pyopencv_Pipeline_run, METH_VARARGS, "run(inputs...) -> outputs. Executes the pipeline on the input arrays, given in the order of inputs(), and returns the output arrays (a tuple if there are several)"},
+    {"inputs", (PyCFunction)pyopencv_Pipeline_inputs, METH_NOARGS, "inputs() -> names. The buffers read before they are written, the arguments of run()"},
+    {"outputs", (PyCFunction)pyopencv_Pipeline_outputs, METH_NOARGS, "outputs() -> names. The buffers returned by run()"},
+    {NULL, NULL}
+};
+
+static PyTypeObject pyopencv_Pipeline_Type =
+{
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    MODULESTR".Pipeline",
+    sizeof(pyopencv_Pipeline_t),
+};
+
+static void pyopencv_Pipeline_specials(void)
+{
+    pyopencv_Pipeline_Type.tp_dealloc = pyopencv_Pipeline_dealloc;
+    pyopencv_Pipeline_Type.tp_methods = pyopencv_Pipeline_methods;
+    pyopencv_Pipeline_Type.tp_flags = Py_TPFLAGS_DEFAULT;
+    pyopencv_Pipeline_Type.tp_doc = (char*)"Graph of OpenCV calls executed natively, see cv2.Pipeline()";
+}
+
+static int pyopencv_pipeline_buffer(pyopencv_Pipeline& p, const char* name)
+{
+    for( size_t b = 0; b < p.buffers.size(); b++ )
+        if( p.buffers[b].name == name )
+            return (int)b;
+    pyopencv_PipelineBuffer buf;
+    buf.name = name;
+    buf.producer = buf.lastUse = buf.output = -1;
+    buf.type = 0;
+    buf.local = false;
+    p.buffers.push_back(buf);
+    return (int)p.buffers.size() - 1;
+}
+
+// Binds one stage: the call is recorded by the Batch method of the function, with a placeholder
+// array for each argument bound to a buffer, and the arguments are then matched to the buffers
+static bool pyopencv_pipeline_add_stage(pyopencv_Pipeline& p, PyObject* batch, PyObject* item)
+{
+    int s = (int)p.stages.size();
+    const char* func = 0;
+    PyObject *arrays = 0, *params = 0;
+    PyObject* t = PySequence_Check(item) ? PySequence_Tuple(item) : 0;
+    if( !t || !PyArg_ParseTuple(t, "sO!|O!", &func, &PyDict_Type, &arrays, &PyDict_Type, &params) )
+    {
+        Py_XDECREF(t);
+        PyErr_Format(PyExc_TypeError, "stage #%d must be (function, {argument: buffer}[, {argument: value}])", s);
+        return false;
+    }
+    pyopencv_PipelineStage st;
+    st.func = func;
+    st.group = st.output = -1;
+    st.halo = pyopencv_pipeline_halo(st.func, params);
+
+    PyObject* kw = params ? PyDict_Copy(params) : PyDict_New();
+    PyObject* method = 0;
+    PyObject* r = 0;
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    npy_intp dims[] = { 1, 1 };
+    while( kw && PyDict_Next(arrays, &pos, &key, &value) )
+    {
+        PyObject* placeholder = 0;
+        if( !PyString_Check(value) )
+            PyErr_Format(PyExc_TypeError, "stage #%d (%s): the buffer names must be strings", s, func);
+        else if( PyDict_Contains(kw, key) )
+            PyErr_Format(PyExc_TypeError, "stage #%d (%s): an argument is both bound to a buffer and given a value", s, func);
+        else
+            placeholder = PyArray_ZEROS(2, dims, NPY_UINT8, 0);
+        if( !placeholder || PyDict_SetItem(kw, key, placeholder) < 0 )
+            Py_CLEAR(kw);
+        Py_XDECREF(placeholder);
+    }
+    if( kw && strcmp(func, "run") != 0 && strcmp(func, "clear") != 0 )
+    {
+        method = PyObject_GetAttrString(batch, func);
+        if( !method )
+            PyErr_Format(PyExc_ValueError, "stage #%d: %s() can not be a stage of a pipeline", s, func);
+    }
+    else if( kw )
+        PyErr_Format(PyExc_ValueError, "stage #%d: %s() can not be a stage of a pipeline", s, func);
+    PyObject* noargs = method ? PyTuple_New(0) : 0;
+    r = noargs ? PyObject_Call(method, noargs, kw) : 0;
+    Py_XDECREF(noargs);
+    Py_XDECREF(method);
+    Py_XDECREF(kw);
+    Py_XDECREF(r);
+    if( !r )
+    {
+        Py_DECREF(t);
+        return false;
+    }
+    std::vector<Ptr<pyopencv_DeferredCall> >& calls = ((pyopencv_Batch_t*)batch)->calls;
+    st.call = calls.back();
+    calls.pop_back();
+
+    // the arguments bound to the buffers; the buffers are in the SSA form: a stage reads the buffers
+    // written by the previous stages or given to run(), and writes the new ones, except for the
+    // input/output arguments, which modify a buffer written before in place
+    const char* name;
+    int flags;
+    Mat* m;
+    Py_ssize_t nbound = 0;
+    bool ok = true;
+    for( int i = 0; ok && (m = st.call->mat(i, name, flags)) != 0; i++ )
+    {
+        value = PyDict_GetItemString(arrays, name);
+        if( !value )
+            continue;
+        nbound++;
+        m->release();
+        const char* bname = PyString_AsString(value);
+        pyopencv_PipelineArg a;
+        a.index = i;
+        a.flags = flags;
+        a.buffer = pyopencv_pipeline_buffer(p, bname);
+        pyopencv_PipelineBuffer& buf = p.buffers[a.buffer];
+        bool known = buf.producer >= 0 || buf.lastUse >= 0;
+        if( flags == PYOPENCV_ARG_OUT && known )
+            ok = (PyErr_Format(PyExc_ValueError, "stage #%d (%s): the buffer '%s' is written twice or is an input", s, func, bname), false);
+        else if( flags == (PYOPENCV_ARG_IN | PYOPENCV_ARG_OUT) && buf.producer < 0 )
+            ok = (PyErr_Format(PyExc_ValueError, "stage #%d (%s): the buffer '%s' modified in place must be written by a previous stage", s, func, bname), false);
+        if( flags & PYOPENCV_ARG_IN )
+        {
+            if( !known )
+                p.inputs.push_back(a.buffer);
+            buf.lastUse = s;
+        }
+        if( flags == PYOPENCV_ARG_OUT )
+            buf.producer = s;
+        else if( flags & PYOPENCV_ARG_OUT )
+            st.halo = -1;
+        st.args.push_back(a);
+    }
+    if( ok && nbound != PyDict_Size(arrays) )
+    {
+        PyErr_Format(PyExc_ValueError, "stage #%d (%s): some of the buffers are bound to the arguments that are not arrays", s, func);
+        ok = false;
+    }
+    Py_DECREF(t);
+    if( ok )
+        p.stages.push_back(st);
+    return ok;
+}
+
+static PyObject* pycvPipeline(PyObject*, PyObject* args, PyObject* kw)
+{
+    const char* keywords[] = { "stages", "outputs", "band_rows", NULL };
+    PyObject *stages = 0, *outputs = 0;
+    int bandRows = 0;
+    if( !PyArg_ParseTupleAndKeywords(args, kw, "O|Oi:Pipeline", (char**)keywords, &stages, &outputs, &bandRows) )
+        return NULL;
+    static PyTypeReadyFlag ready;
+    if( !ready )
+    {
+        PyInitLock lock;
+        if( !(pyopencv_Pipeline_Type.tp_flags & Py_TPFLAGS_READY) )
+        {
+            pyopencv_Pipeline_specials();
+            if( PyType_Ready(&pyopencv_Pipeline_Type) < 0 )
+                return NULL;
+        }
+        ready.set(true);
+    }
+
+    PyObject* seq = PySequence_Fast(stages, "stages must be a sequence of (function, {argument: buffer}[, {argument: value}])");
+    if( !seq )
+        return NULL;
+    std::unique_ptr<pyopencv_Pipeline> p(new pyopencv_Pipeline);
+    p->bandRows = std::max(bandRows, 0);
+    PyObject* batch = pycvBatch(NULL, NULL);
+    bool ok = batch != 0;
+    for( Py_ssize_t i = 0; ok && i < PySequence_Fast_GET_SIZE(seq); i++ )
+        ok = pyopencv_pipeline_add_stage(*p, batch, PySequence_Fast_GET_ITEM(seq, i));
+    Py_XDECREF(batch);
+    Py_DECREF(seq);
+    if( !ok )
+        return NULL;
+
+    if( outputs && outputs != Py_None )
+    {
+        seq = PySequence_Fast(outputs, "outputs must be a sequence of buffer names");
+        for( Py_ssize_t i = 0; seq && i < PySequence_Fast_GET_SIZE(seq); i++ )
+        {
+            PyObject* o = PySequence_Fast_GET_ITEM(seq, i);
+            const char* name = PyString_Check(o) ? PyString_AsString(o) : 0;
+            int b = -1;
+            for( size_t k = 0; name && k < p->buffers.size(); k++ )
+                if( p->buffers[k].name == name && p->buffers[k].producer >= 0 )
+                    b = (int)k;
+            if( b < 0 || p->buffers[b].output >= 0 )
+            {
+                PyErr_Format(PyExc_ValueError, "the output #%d is not a buffer written by the pipeline, or is listed twice", (int)i);
+                Py_CLEAR(seq);
+                break;
+            }
+            p->buffers[b].output = (int)p->outputs.size();
+            p->outputs.push_back(b);
+        }
+        if( !seq )
+            return NULL;
+        Py_DECREF(seq);
+    }
+    else
+    {
+        // the buffers not read after they are written (or modified in place last)
+        for( size_t b = 0; b < p->buffers.size(); b++ )
+        {
+            pyopencv_PipelineBuffer& buf = p->buffers[b];
+            if( buf.producer >= 0 && buf.lastUse <= buf.producer )
+            {
+                buf.output = (int)p->outputs.size();
+                p->outputs.push_back((int)b);
+            }
+        }
+    }
+    if( p->outputs.empty() )
+    {
+        PyErr_SetString(PyExc_ValueError, "the pipeline has no outputs");
+        return NULL;
+    }
+
+    pyopencv_Pipeline_t* self = PyObject_NEW(pyopencv_Pipeline_t, &pyopencv_Pipeline_Type);
+    if( !self )
+        return NULL;
+    self->p = p.release();
+    return (PyObject*)self;
+}
+
+#endif // __PYPIPELINE_HPP__
@@ -0,0 +1,424 @@
+// Output arrays in POSIX shared memory, for passing frames between processes without copying.
+//
+// With cv2.setUseSharedMemory(True) the numpy arrays allocated by the module for the output
+// Mats (of at least min_bytes) are mapped from named POSIX shared memory segments instead of
+// the heap; they are ordinary numpy arrays otherwise. cv2.SharedFrame(array) makes a small
+// handle of such an array (an array elsewhere is copied to a new segment once). The handle
+// pickles as (name, shape, dtype, strides), so sending it through a multiprocessing queue or
+// pipe moves a few bytes, and the receiving process maps the same memory:
+//
+//   cv2.setUseSharedMemory(True)                      # the producer
+//   queue.put(cv2.SharedFrame(cv2.GaussianBlur(frame, (5, 5), 0)).transfer())
+//
+//   frame = queue.get().array                         # the consumer, no copy
+//
+// The segments are compatible with multiprocessing.shared_memory: SharedMemory(name) opens one,
+// and np.ndarray(shape, dtype, shm.buf, strides=strides) is the frame.
+//
+// The name of a segment is unlinked by the process owning it when it releases the memory, which
+// stays mapped in the other processes until they release it too. The process creating the array
+// owns the segment; a pickle of the handle only maps it, so the owner must keep the frame until
+// the receivers have opened it. transfer() hands the ownership over explicitly: the process
+// opening the next pickle of the handle owns the segment, so a frame can be passed along a chain
+// of stages while each sender drops its array right away. A handle should be pickled once after
+// transfer(); if it is never opened, the segment is left in /dev/shm.
+#ifndef __PYSHM_HPP__
+#define __PYSHM_HPP__
+
+#ifndef _WIN32
+
+#define PYOPENCV_HAVE_SHM
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string>
+
+struct pyopencv_ShmSegment
+{
+    std::string name;       // without the leading '/', as multiprocessing.shared_memory has it
+    void* data;
+    size_t size;
+    std::atomic<bool> owner;    // unlinks the name when released
+};
+
+static const char* const pyopencv_shm_capsule = "cv2.SharedMemory";
+
+static std::atomic<bool> pyopencv_shm_enabled(false);
+static std::atomic<size_t> pyopencv_shm_min_bytes(1 << 16);
+static std::atomic<unsigned> pyopencv_shm_counter(0);
+
+static void pyopencv_shm_unmap(pyopencv_ShmSegment* seg)
+{
+    munmap(seg->data, seg->size);
+    if( seg->owner.load() )
+        shm_unlink(("/" + seg->name).c_str());
+    delete seg;
+}
+
+static void pyopencv_shm_release(PyObject* capsule)
+{
+    pyopencv_shm_unmap((pyopencv_ShmSegment*)PyCapsule_GetPointer(capsule, pyopencv_shm_capsule));
+}
+
+// maps a segment, a new one if create; returns the capsule owning the mapping, or sets the error
+static PyObject* pyopencv_shm_map(const std::string& name0, size_t size, bool create)
+{
+    std::string name = name0;
+    int fd = -1;
+    while( fd < 0 )
+    {
+        if( create )
+        {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "cv2_%d_%u", (int)getpid(), pyopencv_shm_counter++);
+            name = buf;
+        }
+        fd = shm_open(("/" + name).c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+        // EEXIST: a segment left behind by a process with the same pid
+        if( fd < 0 && !(create && errno == EEXIST) )
+        {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, name.c_str());
+            return NULL;
+        }
+    }
+    // a mapping can not be empty
+    size = std::max(size, (size_t)1);
+    struct stat st;
+    bool ok;
+    if( create )
+    {
+        ok = ftruncate(fd, (off_t)size) == 0;
+#ifdef __linux__
+        // the pages are reserved now: a full /dev/shm fails here, and the allocation falls back
+        // to the heap, instead of SIGBUS on the first write into the mapping
+        int err = ok ? posix_fallocate(fd, 0, (off_t)size) : 0;
+        if( err != 0 && err != EINVAL && err != EOPNOTSUPP )
+        {
+            errno = err;
+            ok = false;
+        }
+#endif
+    }
+    else if( (ok = fstat(fd, &st) == 0) && (size_t)st.st_size < size )
+    {
+        close(fd);
+        PyErr_Format(PyExc_ValueError, "the shared memory segment '%s' is smaller than the frame", name.c_str());
+        return NULL;
+    }
+    else if( ok )
+        size = (size_t)st.st_size;
+    void* data = ok ? mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    int err = errno;
+    close(fd);
+    if( data == MAP_FAILED )
+    {
+        if( create )
+            shm_unlink(("/" + name).c_str());
+        errno = err;
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, name.c_str());
+        return NULL;
+    }
+    pyopencv_ShmSegment* seg = new pyopencv_ShmSegment;
+    seg->name = name;
+    seg->data = data;
+    seg->size = size;
+    seg->owner.store(create);
+    PyObject* capsule = PyCapsule_New(seg, pyopencv_shm_capsule, pyopencv_shm_release);
+    if( !capsule )
+        pyopencv_shm_unmap(seg);
+    return capsule;
+}
+
+// a numpy array over the mapping of the capsule, which becomes its base; the references to
+// the capsule and descr are stolen
+static PyObject* pyopencv_shm_array(PyObject* capsule, PyArray_Descr* descr, int dims, npy_intp* sizes, npy_intp* strides)
+{
+    pyopencv_ShmSegment* seg = (pyopencv_ShmSegment*)PyCapsule_GetPointer(capsule, pyopencv_shm_capsule);
+    PyObject* o = PyArray_NewFromDescr(&PyArray_Type, descr, dims, sizes, strides, seg->data, NPY_ARRAY_WRITEABLE, NULL);
+    if( !o )
+    {
+        Py_DECREF(capsule);
+        return NULL;
+    }
+    if( PyArray_SetBaseObject((PyArrayObject*)o, capsule) < 0 )
+    {
+        Py_DECREF(o);
+        return NULL;
+    }
+    return o;
+}
+
+// through the Python attribute, as the layout of PyArray_Descr differs between numpy 1.x and 2.x
+static size_t pyopencv_descr_itemsize(PyArray_Descr* descr)
+{
+    PyObject* o = PyObject_GetAttrString((PyObject*)descr, "itemsize");
+    size_t itemsize = o ? (size_t)PyInt_AsLong(o) : 0;
+    Py_XDECREF(o);
+    return itemsize;
+}
+
+// The arrays allocated by NumpyAllocator; in shared memory if enabled and large enough, with
+// a fallback to the heap if the segment can not be created
+static PyObject* pyopencv_new_array(int dims, npy_intp* sizes, int typenum)
+{
+    if( pyopencv_shm_enabled.load(std::memory_order_relaxed) )
+    {
+        PyArray_Descr* descr = PyArray_DescrFromType(typenum);
+        size_t nbytes = descr ? pyopencv_descr_itemsize(descr) : 0;
+        for( int i = 0; i < dims; i++ )
+            nbytes *= (size_t)sizes[i];
+        PyObject* capsule = nbytes >= pyopencv_shm_min_bytes.load(std::memory_order_relaxed) ? pyopencv_shm_map("", nbytes, true) : 0;
+        PyObject* o = capsule ? pyopencv_shm_array(capsule, descr, dims, sizes, 0) : (Py_XDECREF(descr), (PyObject*)0);
+        if( o )
+            return o;
+        PyErr_Clear();
+    }
+    return PyArray_SimpleNew(dims, sizes, typenum);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+// cv2.SharedFrame
+
+struct pyopencv_SharedFrame_t
+{
+    PyObject_HEAD
+    PyObject* array;
+    PyObject* capsule;      // the base of the array with the segment
+    bool transfer;          // the next pickle carries the ownership of the segment
+};
+
+// the segment of a shared memory array, if the array starts at the beginning of it
+static PyObject* pyopencv_shm_capsule_of(PyArrayObject* a)
+{
+    PyObject* base = (PyObject*)a;
+    while( base && PyArray_Check(base) )
+        base = PyArray_BASE((PyArrayObject*)base);
+    if( !base || !PyCapsule_IsValid(base, pyopencv_shm_capsule) )
+        return 0;
+    pyopencv_ShmSegment* seg = (pyopencv_ShmSegment*)PyCapsule_GetPointer(base, pyopencv_shm_capsule);
+    if( PyArray_DATA(a) != seg->data )
+        return 0;
+    for( int i = 0; i < PyArray_NDIM(a); i++ )
+        if( PyArray_STRIDE(a, i) < 0 )
+            return 0;
+    return base;
+}
+
+static PyTypeObject pyopencv_SharedFrame_Type =
+{
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    MODULESTR".SharedFrame",
+    sizeof(pyopencv_SharedFrame_t),
+};
+
+static bool pyopencv_SharedFrame_ready();
+
+// steals the reference to the array
+static PyObject* pyopencv_SharedFrame_new(PyObject* array, PyObject* capsule)
+{
+    if( !pyopencv_SharedFrame_ready() )
+    {
+        Py_DECREF(array);
+        return NULL;
+    }
+    pyopencv_SharedFrame_t* self = PyObject_NEW(pyopencv_SharedFrame_t, &pyopencv_SharedFrame_Type);
+    if( !self )
+    {
+        Py_DECREF(array);
+        return NULL;
+    }
+    self->array = array;
+    self->capsule = capsule;
+    self->transfer = false;
+    Py_INCREF(capsule);
+    return (PyObject*)self;
+}
+
+static PyObject* pyopencv_SharedFrame_reduce(PyObject* self, PyObject*)
+{
+    pyopencv_SharedFrame_t* f = (pyopencv_SharedFrame_t*)self;
+    PyArrayObject* a = (PyArrayObject*)f->array;
+    pyopencv_ShmSegment* seg = (pyopencv_ShmSegment*)PyCapsule_GetPointer(f->capsule, pyopencv_shm_capsule);
+    PyObject* module = PyImport_ImportModule(MODULESTR);
+    PyObject* open = module ? PyObject_GetAttrString(module, "_openSharedFrame") : 0;
+    PyObject* shape = PyObject_GetAttrString(f->array, "shape");
+    PyObject* strides = PyObject_GetAttrString(f->array, "strides");
+    PyObject* dtype = PyObject_GetAttrString((PyObject*)PyArray_DESCR(a), "str");
+    PyObject* r = open && shape && strides && dtype ?
+        Py_BuildValue("(O(sOOOi))", open, seg->name.c_str(), shape, dtype, strides, (int)f->transfer) : 0;
+    Py_XDECREF(module);
+    Py_XDECREF(open);
+    Py_XDECREF(shape);
+    Py_XDECREF(strides);
+    Py_XDECREF(dtype);
+    return r;
+}
+
+static PyObject* pyopencv_SharedFrame_transfer(PyObject* self, PyObject*)
+{
+    pyopencv_SharedFrame_t* f = (pyopencv_SharedFrame_t*)self;
+    pyopencv_ShmSegment* seg = (pyopencv_ShmSegment*)PyCapsule_GetPointer(f->capsule, pyopencv_shm_capsule);
+    if( !seg->owner.exchange(false) )
+    {
+        PyErr_SetString(PyExc_ValueError, "the process does not own the shared memory segment of the frame");
+        return NULL;
+    }
+    f->transfer = true;
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject* pyopencv_SharedFrame_array_method(PyObject* self, PyObject*, PyObject*)
+{
+    PyObject* a = ((pyopencv_SharedFrame_t*)self)->array;
+    Py_INCREF(a);
+    return a;
+}
+
+static PyObject* pyopencv_SharedFrame_get_array(PyObject* self, void*)
+{
+    return pyopencv_SharedFrame_array_method(self, NULL, NULL);
+}
+
+static PyObject* pyopencv_SharedFrame_get_name(PyObject* self, void*)
+{
+    pyopencv_SharedFrame_t* f = (pyopencv_SharedFrame_t*)self;
+    return PyString_FromString(((pyopencv_ShmSegment*)PyCapsule_GetPointer(f->capsule, pyopencv_shm_capsule))->name.c_str());
+}
+
+static void pyopencv_SharedFrame_dealloc(PyObject* self)
+{
+    Py_DECREF(((pyopencv_SharedFrame_t*)self)->array);
+    Py_DECREF(((pyopencv_SharedFrame_t*)self)->capsule);
+    PyObject_Del(self);
+}
+
+static PyMethodDef pyopencv_SharedFrame_methods[] =
+{
+    {"__reduce__", (PyCFunction)pyopencv_SharedFrame_reduce, METH_NOARGS, "Pickles the frame as its segment name, shape, dtype and strides, and the ownership if transferred"},
+    {"transfer", (PyCFunction)pyopencv_SharedFrame_transfer, METH_NOARGS, "transfer() -> self. Gives up the ownership of the segment: the process opening the next pickle of the handle owns it"},
+    {"__array__", (PyCFunction)pyopencv_SharedFrame_array_method, METH_VARARGS | METH_KEYWORDS, "The frame"},
+    {NULL, NULL}
+};
+
+static PyGetSetDef pyopencv_SharedFrame_getseters[] =
+{
+    {(char*)"array", pyopencv_SharedFrame_get_array, NULL, (char*)"The frame, a numpy array in the shared memory", NULL},
+    {(char*)"name", pyopencv_SharedFrame_get_name, NULL, (char*)"The name of the shared memory segment, as multiprocessing.shared_memory takes it", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static bool pyopencv_SharedFrame_ready()
+{
+    static PyTypeReadyFlag ready;
+    if( ready )
+        return true;
+    PyInitLock lock;
+    if( pyopencv_SharedFrame_Type.tp_flags & Py_TPFLAGS_READY )
+        return ready.set(true);
+    pyopencv_SharedFrame_Type.tp_dealloc = pyopencv_SharedFrame_dealloc;
+    pyopencv_SharedFrame_Type.tp_methods = pyopencv_SharedFrame_methods;
+    pyopencv_SharedFrame_Type.tp_getset = pyopencv_SharedFrame_getseters;
+    pyopencv_SharedFrame_Type.tp_flags = Py_TPFLAGS_DEFAULT;
+    pyopencv_SharedFrame_Type.tp_doc = (char*)"Handle of a frame in POSIX shared memory, pickled without the data, see cv2.SharedFrame()";
+    return ready.set(PyType_Ready(&pyopencv_SharedFrame_Type) == 0);
+}
+
+static PyObject* pycvSharedFrame(PyObject*, PyObject* args)
+{
+    PyObject* o;
+    if( !PyArg_ParseTuple(args, "O:SharedFrame", &o) )
+        return NULL;
+    PyArrayObject* a = (PyArrayObject*)PyArray_FROM_O(o);
+    if( !a )
+        return NULL;
+    PyObject* capsule = pyopencv_shm_capsule_of(a);
+    if( capsule )
+        return pyopencv_SharedFrame_new((PyObject*)a, capsule);
+
+    // a copy in a new segment
+    capsule = pyopencv_shm_map("", (size_t)PyArray_NBYTES(a), true);
+    PyArray_Descr* descr = PyArray_DESCR(a);
+    Py_INCREF(descr);
+    PyObject* copy = capsule ? pyopencv_shm_array(capsule, descr, PyArray_NDIM(a), PyArray_DIMS(a), 0) : (Py_DECREF(descr), (PyObject*)0);
+    if( copy && PyArray_CopyInto((PyArrayObject*)copy, a) < 0 )
+        Py_CLEAR(copy);
+    Py_DECREF(a);
+    return copy ? pyopencv_SharedFrame_new(copy, capsule) : NULL;
+}
+
+static PyObject* pycvOpenSharedFrame(PyObject*, PyObject* args)
+{
+    const char* name;
+    PyObject *shape, *dtype, *strides;
+    int owner = 0;
+    if( !PyArg_ParseTuple(args, "sOOO|i:_openSharedFrame", &name, &shape, &dtype, &strides, &owner) )
+        return NULL;
+    PyArray_Descr* descr = 0;
+    PyArray_Dims dims = { 0, 0 }, steps = { 0, 0 };
+    PyObject* r = 0;
+    if( PyArray_DescrConverter(dtype, &descr) && PyArray_IntpConverter(shape, &dims) &&
+        PyArray_IntpConverter(strides, &steps) )
+    {
+        // the extent of the frame, which must be within the segment
+        size_t size = pyopencv_descr_itemsize(descr);
+        bool ok = dims.len == steps.len;
+        for( int i = 0; ok && i < dims.len; i++ )
+        {
+            ok = dims.ptr[i] >= 0 && steps.ptr[i] >= 0;
+            if( ok && dims.ptr[i] > 0 )
+                size += (size_t)(dims.ptr[i] - 1)*(size_t)steps.ptr[i];
+        }
+        PyObject* capsule = 0;
+        if( !ok )
+            PyErr_SetString(PyExc_ValueError, "bad shape or strides of a shared frame");
+        else
+            capsule = pyopencv_shm_map(name, size, false);
+        PyObject* array = 0;
+        if( capsule )
+        {
+            ((pyopencv_ShmSegment*)PyCapsule_GetPointer(capsule, pyopencv_shm_capsule))->owner.store(owner != 0);
+            array = pyopencv_shm_array(capsule, descr, dims.len, dims.ptr, steps.ptr);
+            descr = 0;
+        }
+        if( array )
+            r = pyopencv_SharedFrame_new(array, capsule);
+    }
+    Py_XDECREF(descr);
+    if( dims.ptr )
+        PyDimMem_FREE(dims.ptr);
+    if( steps.ptr )
+        PyDimMem_FREE(steps.ptr);
+    return r;
+}
+
+static PyObject* pycvSetUseSharedMemory(PyObject*, PyObject* args, PyObject* kw)
+{
+    const char* keywords[] = { "flag", "min_bytes", NULL };
+    int flag;
+    Py_ssize_t minBytes = (Py_ssize_t)pyopencv_shm_min_bytes.load();
+    if( !PyArg_ParseTupleAndKeywords(args, kw, "i|n:setUseSharedMemory", (char**)keywords, &flag, &minBytes) )
+        return NULL;
+    pyopencv_shm_min_bytes.store((size_t)std::max(minBytes, (Py_ssize_t)0));
+    pyopencv_shm_enabled.store(flag != 0);
+    Py_RETURN_NONE;
+}
+
+static PyObject* pycvUseSharedMemory(PyObject*, PyObject*)
+{
+    return PyBool_FromLong(pyopencv_shm_enabled.load());
+}
+
+#else
+
+static PyObject* pyopencv_new_array(int dims, npy_intp* sizes, int typenum)
+{
+    return PyArray_SimpleNew(dims, sizes, typenum);
+}
+
+#endif
+
+#endif // __PYSHM_HPP__
@@ -0,0 +1,425 @@
+// Always-on telemetry of the generated wrappers.
+//
+// With PYOPENCV_ENABLE_TELEMETRY every wrapped function counts its calls, the Mat data
+// converted in and out and the call latency, in a log-bucketed histogram with 4 sub-buckets
+// per power of 2 (at most 19% relative error, from 1 ns to ~9 minutes). The counters are
+// sharded per thread: each thread only writes its own shard (plain loads and stores, no
+// atomic read-modify-write), allocated per function and padded to cache lines, and a reader
+// merges the shards. The shards of the finished threads are reused by the new ones, so the
+// counters are cumulative, as Prometheus expects.
+//
+// cv2.getTelemetry() returns a snapshot; cv2.startTelemetryDump(filename, interval) starts a
+// thread writing the snapshot in the Prometheus text format to a local file periodically
+// (for the node_exporter textfile collector, for example). Without PYOPENCV_ENABLE_TELEMETRY
+// the macros expand to nothing.
+#ifndef __PYTELEMETRY_HPP__
+#define __PYTELEMETRY_HPP__
+
+#ifdef PYOPENCV_ENABLE_TELEMETRY
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+enum
+{
+    PYOPENCV_TELEMETRY_MAX_FUNCS = 4096,
+    PYOPENCV_TELEMETRY_BUCKETS = 160,   // 4 per power of 2, up to 2^40 ns
+    PYOPENCV_TELEMETRY_CACHE_LINE = 64
+};
+
+// bucket of a latency: the values below 4 ns have their own buckets, the others
+// are split by the exponent and the 2 bits after the leading one
+static inline int pyopencv_telemetry_bucket(uint64_t ns)
+{
+    if( ns < 4 )
+        return (int)ns;
+    int e = 63;
+    while( !(ns >> e) )
+        e--;
+    int i = 4*(e - 1) + (int)((ns >> (e - 2)) & 3);
+    return std::min(i, (int)PYOPENCV_TELEMETRY_BUCKETS - 1);
+}
+
+static inline uint64_t pyopencv_telemetry_bucket_lower(int i)
+{
+    return i < 4 ? (uint64_t)i : (uint64_t)(4 + (i & 3)) << (i/4 - 1);
+}
+
+struct pyopencv_TelemetryCounters
+{
+    std::atomic<uint64_t> count, ns, bytesIn, bytesOut;
+    std::atomic<uint64_t> buckets[PYOPENCV_TELEMETRY_BUCKETS];
+};
+
+struct pyopencv_TelemetryShard
+{
+    std::atomic<pyopencv_TelemetryCounters*> funcs[PYOPENCV_TELEMETRY_MAX_FUNCS];
+};
+
+// the registry is never destroyed, as the dump thread may still read it at the process exit
+static std::mutex pyopencv_telemetry_mutex;
+static std::vector<pyopencv_TelemetryShard*>* pyopencv_telemetry_shards = 0;  // all of them
+static std::vector<pyopencv_TelemetryShard*>* pyopencv_telemetry_free = 0;    // of the finished threads
+static const char* pyopencv_telemetry_names[PYOPENCV_TELEMETRY_MAX_FUNCS];
+static std::atomic<int> pyopencv_telemetry_nfuncs(0);
+
+// zeroed memory aligned to the cache line, never freed
+static void* pyopencv_telemetry_alloc(size_t size)
+{
+    size = (size + PYOPENCV_TELEMETRY_CACHE_LINE - 1) & ~(size_t)(PYOPENCV_TELEMETRY_CACHE_LINE - 1);
+    char* p = (char*)calloc(1, size + PYOPENCV_TELEMETRY_CACHE_LINE);
+    if( !p )
+        return 0;
+    return p + PYOPENCV_TELEMETRY_CACHE_LINE - ((size_t)p & (PYOPENCV_TELEMETRY_CACHE_LINE - 1));
+}
+
+// the shard of the thread, given back to the registry when the thread ends
+struct pyopencv_TelemetryThread
+{
+    pyopencv_TelemetryThread() : shard(0) {}
+    ~pyopencv_TelemetryThread()
+    {
+        if( !shard )
+            return;
+        std::lock_guard<std::mutex> lock(pyopencv_telemetry_mutex);
+        pyopencv_telemetry_free->push_back(shard);
+    }
+
+    pyopencv_TelemetryShard* getShard()
+    {
+        if( shard )
+            return shard;
+        std::lock_guard<std::mutex> lock(pyopencv_telemetry_mutex);
+        if( !pyopencv_telemetry_shards )
+        {
+            pyopencv_telemetry_shards = new std::vector<pyopencv_TelemetryShard*>;
+            pyopencv_telemetry_free = new std::vector<pyopencv_TelemetryShard*>;
+        }
+        if( !pyopencv_telemetry_free->empty() )
+        {
+            shard = pyopencv_telemetry_free->back();
+            pyopencv_telemetry_free->pop_back();
+        }
+        else
+        {
+            shard = (pyopencv_TelemetryShard*)pyopencv_telemetry_alloc(sizeof(pyopencv_TelemetryShard));
+            if( shard )
+                pyopencv_telemetry_shards->push_back(shard);
+        }
+        return shard;
+    }
+
+    pyopencv_TelemetryShard* shard;
+};
+
+static thread_local pyopencv_TelemetryThread pyopencv_telemetry_thread;
+
+// a wrapped function; a static of the wrapper, registered on the first call
+struct pyopencv_TelemetryFunc
+{
+    pyopencv_TelemetryFunc(const char* name)
+    {
+        std::lock_guard<std::mutex> lock(pyopencv_telemetry_mutex);
+        index = pyopencv_telemetry_nfuncs.load();
+        if( index < PYOPENCV_TELEMETRY_MAX_FUNCS )
+        {
+            pyopencv_telemetry_names[index] = name;
+            pyopencv_telemetry_nfuncs.store(index + 1, std::memory_order_release);
+        }
+        else
+            index = -1;
+    }
+
+    int index;
+};
+
+// the only writer of the counters is the owner thread
+static inline void pyopencv_telemetry_bump(std::atomic<uint64_t>& v, uint64_t delta)
+{
+    v.store(v.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+class pyopencv_TelemetryCall
+{
+public:
+    pyopencv_TelemetryCall(const pyopencv_TelemetryFunc& f) : c(0), bytesIn(0), bytesOut(0)
+    {
+        pyopencv_TelemetryShard* shard = f.index >= 0 ? pyopencv_telemetry_thread.getShard() : 0;
+        if( !shard )
+            return;
+        c = shard->funcs[f.index].load(std::memory_order_relaxed);
+        if( !c )
+        {
+            c = (pyopencv_TelemetryCounters*)pyopencv_telemetry_alloc(sizeof(pyopencv_TelemetryCounters));
+            if( !c )
+                return;
+            shard->funcs[f.index].store(c, std::memory_order_release);
+        }
+        prev = current;
+        current = this;
+        t0 = std::chrono::steady_clock::now();
+    }
+
+    ~pyopencv_TelemetryCall()
+    {
+        if( !c )
+            return;
+        uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+        pyopencv_telemetry_bump(c->count, 1);
+        pyopencv_telemetry_bump(c->ns, ns);
+        pyopencv_telemetry_bump(c->bytesIn, bytesIn);
+        pyopencv_telemetry_bump(c->bytesOut, bytesOut);
+        pyopencv_telemetry_bump(c->buckets[pyopencv_telemetry_bucket(ns)], 1);
+        current = prev;
+    }
+
+    static void addBytes(bool out, size_t n)
+    {
+        pyopencv_TelemetryCall* call = current;
+        if( call )
+            (out ? call->bytesOut : call->bytesIn) += n;
+    }
+
+protected:
+    pyopencv_TelemetryCounters* c;
+    pyopencv_TelemetryCall* prev;
+    std::chrono::steady_clock::time_point t0;
+    size_t bytesIn, bytesOut;
+
+    static thread_local pyopencv_TelemetryCall* current;
+};
+
+thread_local pyopencv_TelemetryCall* pyopencv_TelemetryCall::current = 0;
+
+struct pyopencv_TelemetryTotals
+{
+    const char* name;
+    uint64_t count, ns, bytesIn, bytesOut;
+    uint64_t buckets[PYOPENCV_TELEMETRY_BUCKETS];
+};
+
+// merges the shards; the functions not called yet are skipped
+static void pyopencv_telemetry_snapshot(std::vector<pyopencv_TelemetryTotals>& totals)
+{
+    int i, j, nfuncs = pyopencv_telemetry_nfuncs.load(std::memory_order_acquire);
+    std::vector<pyopencv_TelemetryShard*> shards;
+    {
+        std::lock_guard<std::mutex> lock(pyopencv_telemetry_mutex);
+        if( pyopencv_telemetry_shards )
+            shards = *pyopencv_telemetry_shards;
+    }
+    totals.clear();
+    for( i = 0; i < nfuncs; i++ )
+    {
+        pyopencv_TelemetryTotals t;
+        memset(&t, 0, sizeof(t));
+        t.name = pyopencv_telemetry_names[i];
+        for( size_t k = 0; k < shards.size(); k++ )
+        {
+            const pyopencv_TelemetryCounters* c = shards[k]->funcs[i].load(std::memory_order_acquire);
+            if( !c )
+                continue;
+            t.count += c->count.load(std::memory_order_relaxed);
+            t.ns += c->ns.load(std::memory_order_relaxed);
+            t.bytesIn += c->bytesIn.load(std::memory_order_relaxed);
+            t.bytesOut += c->bytesOut.load(std::memory_order_relaxed);
+            for( j = 0; j < PYOPENCV_TELEMETRY_BUCKETS; j++ )
+                t.buckets[j] += c->buckets[j].load(std::memory_order_relaxed);
+        }
+        if( t.count > 0 )
+            totals.push_back(t);
+    }
+}
+
+// the Prometheus histogram has the cumulative buckets at the powers of 2 from 1 us (2^10 ns) to 2^36 ns
+static void pyopencv_telemetry_write_prometheus(FILE* f, const std::vector<pyopencv_TelemetryTotals>& totals)
+{
+    size_t i;
+    fprintf(f, "# HELP cv2_calls_total Calls of the wrapped function.\n# TYPE cv2_calls_total counter\n");
+    for( i = 0; i < totals.size(); i++ )
+        fprintf(f, "cv2_calls_total{function=\"%s\"} %llu\n", totals[i].name, (unsigned long long)totals[i].count);
+    fprintf(f, "# HELP cv2_bytes_in_total Mat data converted from the arguments.\n# TYPE cv2_bytes_in_total counter\n");
+    for( i = 0; i < totals.size(); i++ )
+        fprintf(f, "cv2_bytes_in_total{function=\"%s\"} %llu\n", totals[i].name, (unsigned long long)totals[i].bytesIn);
+    fprintf(f, "# HELP cv2_bytes_out_total Mat data converted to the results.\n# TYPE cv2_bytes_out_total counter\n");
+    for( i = 0; i < totals.size(); i++ )
+        fprintf(f, "cv2_bytes_out_total{function=\"%s\"} %llu\n", totals[i].name, (unsigned long long)totals[i].bytesOut);
+    fprintf(f, "# HELP cv2_call_duration_seconds Latency of the wrapped function.\n# TYPE cv2_call_duration_seconds histogram\n");
+    for( i = 0; i < totals.size(); i++ )
+    {
+        const pyopencv_TelemetryTotals& t = totals[i];
+        uint64_t cum = 0;
+        int j = 0;
+        for( int e = 10; e <= 36; e++ )
+        {
+            for( ; j < 4*(e - 1); j++ )
+                cum += t.buckets[j];
+            fprintf(f, "cv2_call_duration_seconds_bucket{function=\"%s\",le=\"%.9g\"} %llu\n", t.name, (double)((uint64_t)1 << e)*1e-9, (unsigned long long)cum);
+        }
+        fprintf(f, "cv2_call_duration_seconds_bucket{function=\"%s\",le=\"+Inf\"} %llu\n", t.name, (unsigned long long)t.count);
+        fprintf(f, "cv2_call_duration_seconds_sum{function=\"%s\"} %.9f\n", t.name, t.ns*1e-9);
+        fprintf(f, "cv2_call_duration_seconds_count{function=\"%s\"} %llu\n", t.name, (unsigned long long)t.count);
+    }
+}
+
+// written to a temporary file and renamed, so the collector never reads a partial file
+static bool pyopencv_telemetry_dump(const std::string& filename)
+{
+    std::vector<pyopencv_TelemetryTotals> totals;
+    pyopencv_telemetry_snapshot(totals);
+    std::string tmpname = filename + ".tmp";
+    FILE* f = fopen(tmpname.c_str(), "wt");
+    if( !f )
+        return false;
+    pyopencv_telemetry_write_prometheus(f, totals);
+    if( fclose(f) != 0 )
+        return false;
+#ifdef _WIN32
+    remove(filename.c_str());
+#endif
+    return rename(tmpname.c_str(), filename.c_str()) == 0;
+}
+
+// the periodic dump; the thread does not touch the Python objects, so it runs without the GIL
+class pyopencv_TelemetryDumper
+{
+public:
+    pyopencv_TelemetryDumper(const std::string& _filename, double _interval)
+        : filename(_filename), interval(_interval), stopped(false)
+    {
+        thread = std::thread(&pyopencv_TelemetryDumper::loop, this);
+    }
+
+    ~pyopencv_TelemetryDumper()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        cond.notify_all();
+        thread.join();
+        pyopencv_telemetry_dump(filename);
+    }
+
+protected:
+    void loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while( !cond.wait_for(lock, std::chrono::duration<double>(interval), [this]() { return stopped; }) )
+        {
+            lock.unlock();
+            pyopencv_telemetry_dump(filename);
+            lock.lock();
+        }
+    }
+
+    std::string filename;
+    double interval;
+    bool stopped;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread thread;
+};
+
+static pyopencv_TelemetryDumper* pyopencv_telemetry_dumper = 0;  // guarded by the GIL
+
+static PyObject* pycvStopTelemetryDump(PyObject*, PyObject*)
+{
+    pyopencv_TelemetryDumper* d = pyopencv_telemetry_dumper;
+    pyopencv_telemetry_dumper = 0;
+    if( d )
+    {
+        PyAllowThreads allowThreads;
+        delete d;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pyopencv_telemetry_shutdown_def =
+    {"_telemetryShutdown", pycvStopTelemetryDump, METH_NOARGS, "Stops the periodic telemetry dump, writing the last one"};
+
+static PyObject* pycvStartTelemetryDump(PyObject*, PyObject* args)
+{
+    const char* filename = 0;
+    double interval = 10;
+    if( !PyArg_ParseTuple(args, "s|d:startTelemetryDump", &filename, &interval) )
+        return NULL;
+    if( !(interval > 0) )
+    {
+        PyErr_SetString(PyExc_ValueError, "the interval must be positive");
+        return NULL;
+    }
+    if( !pyopencv_telemetry_dump(filename) )
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char*)filename);
+
+    static bool registered = false;
+    if( !registered )
+    {
+        // the thread is stopped before the interpreter (and the static objects) go away
+        PyObject* atexit = PyImport_ImportModule("atexit");
+        PyObject* hook = PyCFunction_New(&pyopencv_telemetry_shutdown_def, NULL);
+        PyObject* r = atexit && hook ? PyObject_CallMethod(atexit, (char*)"register", (char*)"(O)", hook) : 0;
+        Py_XDECREF(atexit);
+        Py_XDECREF(hook);
+        if( !r )
+            return NULL;
+        Py_DECREF(r);
+        registered = true;
+    }
+
+    PyObject* r = pycvStopTelemetryDump(NULL, NULL);
+    Py_XDECREF(r);
+    pyopencv_telemetry_dumper = new pyopencv_TelemetryDumper(filename, interval);
+    Py_RETURN_NONE;
+}
+
+static PyObject* pycvGetTelemetry(PyObject*, PyObject*)
+{
+    std::vector<pyopencv_TelemetryTotals> totals;
+    pyopencv_telemetry_snapshot(totals);
+    PyObject* result = PyDict_New();
+    for( size_t i = 0; result && i < totals.size(); i++ )
+    {
+        const pyopencv_TelemetryTotals& t = totals[i];
+        PyObject* hist = PyList_New(0);
+        for( int j = 0; hist && j < PYOPENCV_TELEMETRY_BUCKETS; j++ )
+        {
+            if( !t.buckets[j] )
+                continue;
+            PyObject* b = Py_BuildValue("(KKK)", (unsigned long long)pyopencv_telemetry_bucket_lower(j),
+                                        (unsigned long long)pyopencv_telemetry_bucket_lower(j + 1),
+                                        (unsigned long long)t.buckets[j]);
+            if( !b || PyList_Append(hist, b) < 0 )
+                Py_CLEAR(hist);
+            Py_XDECREF(b);
+        }
+        PyObject* item = hist ? Py_BuildValue("{s:K,s:K,s:K,s:K,s:N}", "count", (unsigned long long)t.count,
+                                              "total_ns", (unsigned long long)t.ns, "bytes_in", (unsigned long long)t.bytesIn,
+                                              "bytes_out", (unsigned long long)t.bytesOut, "histogram", hist) : 0;
+        if( !item || PyDict_SetItemString(result, t.name, item) < 0 )
+            Py_CLEAR(result);
+        Py_XDECREF(item);
+    }
+    return result;
+}
+
+#define PYOPENCV_TELEMETRY_FUNC(name) \
+    static pyopencv_TelemetryFunc pyopencv_telemetry_func(name); \
+    pyopencv_TelemetryCall pyopencv_telemetry_call(pyopencv_telemetry_func)
+#define PYOPENCV_TELEMETRY_BYTES(out, n) pyopencv_TelemetryCall::addBytes(out, n)
+
+#else
+
+#define PYOPENCV_TELEMETRY_FUNC(name)
+#define PYOPENCV_TELEMETRY_BYTES(out, n) (void)0
+
+#endif
+
+#endif // __PYTELEMETRY_HPP__
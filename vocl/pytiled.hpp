@@ -0,0 +1,274 @@
+// cv2.tiledApply(): a pipeline applied to an image too large for memory, tile by tile.
+//
+//   src = np.memmap("slide.raw", np.uint8, "r", shape=(100000, 100000, 3))
+//   dst = np.memmap("out.raw", np.uint8, "w+", shape=(100000, 100000))
+//   cv2.tiledApply(src, dst, [("cvtColor", {"src": "in", "dst": "gray"}, {"code": cv2.COLOR_BGR2GRAY}),
+//                             ("GaussianBlur", {"src": "gray", "dst": "out"}, {"ksize": (0, 0), "sigmaX": 8})],
+//                  halo=33)
+//
+// The op is a cv2.Pipeline() with one input and one output, or its list of stages; it must keep
+// the size of the image. The source is an array (np.memmap reads only the pages of the tiles) or
+// a callable source(x, y, width, height) -> array, for a tiled TIFF reader for example, with the
+// size of the image given. The sink is a writable array of the same size (np.memmap writes the
+// tiles back to the file), not overlapping the source with a halo, or a callable sink(x, y, tile).
+//
+// The image is cut into tiles, which are processed in parallel on the module thread pool with
+// the GIL released: each worker reads its tile extended by halo pixels on every side (within the
+// image), runs the op on it and writes the tile without the halo to the sink. With halo at least
+// the reach of the op (the sum of the kernel radii of the stages), the result is the same as of
+// the op on the whole image: the pixels of the halo are read from the neighbouring tiles, and the
+// border is extrapolated only at the edges of the image. The GIL is taken only around the calls
+// of the source and sink callables. At most threads tiles are in memory at once, with the
+// intermediates of the op.
+#ifndef __PYTILED_HPP__
+#define __PYTILED_HPP__
+
+struct pyopencv_TiledJob
+{
+    pyopencv_Pipeline* op;
+    Mat source, sink;                   // unless the callables
+    PyObject *sourceFunc, *sinkFunc;
+    Size size, tile;
+    int halo, tilesX;
+
+    std::atomic<bool> failed;
+    std::mutex errorMutex;
+    String error;
+    PyObject *excType, *excValue, *excTraceback;    // of a callable, with the GIL
+
+    bool fail(const String& msg)
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if( !failed.exchange(true) )
+            error = msg;
+        return false;
+    }
+
+    // keeps the first exception raised by a callable; with the GIL
+    bool failPython()
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if( !failed.exchange(true) )
+            PyErr_Fetch(&excType, &excValue, &excTraceback);
+        else
+            PyErr_Clear();
+        return false;
+    }
+
+    bool read(const Rect& r, Mat& m)
+    {
+        if( !sourceFunc )
+        {
+            m = source(r);
+            return true;
+        }
+        PyEnsureGIL gil(PYOPENCV_GIL_SITE("tiledApply source"));
+        PyObject* o = PyObject_CallFunction(sourceFunc, (char*)"iiii", r.x, r.y, r.width, r.height);
+        bool ok = o && pyopencv_to(o, m, ArgInfo("source tile", 0));
+        Py_XDECREF(o);
+        if( !ok )
+            return failPython();
+        if( m.rows != r.height || m.cols != r.width )
+            return fail(format("the source returned a %dx%d tile for %dx%d at (%d, %d)",
+                               m.cols, m.rows, r.width, r.height, r.x, r.y));
+        return true;
+    }
+
+    bool write(const Rect& r, const Mat& m)
+    {
+        if( !sinkFunc )
+        {
+            if( m.type() != sink.type() )
+                return fail("the type of the sink differs from the type of the op output");
+            Mat dst = sink(r);
+            m.copyTo(dst);
+            return true;
+        }
+        PyEnsureGIL gil(PYOPENCV_GIL_SITE("tiledApply sink"));
+        PyObject* tile = pyopencv_from(m);
+        PyObject* o = tile ? PyObject_CallFunction(sinkFunc, (char*)"iiO", r.x, r.y, tile) : 0;
+        Py_XDECREF(tile);
+        Py_XDECREF(o);
+        return o ? true : failPython();
+    }
+
+    void run(int t, std::vector<Ptr<pyopencv_DeferredCall> >& calls)
+    {
+        int tx = t % tilesX, ty = t / tilesX;
+        Rect r(tx*tile.width, ty*tile.height, 0, 0);
+        r.width = std::min(tile.width, size.width - r.x);
+        r.height = std::min(tile.height, size.height - r.y);
+        Rect ext(std::max(r.x - halo, 0), std::max(r.y - halo, 0), 0, 0);
+        ext.width = std::min(r.x + r.width + halo, size.width) - ext.x;
+        ext.height = std::min(r.y + r.height + halo, size.height) - ext.y;
+
+        std::vector<Mat> in(1), out(1);
+        String err;
+        if( !read(ext, in[0]) )
+            return;
+        if( !op->executeWith(calls, in, out, err) )
+        {
+            fail(err);
+            return;
+        }
+        if( out[0].rows != ext.height || out[0].cols != ext.width )
+        {
+            fail("the op must keep the size of the image");
+            return;
+        }
+        write(r, out[0](Rect(r.x - ext.x, r.y - ext.y, r.width, r.height)));
+    }
+};
+
+class pyopencv_TiledBody : public ParallelLoopBody
+{
+public:
+    pyopencv_TiledBody(pyopencv_TiledJob& _job) : job(_job) {}
+
+    void operator()(const Range& range) const
+    {
+        // the copies of the calls of the op for this thread
+        std::vector<Ptr<pyopencv_DeferredCall> > calls;
+        job.op->cloneCalls(calls);
+        for( int t = range.start; t < range.end && !job.failed.load(std::memory_order_relaxed); t++ )
+        {
+            try
+            {
+                job.run(t, calls);
+            }
+            catch(const std::exception& e)
+            {
+                job.fail(e.what());
+            }
+        }
+    }
+
+protected:
+    pyopencv_TiledJob& job;
+};
+
+static PyObject* pycvTiledApply(PyObject*, PyObject* args, PyObject* kw)
+{
+    const char* keywords[] = { "source", "sink", "op", "halo", "tile_size", "threads", "size", NULL };
+    PyObject *source, *sink, *op, *pytile = 0, *pysize = 0;
+    int halo, threads = 0;
+    if( !PyArg_ParseTupleAndKeywords(args, kw, "OOOi|OiO:tiledApply", (char**)keywords,
+                                     &source, &sink, &op, &halo, &pytile, &threads, &pysize) )
+        return NULL;
+
+    pyopencv_TiledJob job;
+    job.sourceFunc = PyCallable_Check(source) ? source : 0;
+    job.sinkFunc = PyCallable_Check(sink) ? sink : 0;
+    job.tile = Size(1024, 1024);
+    job.halo = halo;
+    job.failed.store(false);
+    job.excType = job.excValue = job.excTraceback = 0;
+    if( halo < 0 )
+    {
+        PyErr_SetString(PyExc_ValueError, "halo must not be negative");
+        return NULL;
+    }
+    if( pytile && !pyopencv_to(pytile, job.tile, ArgInfo("tile_size", 0)) )
+        return NULL;
+    if( job.tile.width <= 0 || job.tile.height <= 0 )
+    {
+        PyErr_SetString(PyExc_ValueError, "tile_size must be positive");
+        return NULL;
+    }
+    if( job.sourceFunc )
+    {
+        if( !pysize || !pyopencv_to(pysize, job.size, ArgInfo("size", 0)) || job.size.width <= 0 || job.size.height <= 0 )
+        {
+            if( !PyErr_Occurred() )
+                PyErr_SetString(PyExc_TypeError, "the size of the image is needed with a callable source");
+            return NULL;
+        }
+    }
+    else
+    {
+        if( !pyopencv_to(source, job.source, ArgInfo("source", 0)) )
+            return NULL;
+        if( job.source.dims != 2 || job.source.empty() )
+        {
+            PyErr_SetString(PyExc_TypeError, "the source must be a 2D image");
+            return NULL;
+        }
+        job.size = job.source.size();
+    }
+    // the sink is written in place, so it can not be converted with a copy
+    if( !job.sinkFunc )
+    {
+        if( PyArray_Check(sink) && !PyArray_ISWRITEABLE((PyArrayObject*)sink) )
+        {
+            PyErr_SetString(PyExc_ValueError, "the sink array is read-only");
+            return NULL;
+        }
+        if( !pyopencv_to(sink, job.sink, ArgInfo("sink", 1)) )
+            return NULL;
+        if( job.sink.dims != 2 || job.sink.size() != job.size || job.sink.data == 0 )
+        {
+            PyErr_SetString(PyExc_TypeError, "the sink must be an array of the size of the source");
+            return NULL;
+        }
+        // the halo of a tile would be read after a neighbouring tile is written over it
+        if( halo > 0 && !job.sourceFunc &&
+            job.sink.datastart < job.source.dataend && job.source.datastart < job.sink.dataend )
+        {
+            PyErr_SetString(PyExc_ValueError, "the sink must not overlap the source when halo > 0");
+            return NULL;
+        }
+    }
+
+    // the op, as a pipeline
+    PyObject* pipeline;
+    if( PyObject_TypeCheck(op, &pyopencv_Pipeline_Type) )
+    {
+        pipeline = op;
+        Py_INCREF(pipeline);
+    }
+    else
+    {
+        PyObject* a = Py_BuildValue("(O)", op);
+        pipeline = a ? pycvPipeline(NULL, a, NULL) : 0;
+        Py_XDECREF(a);
+        if( !pipeline )
+            return NULL;
+    }
+    job.op = ((pyopencv_Pipeline_t*)pipeline)->p;
+    if( job.op->inputs.size() != 1 || job.op->outputs.size() != 1 )
+    {
+        Py_DECREF(pipeline);
+        PyErr_SetString(PyExc_ValueError, "the op must have one input and one output");
+        return NULL;
+    }
+
+    pyopencv_ThreadPool* pool = pyopencv_ThreadPool::get();
+    if( !pool )
+    {
+        Py_DECREF(pipeline);
+        return NULL;
+    }
+    if( threads <= 0 )
+        threads = pyopencv_region_threads(pool);
+    job.tilesX = (job.size.width + job.tile.width - 1)/job.tile.width;
+    int ntiles = job.tilesX*((job.size.height + job.tile.height - 1)/job.tile.height);
+    {
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("tiledApply"));
+        pool->parallel_for(Range(0, ntiles), pyopencv_TiledBody(job), threads);
+    }
+    Py_DECREF(pipeline);
+
+    if( job.excType )
+    {
+        PyErr_Restore(job.excType, job.excValue, job.excTraceback);
+        return NULL;
+    }
+    if( job.failed.load() )
+    {
+        PyErr_SetString(opencv_error, job.error.c_str());
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+#endif // __PYTILED_HPP__
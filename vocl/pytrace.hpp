@@ -0,0 +1,361 @@
+// Chrome trace instrumentation of the generated wrappers.
+//
+// With PYOPENCV_ENABLE_TRACE every wrapped call is split into phases: argument parsing,
+// input conversion, the OpenCV call itself, re-acquiring the GIL after it and the
+// conversion of the results, plus the output arrays allocated by NumpyAllocator during
+// the call. When the capture is started (cv2.startTrace()) the phases and the whole calls
+// are recorded, with the function name and the shapes of the Mat arguments, into a ring
+// buffer of the calling thread; cv2.dumpTrace() writes them as a Chrome trace JSON file
+// (chrome://tracing, ui.perfetto.dev). Without PYOPENCV_ENABLE_TRACE the macros below
+// expand to nothing, and while the capture is stopped a call only checks a flag.
+#ifndef __PYTRACE_HPP__
+#define __PYTRACE_HPP__
+
+enum
+{
+    PYOPENCV_TRACE_PARSE,        // binding the arguments, choosing the overload
+    PYOPENCV_TRACE_CONVERT_IN,   // pyopencv_to() of the arguments
+    PYOPENCV_TRACE_KERNEL,       // the wrapped function
+    PYOPENCV_TRACE_GIL,          // re-acquiring the GIL after the call
+    PYOPENCV_TRACE_ALLOC,        // output arrays allocated by NumpyAllocator
+    PYOPENCV_TRACE_CONVERT_OUT,  // pyopencv_from() of the results
+    PYOPENCV_TRACE_CALL          // the whole call
+};
+
+#ifdef PYOPENCV_ENABLE_TRACE
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <stdio.h>
+
+static const char* pyopencv_trace_names[] = { "parse", "convert_in", "kernel", "gil", "alloc", "convert_out" };
+
+struct pyopencv_TraceEvent
+{
+    const char* func;
+    int phase;
+    int64_t t0, t1;   // ns since the capture was started
+    char shapes[64];  // the Mat arguments of PYOPENCV_TRACE_CALL events
+};
+
+// the events of one thread; the buffer of a finished thread is kept while it holds the events
+// of the current capture, so the trace has the finished threads too
+struct pyopencv_TraceBuffer
+{
+    pyopencv_TraceBuffer() : head(0), count(0), generation(-1), tid(0), finished(false) {}
+
+    std::mutex mutex;  // taken by the owner thread per event and by dumpTrace(), so it is not contended
+    std::vector<pyopencv_TraceEvent> events;
+    size_t head, count;
+    int generation, tid;
+    bool finished;     // the thread has ended; guarded by pyopencv_trace_mutex
+};
+
+static std::atomic<bool> pyopencv_trace_on(false);
+static std::mutex pyopencv_trace_mutex;  // guards the fields below
+static std::vector<std::shared_ptr<pyopencv_TraceBuffer> > pyopencv_trace_buffers;
+static int pyopencv_trace_ntids = 0;
+static std::atomic<int> pyopencv_trace_generation(0);
+static size_t pyopencv_trace_capacity = 1 << 16;
+// the steady clock time of the start, in ns; read by the threads recording the events
+static std::atomic<int64_t> pyopencv_trace_start(0);
+
+static inline int64_t pyopencv_trace_clock()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline int64_t pyopencv_trace_now()
+{
+    return pyopencv_trace_clock() - pyopencv_trace_start.load(std::memory_order_relaxed);
+}
+
+// drops the buffers of the finished threads holding no events of the current capture;
+// called under pyopencv_trace_mutex
+static void pyopencv_trace_drop_finished()
+{
+    int generation = pyopencv_trace_generation.load();
+    size_t i, j = 0;
+    for( i = 0; i < pyopencv_trace_buffers.size(); i++ )
+        if( !pyopencv_trace_buffers[i]->finished || pyopencv_trace_buffers[i]->generation == generation )
+            pyopencv_trace_buffers[j++] = pyopencv_trace_buffers[i];
+    pyopencv_trace_buffers.resize(j);
+}
+
+// the buffer of the thread, given back to the registry when the thread ends
+struct pyopencv_TraceThread
+{
+    pyopencv_TraceThread() : buffer(0) {}
+    ~pyopencv_TraceThread()
+    {
+        if( !buffer )
+            return;
+        std::lock_guard<std::mutex> lock(pyopencv_trace_mutex);
+        buffer->finished = true;
+        pyopencv_trace_drop_finished();
+    }
+
+    pyopencv_TraceBuffer* buffer;
+};
+
+static thread_local pyopencv_TraceThread pyopencv_trace_thread;
+
+static void pyopencv_trace_record(const char* func, int phase, int64_t t0, int64_t t1, const char* shapes)
+{
+    pyopencv_TraceBuffer* b = pyopencv_trace_thread.buffer;
+    int generation = pyopencv_trace_generation.load(std::memory_order_acquire);
+    if( !b || b->generation != generation )
+    {
+        std::lock_guard<std::mutex> lock(pyopencv_trace_mutex);
+        if( !b )
+        {
+            std::shared_ptr<pyopencv_TraceBuffer> nb = std::make_shared<pyopencv_TraceBuffer>();
+            nb->tid = ++pyopencv_trace_ntids;
+            pyopencv_trace_buffers.push_back(nb);
+            b = pyopencv_trace_thread.buffer = nb.get();
+        }
+        std::lock_guard<std::mutex> block(b->mutex);
+        b->events.assign(pyopencv_trace_capacity, pyopencv_TraceEvent());
+        b->head = b->count = 0;
+        b->generation = generation;
+    }
+
+    std::lock_guard<std::mutex> lock(b->mutex);
+    // freed by startTrace() after the generation was checked: the event is of the old capture
+    if( b->events.empty() )
+        return;
+    pyopencv_TraceEvent& e = b->events[b->head];
+    e.func = func;
+    e.phase = phase;
+    e.t0 = t0;
+    e.t1 = t1;
+    if( shapes )
+    {
+        strncpy(e.shapes, shapes, sizeof(e.shapes) - 1);
+        e.shapes[sizeof(e.shapes) - 1] = '\0';
+    }
+    else
+        e.shapes[0] = '\0';
+    b->head = b->head + 1 < b->events.size() ? b->head + 1 : 0;
+    b->count = std::min(b->count + 1, b->events.size());
+}
+
+// The wrapped call being traced on this thread. The phases follow each other: each mark
+// ends the current phase and starts the next one, the destructor ends the last one. The
+// phases only go forward, so ERRWRAP2 used by the converters (e.g. the copy made by
+// pyopencv_from(Mat)) does not start another kernel phase.
+class pyopencv_TraceCall
+{
+public:
+    pyopencv_TraceCall(const char* _func) : active(pyopencv_trace_on.load(std::memory_order_relaxed))
+    {
+        if( !active )
+            return;
+        func = _func;
+        prev = current;
+        current = this;
+        phase = PYOPENCV_TRACE_PARSE;
+        t0 = t = pyopencv_trace_now();
+        shapes[0] = '\0';
+        nshapes = 0;
+    }
+
+    ~pyopencv_TraceCall()
+    {
+        if( !active )
+            return;
+        int64_t t1 = pyopencv_trace_now();
+        pyopencv_trace_record(func, phase, t, t1, 0);
+        pyopencv_trace_record(func, PYOPENCV_TRACE_CALL, t0, t1, shapes);
+        current = prev;
+    }
+
+    static bool mark(int next)
+    {
+        pyopencv_TraceCall* c = current;
+        if( c && c->phase < next )
+        {
+            int64_t t1 = pyopencv_trace_now();
+            pyopencv_trace_record(c->func, c->phase, c->t, t1, 0);
+            c->phase = next;
+            c->t = t1;
+        }
+        return true;
+    }
+
+    static const char* currentFunc()
+    {
+        return current ? current->func : "";
+    }
+
+    static void addShape(const char* name, const cv::Mat& m)
+    {
+        pyopencv_TraceCall* c = current;
+        if( !c || c->nshapes >= sizeof(c->shapes) - 1 )
+            return;
+        static const char* depths[] = { "u8", "s8", "u16", "s16", "s32", "f32", "f64", "?" };
+        char buf[64];
+        int n = snprintf(buf, sizeof(buf), "%s%s=", c->nshapes > 0 ? " " : "", name);
+        for( int i = 0; i < m.dims && n < (int)sizeof(buf); i++ )
+            n += snprintf(buf + n, sizeof(buf) - n, i > 0 ? "x%d" : "%d", m.size[i]);
+        if( n < (int)sizeof(buf) && m.channels() > 1 )
+            n += snprintf(buf + n, sizeof(buf) - n, "x%d", m.channels());
+        if( n < (int)sizeof(buf) )
+            snprintf(buf + n, sizeof(buf) - n, ":%s", depths[m.depth()]);
+        c->nshapes += (size_t)snprintf(c->shapes + c->nshapes, sizeof(c->shapes) - c->nshapes, "%s", buf);
+        c->nshapes = std::min(c->nshapes, sizeof(c->shapes) - 1);
+    }
+
+protected:
+    bool active;
+    const char* func;
+    pyopencv_TraceCall* prev;
+    int phase;
+    int64_t t0, t;
+    char shapes[64];
+    size_t nshapes;
+
+    static thread_local pyopencv_TraceCall* current;
+};
+
+thread_local pyopencv_TraceCall* pyopencv_TraceCall::current = 0;
+
+// a span nested in the current call, not one of its sequential phases
+class pyopencv_TraceSpan
+{
+public:
+    pyopencv_TraceSpan(int _phase)
+        : active(pyopencv_trace_on.load(std::memory_order_relaxed)), func(0), phase(_phase)
+    {
+        if( !active )
+            return;
+        func = pyopencv_TraceCall::currentFunc();
+        t0 = pyopencv_trace_now();
+    }
+    ~pyopencv_TraceSpan()
+    {
+        if( active )
+            pyopencv_trace_record(func, phase, t0, pyopencv_trace_now(), 0);
+    }
+
+protected:
+    bool active;
+    const char* func;
+    int phase;
+    int64_t t0;
+};
+
+static PyObject* pycvStartTrace(PyObject*, PyObject* args)
+{
+    Py_ssize_t capacity = 1 << 16;
+    if( !PyArg_ParseTuple(args, "|n:startTrace", &capacity) )
+        return NULL;
+    if( capacity <= 0 )
+    {
+        PyErr_SetString(PyExc_ValueError, "the number of events per thread must be positive");
+        return NULL;
+    }
+    {
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("startTrace"));
+        std::lock_guard<std::mutex> lock(pyopencv_trace_mutex);
+        pyopencv_trace_capacity = (size_t)capacity;
+        if( !pyopencv_trace_on.load() )
+            pyopencv_trace_start.store(pyopencv_trace_clock(), std::memory_order_relaxed);
+        pyopencv_trace_generation.fetch_add(1, std::memory_order_release);
+        // the events of the previous capture are dropped: the buffers of the finished threads
+        // are freed, the others are emptied and reallocated by their threads on the next event
+        pyopencv_trace_drop_finished();
+        for( size_t i = 0; i < pyopencv_trace_buffers.size(); i++ )
+        {
+            pyopencv_TraceBuffer& b = *pyopencv_trace_buffers[i];
+            std::lock_guard<std::mutex> block(b.mutex);
+            std::vector<pyopencv_TraceEvent>().swap(b.events);
+            b.head = b.count = 0;
+        }
+    }
+    pyopencv_trace_on.store(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject* pycvStopTrace(PyObject*, PyObject*)
+{
+    pyopencv_trace_on.store(false);
+    Py_RETURN_NONE;
+}
+
+static void pyopencv_trace_write_event(FILE* f, const pyopencv_TraceEvent& e, int tid, bool& first)
+{
+    bool call = e.phase == PYOPENCV_TRACE_CALL;
+    fprintf(f, "%s\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {",
+            first ? "" : ",", call ? e.func : pyopencv_trace_names[e.phase], call ? "call" : "phase",
+            e.t0*1e-3, (e.t1 - e.t0)*1e-3, tid);
+    if( call )
+        fprintf(f, "\"shapes\": \"%s\"}}", e.shapes);
+    else
+        fprintf(f, "\"func\": \"%s\"}}", e.func);
+    first = false;
+}
+
+static PyObject* pycvDumpTrace(PyObject*, PyObject* args)
+{
+    const char* filename = 0;
+    if( !PyArg_ParseTuple(args, "s:dumpTrace", &filename) )
+        return NULL;
+    FILE* f = fopen(filename, "wt");
+    if( !f )
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+
+    size_t nevents = 0;
+    {
+        PyAllowThreads allowThreads(PYOPENCV_GIL_SITE("dumpTrace"));
+        std::vector<std::shared_ptr<pyopencv_TraceBuffer> > buffers;
+        int generation;
+        {
+            std::lock_guard<std::mutex> lock(pyopencv_trace_mutex);
+            buffers = pyopencv_trace_buffers;
+            generation = pyopencv_trace_generation.load();
+        }
+        bool first = true;
+        fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+        for( size_t i = 0; i < buffers.size(); i++ )
+        {
+            pyopencv_TraceBuffer& b = *buffers[i];
+            std::lock_guard<std::mutex> lock(b.mutex);
+            if( b.generation != generation || b.count == 0 )
+                continue;
+            fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                    first ? "" : ",", b.tid, b.tid);
+            first = false;
+            size_t start = (b.head + b.events.size() - b.count) % b.events.size();
+            for( size_t j = 0; j < b.count; j++ )
+                pyopencv_trace_write_event(f, b.events[(start + j) % b.events.size()], b.tid, first);
+            nevents += b.count;
+        }
+        fprintf(f, "\n]}\n");
+    }
+    if( fclose(f) != 0 )
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, filename);
+    return PyLong_FromSize_t(nevents);
+}
+
+#define PYOPENCV_TRACE_FUNC(name) pyopencv_TraceCall pyopencv_trace_call(name)
+#define PYOPENCV_TRACE_MARK(phase) pyopencv_TraceCall::mark(phase)
+#define PYOPENCV_TRACE_PHASE(phase) (void)pyopencv_TraceCall::mark(phase)
+#define PYOPENCV_TRACE_SPAN(phase) pyopencv_TraceSpan pyopencv_trace_span(phase)
+#define PYOPENCV_TRACE_SHAPE(name, m) pyopencv_TraceCall::addShape(name, m)
+
+#else
+
+#define PYOPENCV_TRACE_FUNC(name)
+#define PYOPENCV_TRACE_MARK(phase) true
+#define PYOPENCV_TRACE_PHASE(phase) (void)0
+#define PYOPENCV_TRACE_SPAN(phase)
+#define PYOPENCV_TRACE_SHAPE(name, m) (void)0
+
+#endif
+
+#endif // __PYTRACE_HPP__